@@ -3,6 +3,7 @@
 echo make_bench.sh will make the benchmark files 
 echo This should always be done on the same machine.
 echo All options should be enabled '(-e all)'
+echo For a benchmark that needs no NPS drives, run make bench '(see tests/bench.py)'
 for drive in nps-2009-domexusers nps-2009-ubnist1.gen3 nps-2010-emails nps-2009-casper-rw ; do
   #/bin/rm -rf $drive
   fn=/cor/drives/nps/`basename $drive .gen3`/$drive.E01
@@ -10,6 +10,7 @@ b.feature_files() = List of feature files
 b.histograms()    = List of histograms
 b.read_histogram() = Returns a dictionary of the histogram
 b.open(fname)     = Opens a feature file in the report
+b.open_mapped(fname) = Memory-maps a feature file in the report; see FeatureFile
 
 """
 
@@ -17,7 +18,7 @@ b.open(fname)     = Opens a feature file in the report
 __version__ = "1.3.0"
 
 b'This module needs Python 2.7 or later.'
-import zipfile,os,os.path,glob,codecs,re
+import zipfile,os,os.path,glob,codecs,re,mmap,struct,array
 
 property_re = re.compile("# ([a-z0-9\-_]+):(.*)",re.I)
 
@@ -90,6 +91,137 @@ def is_feature_filename(fname):
     if "wordlist" in fname: return False
     return None                 # don't know
 
+path_offset_re = re.compile(b"\\d+(?:-XOR(?:\\(0x[0-9a-fA-F]+\\))?-\\d+)*")
+path_xor_re = re.compile(b"-XOR(?:\\(0x[0-9a-fA-F]+\\))?-")
+
+def path_offset(path):
+    """Returns the image offset of a forensic path (bytes): its first number
+    plus the offset within each XOR part that follows, as XOR does not move
+    bytes. An XOR part may name its mask, as in XOR(0x5a).
+    Returns None if the path does not start with a number."""
+    m = path_offset_re.match(path)
+    if not m: return None
+    return sum(int(n) for n in path_xor_re.split(m.group(0)))
+
+FEATURE_INDEX_MAGIC = b"BEFIDX01"
+FEATURE_INDEX_HEADER = struct.Struct("<8sQQQ")
+
+class FeatureFile:
+    """A feature file that is memory-mapped and decoded only as it is used.
+    f[i] is line i as bytes without its newline (lines are numbered from 0
+    and include comments), f[i:j] is a list of lines, and len(f) is the
+    number of lines. f.record(i) splits line i into its fields, and
+    f.features_in_range(start,end) yields (line number, line) for each
+    feature whose image offset is in [start,end), in offset order.
+
+    The FILE.idx index that bulk_extractor writes beside FILE is used if it
+    is there and matches; otherwise the lines are found when the file is
+    opened, and the offsets when features_in_range() is first called.
+    """
+    def __init__(self,data,index=None,maps=()):
+        self.data  = data               # the feature file, as a memoryview
+        self.maps  = maps               # mmaps to close
+        self.index = None
+        self.by_offset = None
+        if index is not None and len(index)>=FEATURE_INDEX_HEADER.size:
+            (magic,size,lines,features) = FEATURE_INDEX_HEADER.unpack_from(index,0)
+            if (magic==FEATURE_INDEX_MAGIC and size==len(data)
+                and len(index)==FEATURE_INDEX_HEADER.size + (lines+1+features)*8):
+                self.index    = index
+                self.nlines   = lines
+                self.features = features
+        if self.index is None:
+            self.starts = array.array('Q',[0])
+            pos = 0
+            end = len(data)
+            raw = data.obj if isinstance(data.obj,mmap.mmap) and len(data)==len(data.obj) else bytes(data)
+            while pos<end:
+                nl = raw.find(b"\n",pos,end)
+                pos = end if nl<0 else nl+1
+                self.starts.append(pos)
+            self.nlines = len(self.starts)-1
+
+    @classmethod
+    def from_file(cls,fn):
+        """Memory-maps the feature file fn and its fn.idx, if there is one."""
+        maps = []
+        with open(fn,'rb') as f:
+            if os.fstat(f.fileno()).st_size==0:
+                return cls(memoryview(b""))
+            maps.append(mmap.mmap(f.fileno(),0,access=mmap.ACCESS_READ))
+        index = None
+        try:
+            with open(fn+".idx",'rb') as f:
+                maps.append(mmap.mmap(f.fileno(),0,access=mmap.ACCESS_READ))
+                index = memoryview(maps[-1])
+        except (IOError,OSError,ValueError):
+            pass
+        return cls(memoryview(maps[0]),index,maps)
+
+    def close(self):
+        self.data.release()
+        if self.index is not None: self.index.release()
+        for m in self.maps: m.close()
+        self.maps = ()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self,*args):
+        self.close()
+
+    def __len__(self):
+        return self.nlines
+
+    def line_start(self,i):
+        """Returns the offset of line i in the file; line_start(len(self)) is its size."""
+        if self.index is None: return self.starts[i]
+        return struct.unpack_from("<Q",self.index,FEATURE_INDEX_HEADER.size+i*8)[0]
+
+    def __getitem__(self,i):
+        if isinstance(i,slice):
+            return [self[j] for j in range(*i.indices(self.nlines))]
+        if i<0: i += self.nlines
+        if i<0 or i>=self.nlines: raise IndexError("line out of range")
+        line = self.data[self.line_start(i):self.line_start(i+1)].tobytes()
+        if line.endswith(b"\n"): line = line[:-1]
+        return line
+
+    def record(self,i):
+        """Returns the fields of line i: (path, feature, context) for a feature line."""
+        return tuple(self[i].split(b"\t"))
+
+    def _feature_line(self,k):
+        """Returns the line number of the k'th feature in offset order."""
+        if self.by_offset is not None: return self.by_offset[k]
+        off = FEATURE_INDEX_HEADER.size + (self.nlines+1+k)*8
+        return struct.unpack_from("<Q",self.index,off)[0]
+
+    def features_in_range(self,start,end):
+        if self.index is None and self.by_offset is None:
+            pairs = []
+            for i in range(self.nlines):
+                line = self[i]
+                if is_comment_line(line) or b"\t" not in line: continue
+                off = path_offset(line[:line.find(b"\t")])
+                if off is not None: pairs.append((off,i))
+            pairs.sort()
+            self.by_offset = array.array('Q',[i for (off,i) in pairs])
+            self.features  = len(pairs)
+        def offset_of(k):
+            line = self[self._feature_line(k)]
+            return path_offset(line[:line.find(b"\t")])
+        lo, hi = 0, self.features
+        while lo<hi:                    # the first feature at or after start
+            mid = (lo+hi)//2
+            if offset_of(mid)<start: lo = mid+1
+            else: hi = mid
+        for k in range(lo,self.features):
+            i = self._feature_line(k)
+            line = self[i]
+            if path_offset(line[:line.find(b"\t")])>=end: break
+            yield (i,line)
+
 
 class BulkReport:
     """Creates an object from a bulk_extractor report. The report can be a directory or a ZIP of a directory.
@@ -158,6 +290,29 @@ class BulkReport:
         f.bulk_extractor_reader = self
         return f
 
+    def open_mapped(self,fname):
+        """Returns a FeatureFile for a named file in the bulk report, which is
+        memory-mapped rather than read. In a ZIP file, the member must be stored
+        uncompressed."""
+        if not self.zipfile:
+            return FeatureFile.from_file(os.path.join(self.dname,fname))
+        with open(self.name,'rb') as f:
+            zmap = mmap.mmap(f.fileno(),0,access=mmap.ACCESS_READ)
+        def member(name):
+            info = self.zipfile.getinfo(name)
+            if info.compress_type!=zipfile.ZIP_STORED:
+                raise ValueError(name+" is compressed and cannot be memory-mapped")
+            (namelen,extralen) = struct.unpack_from("<HH",zmap,info.header_offset+26)
+            start = info.header_offset + 30 + namelen + extralen
+            return memoryview(zmap)[start:start+info.file_size]
+        index = None
+        if fname+".idx" in self.map:
+            try:
+                index = member(self.map[fname+".idx"])
+            except ValueError:
+                pass
+        return FeatureFile(member(self.map[fname]),index,[zmap])
+
     def is_histogram_file(self,fn):
         if is_histogram_filename(fn)==True: return True
         for line in self.open(fn,'rb'):
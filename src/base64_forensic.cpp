@@ -53,6 +53,10 @@
 #include <sys/types.h>
 #include <sys/param.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 #define Assert(Cond) if (!(Cond)) abort()
 
@@ -60,6 +64,15 @@ static const char Base64[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char Pad64 = '=';
 
+/* The value of each character in Base64, or -1 if it is not in the alphabet */
+static signed char b64_value[256];
+static struct b64_value_init {
+    b64_value_init() {
+	memset(b64_value,-1,sizeof(b64_value));
+	for (int i=0; Base64[i]; i++) b64_value[(unsigned char)Base64[i]] = i;
+    }
+} b64_value_init_;
+
 /* (From RFC1521 and draft-ietf-dnssec-secext-03.txt)
    The following encoding technique is taken from RFC 1521 by Borenstein
    and Freed.  It is reproduced here in a slightly edited form for
@@ -127,13 +140,75 @@ static const char Pad64 = '=';
 /* we don't report errors */
 #define puts(x) {}
 
+/*
+ * Fast paths for runs of whole quanta, used only at a quantum boundary.
+ * They decode 4 (or, with SSE2, 16) alphabet characters at once and write
+ * exactly what the character-at-a-time loop below would have written.
+ * They return false, having written nothing, if any character is outside
+ * the alphabet (whitespace, padding, NUL or junk); the slow loop then takes
+ * over and applies the forensic rules.
+ */
+static inline bool b64_decode4(const char *src, unsigned char *dst)
+{
+	int a = b64_value[(unsigned char)src[0]];
+	int b = b64_value[(unsigned char)src[1]];
+	int c = b64_value[(unsigned char)src[2]];
+	int d = b64_value[(unsigned char)src[3]];
+	if ((a|b|c|d) < 0) return false;
+	unsigned int v = (a<<18) | (b<<12) | (c<<6) | d;
+	dst[0] = v >> 16;
+	dst[1] = v >> 8;
+	dst[2] = v;
+	return true;
+}
+
+#ifdef __SSE2__
+static inline __m128i b64_in_range(__m128i c, char lo, char hi)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(c,_mm_set1_epi8(lo-1)),_mm_cmplt_epi8(c,_mm_set1_epi8(hi+1)));
+}
+
+static inline bool b64_decode16(const char *src, unsigned char *dst)
+{
+	const __m128i c     = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+	const __m128i upper = b64_in_range(c,'A','Z');
+	const __m128i lower = b64_in_range(c,'a','z');
+	const __m128i digit = b64_in_range(c,'0','9');
+	const __m128i plus  = _mm_cmpeq_epi8(c,_mm_set1_epi8('+'));
+	const __m128i slash = _mm_cmpeq_epi8(c,_mm_set1_epi8('/'));
+	const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper,lower),digit),_mm_or_si128(plus,slash));
+	if (_mm_movemask_epi8(valid) != 0xffff) return false;
+
+	/* translate to 6-bit values */
+	__m128i delta = _mm_or_si128(_mm_and_si128(upper,_mm_set1_epi8(-'A')),
+				     _mm_and_si128(lower,_mm_set1_epi8(26-'a')));
+	delta = _mm_or_si128(delta,_mm_and_si128(digit,_mm_set1_epi8(52-'0')));
+	delta = _mm_or_si128(delta,_mm_and_si128(plus,_mm_set1_epi8(62-'+')));
+	delta = _mm_or_si128(delta,_mm_and_si128(slash,_mm_set1_epi8(63-'/')));
+	const __m128i v = _mm_add_epi8(c,delta);
+
+	/* pack: two 6-bit values into 12 bits, then two 12-bit values into 24 bits */
+	const __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v,_mm_set1_epi16(0x00ff)),6),
+					   _mm_srli_epi16(v,8));
+	const __m128i quads = _mm_madd_epi16(pairs,_mm_set1_epi32(0x00011000));
+	unsigned int q[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(q),quads);
+	for (int i=0; i<4; i++) {
+	    dst[i*3+0] = q[i] >> 16;
+	    dst[i*3+1] = q[i] >> 8;
+	    dst[i*3+2] = q[i];
+	}
+	return true;
+}
+#endif
+
 extern "C" int b64_pton_forensic(const char *src, int srclen, unsigned char *target, size_t targsize);
 extern "C"
 int
 b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t targsize)
 {
 	int tarindex=0, state=0, ch=0;
-	char *pos=0;
+	int pos=0;
 
 	state = 0;
 	tarindex = 0;
@@ -141,19 +216,33 @@ b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t tar
 	// bug found by SLG on 2012-07-26:
 	// while ((ch = *src++) != '\0' && srclen>0){
 	// should be:
-	while (srclen>0 && (ch = *src++) != '\0' ){
+	while (srclen>0){
+	    if (state==0 && target) {
+		const char *start = src;
+#ifdef __SSE2__
+		while (srclen>=16 && (size_t)tarindex+12<=targsize && b64_decode16(src,target+tarindex)) {
+		    src += 16;
+		    srclen -= 16;
+		    tarindex += 12;
+		}
+#endif
+		while (srclen>=4 && (size_t)tarindex+3<=targsize && b64_decode4(src,target+tarindex)) {
+		    src += 4;
+		    srclen -= 4;
+		    tarindex += 3;
+		}
+		if (src != start) ch = src[-1];
+		if (srclen<=0) break;
+	    }
+	    if ((ch = *src++) == '\0') break;
 	    srclen--;
 		if (isspace(ch))	/* Skip whitespace anywhere. */
 			continue;
 
 		if (ch == Pad64) break;
 
-#ifdef HAVE_CONFORMING_STRCHR
-		pos = strchr(Base64, ch);
-#else
-		pos = strchr((char *)Base64, ch);
-#endif
-		if (pos == 0){ 		/* A non-base64 character. */
+		pos = b64_value[(unsigned char)ch];
+		if (pos < 0){ 		/* A non-base64 character. */
 		    puts("B64 Fail at 1");
 		    /* return (-1);*/
 		    return tarindex;
@@ -167,7 +256,7 @@ b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t tar
 				/* return (-1); */
 				return tarindex;
 			    }
-			    target[tarindex] = (pos - Base64) << 2;
+			    target[tarindex] = pos << 2;
 			}
 			state = 1;
 			break;
@@ -179,8 +268,8 @@ b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t tar
 				return tarindex;
 				
 			    }
-			    target[tarindex]   |=  (pos - Base64) >> 4;
-			    target[tarindex+1]  = ((pos - Base64) & 0x0f) << 4 ;
+			    target[tarindex]   |=  pos >> 4;
+			    target[tarindex+1]  = (pos & 0x0f) << 4 ;
 			}
 			tarindex++;
 			state = 2;
@@ -192,8 +281,8 @@ b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t tar
 				/* return (-1);*/
 				return tarindex;
 			    }
-			    target[tarindex]   |=  (pos - Base64) >> 2;
-			    target[tarindex+1]  = ((pos - Base64) & 0x03) << 6;
+			    target[tarindex]   |=  pos >> 2;
+			    target[tarindex+1]  = (pos & 0x03) << 6;
 			}
 			tarindex++;
 			state = 3;
@@ -205,7 +294,7 @@ b64_pton_forensic(char const *src, int srclen, unsigned char *target, size_t tar
 				/* return (-1); */
 				return tarindex;
 			    }
-			    target[tarindex] |= (pos - Base64);
+			    target[tarindex] |= pos;
 			}
 			tarindex++;
 			state = 0;
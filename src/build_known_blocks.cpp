@@ -0,0 +1,145 @@
+/*
+ * build_known_blocks.cpp:
+ * Build the known blocks file read by bulk_extractor -k.
+ *
+ * Input is either lists of hex MD5 block hashes, one per line (the first
+ * 32 hex digits of each line are used, so md5deep -p output works), or,
+ * with -r, files whose aligned blocks are hashed directly.
+ */
+
+#include "bulk_extractor.h"
+#include "known_blocks.h"
+#include "dfxml/src/hash_t.h"
+
+#include <iostream>
+#include <fstream>
+
+static uint32_t block_size = 4096;
+
+static void usage()
+{
+    std::cerr << "usage: build_known_blocks [options] outfile [infile ...]\n"
+              << "   -b size  - block size in bytes (default " << block_size << ")\n"
+              << "   -r       - infiles are raw data to hash block by block, not MD5 lists\n"
+              << "   -h       - print this message\n"
+              << "With no infile, MD5 lists are read from stdin.\n";
+}
+
+static int hexval(int ch)
+{
+    if(ch>='0' && ch<='9') return ch-'0';
+    if(ch>='a' && ch<='f') return ch-'a'+10;
+    if(ch>='A' && ch<='F') return ch-'A'+10;
+    return -1;
+}
+
+/* Append the digest from a line of an MD5 list; return false if the line has none */
+static bool parse_md5_line(const std::string &line,std::vector<uint8_t> &digests)
+{
+    size_t start = 0;
+    while(start<line.size() && isspace(line[start])) start++;
+    if(start+32>line.size()) return false;
+    uint8_t d[16];
+    for(size_t i=0;i<16;i++){
+        int hi = hexval(line[start+i*2]);
+        int lo = hexval(line[start+i*2+1]);
+        if(hi<0 || lo<0) return false;
+        d[i] = (hi<<4) | lo;
+    }
+    if(start+32<line.size() && hexval(line[start+32])>=0) return false; // longer than an MD5
+    digests.insert(digests.end(),d,d+16);
+    return true;
+}
+
+static void read_md5_list(std::istream &in,const std::string &name,std::vector<uint8_t> &digests)
+{
+    std::string line;
+    uint64_t lineno = 0;
+    uint64_t skipped = 0;
+    while(getline(in,line)){
+        lineno++;
+        if(line.size()==0 || line[0]=='#') continue;
+        if(!parse_md5_line(line,digests)) skipped++;
+    }
+    if(skipped) std::cerr << name << ": " << skipped << " of " << lineno << " lines had no MD5\n";
+}
+
+static void hash_raw_file(const std::string &fname,std::vector<uint8_t> &digests)
+{
+    std::ifstream in(fname.c_str(),std::ios::binary);
+    if(!in.is_open()) err(1,"%s",fname.c_str());
+    std::vector<uint8_t> buf(block_size);
+    while(in.read(reinterpret_cast<char *>(&buf[0]),block_size)){
+        md5_t md5 = md5_generator::hash_buf(&buf[0],block_size);
+        digests.insert(digests.end(),md5.digest,md5.digest+16);
+    }
+}
+
+/* Sort the 16-byte digests and drop duplicates */
+struct digest_less {
+    const uint8_t *base;
+    digest_less(const uint8_t *b):base(b){}
+    bool operator()(uint64_t a,uint64_t b) const { return memcmp(base+a*16,base+b*16,16)<0; }
+};
+
+static void sort_unique(std::vector<uint8_t> &digests)
+{
+    uint64_t count = digests.size()/16;
+    std::vector<uint64_t> order(count);
+    for(uint64_t i=0;i<count;i++) order[i] = i;
+    std::sort(order.begin(),order.end(),digest_less(count ? &digests[0] : 0));
+
+    std::vector<uint8_t> out;
+    out.reserve(digests.size());
+    for(uint64_t i=0;i<count;i++){
+        const uint8_t *d = &digests[order[i]*16];
+        if(out.size()>=16 && memcmp(&out[out.size()-16],d,16)==0) continue;
+        out.insert(out.end(),d,d+16);
+    }
+    digests.swap(out);
+}
+
+int main(int argc,char **argv)
+{
+    bool opt_raw = false;
+    int ch;
+    while((ch = getopt(argc,argv,"b:rh")) != -1){
+        switch(ch){
+        case 'b':
+            block_size = atoi(optarg);
+            if(block_size==0) errx(1,"block size must be positive");
+            break;
+        case 'r': opt_raw = true; break;
+        case 'h': usage(); exit(0);
+        default:  usage(); exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc<1){
+        usage();
+        exit(1);
+    }
+    std::string outfile = argv[0];
+
+    std::vector<uint8_t> digests;
+    if(argc==1){
+        if(opt_raw) errx(1,"-r requires input files");
+        read_md5_list(std::cin,"stdin",digests);
+    }
+    for(int i=1;i<argc;i++){
+        if(opt_raw){
+            hash_raw_file(argv[i],digests);
+            continue;
+        }
+        std::ifstream in(argv[i]);
+        if(!in.is_open()) err(1,"%s",argv[i]);
+        read_md5_list(in,argv[i],digests);
+    }
+    sort_unique(digests);
+
+    uint64_t count = digests.size()/16;
+    known_blocks::write_file(outfile,block_size,count ? &digests[0] : 0,count);
+    std::cout << outfile << ": " << count << " known blocks of " << block_size << " bytes\n";
+    return 0;
+}
@@ -0,0 +1,607 @@
+/*
+ * bulk_diff.cpp:
+ * Report the histogram values that changed between two bulk_extractor runs.
+ *
+ * A native version of python/bulk_diff.py with the same text and HTML
+ * output. Instead of loading both histograms into memory, each one is
+ * sorted by value with a bounded-memory external sort and the two are
+ * merge-joined; the changed values are sorted for output the same way.
+ * The histogram pairs are diffed in parallel, each into a temporary
+ * file, and the results are written out in order.
+ */
+
+#include "bulk_extractor.h"
+#include "line_reader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <pthread.h>
+
+#ifdef HAVE_EXPAT_H
+#include <expat.h>
+#endif
+
+static const char *bulk_diff_version = "1.3";
+static bool opt_smaller = false;
+static bool opt_html = false;
+static size_t sort_memory = 256*1024*1024;	// divided among the threads
+
+/****************************************************************
+ *** External sort
+ ****************************************************************/
+
+/* A histogram entry (v1 is the count and v2 its line) or a row of the output */
+struct diff_row {
+    int64_t v1;
+    int64_t v2;
+    std::string value;
+    diff_row():v1(0),v2(0),value(){}
+};
+
+/* Histogram entries by value; the last of a value is the one that counts */
+struct value_less {
+    bool operator()(const diff_row &a,const diff_row &b) const {
+        int r = a.value.compare(b.value);
+        if(r!=0) return r<0;
+        return a.v2<b.v2;
+    }
+};
+
+/* Output rows by increase, then value, then the counts, as bulk_diff.py sorts them */
+struct output_less {
+    bool operator()(const diff_row &a,const diff_row &b) const {
+        int64_t da = a.v2-a.v1;
+        int64_t db = b.v2-b.v1;
+        if(da!=db) return da>db;
+        int r = a.value.compare(b.value);
+        if(r!=0) return r<0;
+        if(a.v2!=b.v2) return a.v2<b.v2;
+        return a.v1<b.v1;
+    }
+};
+
+/**
+ * Sorts rows in memory up to a limit, spilling sorted runs to temporary
+ * files beyond it, and returns them in order with a k-way merge.
+ */
+template <class Less> class external_sorter {
+    /* A sorted run in a temporary file, and the next row read from it */
+    struct run_reader {
+        FILE *f;
+        diff_row cur;
+        run_reader(FILE *f_):f(f_),cur(){}
+        ~run_reader(){fclose(f);}
+    private:
+        run_reader(const run_reader &);
+        run_reader &operator=(const run_reader &);
+    };
+    /* For the heap, which puts the greatest first */
+    struct reader_greater {
+        const std::vector<run_reader *> &readers;
+        reader_greater(const std::vector<run_reader *> &readers_):readers(readers_){}
+        bool operator()(size_t a,size_t b) const {
+            return Less()(readers[b]->cur,readers[a]->cur);
+        }
+    };
+
+    size_t limit;
+    std::vector<diff_row> buf;
+    size_t buf_bytes;
+    size_t next_in_buf;
+    std::vector<run_reader *> readers;
+    std::vector<size_t> heap;
+
+    static void write_row(FILE *f,const diff_row &r){
+        uint32_t len = r.value.size();
+        if(fwrite(&r.v1,sizeof(r.v1),1,f)!=1 || fwrite(&r.v2,sizeof(r.v2),1,f)!=1 ||
+           fwrite(&len,sizeof(len),1,f)!=1 || fwrite(r.value.data(),1,len,f)!=len){
+            err(1,"tmpfile");
+        }
+    }
+    static bool read_row(FILE *f,diff_row &r){
+        uint32_t len;
+        if(fread(&r.v1,sizeof(r.v1),1,f)!=1) return false;
+        if(fread(&r.v2,sizeof(r.v2),1,f)!=1 || fread(&len,sizeof(len),1,f)!=1) errx(1,"tmpfile: truncated");
+        r.value.resize(len);
+        if(len>0 && fread(&r.value[0],1,len,f)!=len) errx(1,"tmpfile: truncated");
+        return true;
+    }
+    void spill(){
+        std::sort(buf.begin(),buf.end(),Less());
+        FILE *f = tmpfile();
+        if(!f) err(1,"tmpfile");
+        readers.push_back(new run_reader(f));
+        for(size_t i=0;i<buf.size();i++) write_row(f,buf[i]);
+        if(fflush(f) || fseek(f,0,SEEK_SET)) err(1,"tmpfile");
+        buf.clear();
+        buf_bytes = 0;
+    }
+    external_sorter(const external_sorter &);
+    external_sorter &operator=(const external_sorter &);
+public:
+    external_sorter(size_t limit_):limit(limit_),buf(),buf_bytes(0),next_in_buf(0),readers(),heap(){}
+    ~external_sorter(){
+        for(size_t i=0;i<readers.size();i++) delete readers[i];
+    }
+
+    void add(const diff_row &r){
+        buf.push_back(r);
+        buf_bytes += sizeof(diff_row) + r.value.size();
+        if(buf_bytes>=limit) spill();
+    }
+
+    /* Call after the last add() */
+    void finish(){
+        if(readers.size()==0){		// it all fit
+            std::sort(buf.begin(),buf.end(),Less());
+            return;
+        }
+        if(buf.size()>0) spill();
+        for(size_t i=0;i<readers.size();i++){
+            if(read_row(readers[i]->f,readers[i]->cur)) heap.push_back(i);
+        }
+        std::make_heap(heap.begin(),heap.end(),reader_greater(readers));
+    }
+
+    /* Set r to the next row in order; return false when there are none left */
+    bool next(diff_row &r){
+        if(readers.size()==0){
+            if(next_in_buf>=buf.size()) return false;
+            r = buf[next_in_buf++];
+            return true;
+        }
+        if(heap.size()==0) return false;
+        std::pop_heap(heap.begin(),heap.end(),reader_greater(readers));
+        size_t i = heap.back();
+        r = readers[i]->cur;
+        if(read_row(readers[i]->f,readers[i]->cur)){
+            std::push_heap(heap.begin(),heap.end(),reader_greater(readers));
+        } else {
+            heap.pop_back();
+        }
+        return true;
+    }
+};
+
+/* Yields the entries of a histogram file in value order, one per value */
+class histogram_reader {
+    external_sorter<value_less> sorter;
+    diff_row pending;
+    bool have_pending;
+public:
+    histogram_reader(const std::string &fn,size_t limit):sorter(limit),pending(),have_pending(false){
+        FILE *f = fopen(fn.c_str(),"rb");
+        if(!f) err(1,"%s",fn.c_str());
+        line_reader lr(f);
+        const char *line;
+        size_t len;
+        int64_t lineno = 0;
+        diff_row r;
+        while(lr.getline(line,len)){
+            lineno++;
+            /* n=COUNT\tVALUE, where VALUE is the rest of the line */
+            if(len<4 || line[0]!='n' || line[1]!='=') continue;
+            size_t i = 2;
+            int64_t count = 0;
+            while(i<len && line[i]>='0' && line[i]<='9') count = count*10 + (line[i++]-'0');
+            if(i==2 || i>=len || line[i]!='\t') continue;
+            i++;
+            if(line[len-1]=='\n') len--;
+            r.v1 = count;
+            r.v2 = lineno;
+            r.value.assign(line+i,line+(len>i ? len : i));
+            sorter.add(r);
+        }
+        fclose(f);
+        sorter.finish();
+        have_pending = sorter.next(pending);
+    }
+    bool next(diff_row &r){
+        if(!have_pending) return false;
+        r = pending;
+        while((have_pending = sorter.next(pending)) && pending.value==r.value){
+            r = pending;			// a later line for the same value replaces it
+        }
+        return true;
+    }
+};
+
+/****************************************************************
+ *** Typesetting, as python/ttable.py does it
+ ****************************************************************/
+
+/* The width of a UTF-8 string in characters */
+static size_t text_width(const std::string &s)
+{
+    size_t w = 0;
+    for(size_t i=0;i<s.size();i++) if(((uint8_t)s[i] & 0xc0)!=0x80) w++;
+    return w;
+}
+
+static std::string commas(int64_t i)
+{
+    if(i<0) return "-" + commas(-i);
+    char buf[32];
+    if(i<1000){
+        snprintf(buf,sizeof(buf),"%" PRId64,i);
+        return buf;
+    }
+    snprintf(buf,sizeof(buf),",%03d",(int)(i%1000));
+    return commas(i/1000) + buf;
+}
+
+static void pad(FILE *out,size_t n)
+{
+    for(size_t i=0;i<n;i++) fputc(' ',out);
+}
+
+/**
+ * Write a row of cells. In text, each cell is padded to its column's
+ * width (on the left if right is set, and never for the last column).
+ * In HTML, which ttable always marks right-aligned unless a column is
+ * set to left, the alignment goes in the style.
+ */
+static void typeset_row(FILE *out,const std::vector<std::string> &cells,const std::vector<size_t> &widths,
+                        const std::vector<bool> &right,const char *delim)
+{
+    if(opt_html) fputs("<tr>",out);
+    for(size_t c=0;c<cells.size();c++){
+        if(c>0) fputc(' ',out);
+        if(opt_html){
+            fprintf(out,"<%s %s>",delim,right[c] ? "style='text-align:right;'" : "");
+            fputs(cells[c].c_str(),out);
+            fprintf(out,"</%s>",delim);
+            continue;
+        }
+        size_t fill = widths[c]-text_width(cells[c]);
+        if(right[c]) pad(out,fill);
+        fputs(cells[c].c_str(),out);
+        if(!right[c] && c+1<cells.size()) pad(out,fill);
+    }
+    if(opt_html) fputs("</tr>\n",out);	// ttable ends HTML rows with two newlines
+    fputc('\n',out);
+}
+
+/****************************************************************
+ *** Diffing one histogram
+ ****************************************************************/
+
+struct hist_task {
+    std::string name;
+    std::string pre;			// paths of the two histograms
+    std::string post;
+    FILE *out;				// the table, if there is one
+    uint64_t diffcount;
+    hist_task(const std::string &name_,const std::string &pre_,const std::string &post_):
+        name(name_),pre(pre_),post(post_),out(0),diffcount(0){}
+    ~hist_task(){
+        if(out) fclose(out);
+    }
+private:
+    hist_task(const hist_task &);
+    hist_task &operator=(const hist_task &);
+};
+
+static void diff_histogram(hist_task &t,size_t limit)
+{
+    /* Merge-join the two histograms in value order */
+    histogram_reader h1(t.pre,limit/3);
+    histogram_reader h2(t.post,limit/3);
+    external_sorter<output_less> rows(limit/3);
+    diff_row a,b,r;
+    bool have_a = h1.next(a);
+    bool have_b = h2.next(b);
+    size_t widths[4] = {8,9,1,5};	// of the headings
+    uint64_t nrows = 0;
+    while(have_a || have_b){
+        int c = !have_a ? 1 : !have_b ? -1 : a.value.compare(b.value);
+        if(c<0){
+            r.v1 = a.v1; r.v2 = 0; r.value.swap(a.value);
+            have_a = h1.next(a);
+        } else if(c>0){
+            r.v1 = 0; r.v2 = b.v1; r.value.swap(b.value);
+            have_b = h2.next(b);
+        } else {
+            r.v1 = a.v1; r.v2 = b.v1; r.value.swap(a.value);
+            have_a = h1.next(a);
+            have_b = h2.next(b);
+        }
+        if(r.v1!=r.v2) t.diffcount++;
+        if(r.v2<=r.v1 && !opt_smaller) continue;
+        widths[0] = std::max(widths[0],commas(r.v1).size());
+        widths[1] = std::max(widths[1],commas(r.v2).size());
+        widths[2] = std::max(widths[2],commas(r.v2-r.v1).size());
+        widths[3] = std::max(widths[3],text_width(r.value));
+        rows.add(r);
+        nrows++;
+    }
+    rows.finish();
+    if(nrows==0) return;
+
+    t.out = tmpfile();
+    if(!t.out) err(1,"tmpfile");
+    std::vector<size_t> w(widths,widths+4);
+    std::vector<bool> right(4,true);
+    right[3] = false;
+    std::vector<std::string> cells(4);
+    if(opt_html){
+        fputs("<table>\n",t.out);
+    } else {
+        fprintf(t.out,"%s:\n",t.name.c_str());
+    }
+    cells[0] = "# in PRE";
+    cells[1] = "# in POST";
+    cells[2] = "\xe2\x88\x86";		// increment
+    cells[3] = "Value";
+    typeset_row(t.out,cells,w,right,"th");
+    if(!opt_html){
+        for(size_t i=0;i<w[0]+w[1]+w[2]+w[3]+3;i++) fputc('-',t.out);
+        fputc('\n',t.out);
+    }
+    while(rows.next(r)){
+        cells[0] = commas(r.v1);
+        cells[1] = commas(r.v2);
+        cells[2] = commas(r.v2-r.v1);
+        cells[3].swap(r.value);
+        typeset_row(t.out,cells,w,right,"td");
+    }
+    if(opt_html) fputs("</table>\n",t.out);
+    if(fflush(t.out) || fseek(t.out,0,SEEK_SET)) err(1,"tmpfile");
+}
+
+/* The histograms are handed out to the threads one at a time */
+struct work_queue {
+    std::vector<hist_task *> &tasks;
+    size_t limit;
+    size_t next;
+    pthread_mutex_t M;
+    work_queue(std::vector<hist_task *> &tasks_,size_t limit_):tasks(tasks_),limit(limit_),next(0),M(){
+        pthread_mutex_init(&M,NULL);
+    }
+    ~work_queue(){
+        pthread_mutex_destroy(&M);
+    }
+    hist_task *get(){
+        hist_task *ret = 0;
+        pthread_mutex_lock(&M);
+        if(next<tasks.size()) ret = tasks[next++];
+        pthread_mutex_unlock(&M);
+        return ret;
+    }
+private:
+    work_queue(const work_queue &);
+    work_queue &operator=(const work_queue &);
+};
+
+static void *worker(void *arg)
+{
+    work_queue &wq = *(work_queue *)arg;
+    hist_task *t;
+    while((t = wq.get())!=0){
+        diff_histogram(*t,wq.limit);
+    }
+    return 0;
+}
+
+/****************************************************************
+ *** Reports
+ ****************************************************************/
+
+/* The .txt files of a report directory */
+static std::set<std::string> report_files(const std::string &dir)
+{
+    std::set<std::string> ret;
+    DIR *d = opendir(dir.c_str());
+    if(!d) err(1,"%s",dir.c_str());
+    struct dirent *de;
+    while((de = readdir(d))!=0){
+        std::string fn = de->d_name;
+        if(fn.size()>4 && fn.substr(fn.size()-4)==".txt") ret.insert(fn);
+    }
+    closedir(d);
+    return ret;
+}
+
+/* Read the image_filename from a report's report.xml */
+class report_image_reader {
+    std::string cdata;
+    bool in_image_filename;
+    bool found;
+#ifdef HAVE_LIBEXPAT
+    static void startElement(void *userData,const char *name_,const char **){
+        report_image_reader &self = *(report_image_reader *)userData;
+        if(!self.found && strcmp(name_,"image_filename")==0) self.in_image_filename = true;
+    }
+    static void endElement(void *userData,const char *){
+        report_image_reader &self = *(report_image_reader *)userData;
+        if(self.in_image_filename){
+            self.in_image_filename = false;
+            self.found = true;
+        }
+    }
+    static void characterDataHandler(void *userData,const XML_Char *s,int len){
+        report_image_reader &self = *(report_image_reader *)userData;
+        if(self.in_image_filename) self.cdata.append(s,len);
+    }
+#endif
+public:
+    report_image_reader():cdata(),in_image_filename(false),found(false){}
+
+    std::string read(const std::string &dir){
+        std::string fn = dir + "/report.xml";
+#ifdef HAVE_LIBEXPAT
+        FILE *f = fopen(fn.c_str(),"rb");
+        if(!f) err(1,"%s",fn.c_str());
+        XML_Parser parser = XML_ParserCreate(NULL);
+        XML_SetUserData(parser, this);
+        XML_SetElementHandler(parser, startElement, endElement);
+        XML_SetCharacterDataHandler(parser,characterDataHandler);
+        std::vector<char> buf(65536);
+        size_t count;
+        while(!found && (count = fread(&buf[0],1,buf.size(),f))>0){
+            if(!XML_Parse(parser,&buf[0],count,0)){
+                errx(1,"%s: XML Error: %s at line %d",fn.c_str(),
+                     XML_ErrorString(XML_GetErrorCode(parser)),(int)XML_GetCurrentLineNumber(parser));
+            }
+        }
+        XML_ParserFree(parser);
+        fclose(f);
+        if(!found) errx(1,"%s: no image_filename",fn.c_str());
+        return cdata;
+#else
+        errx(1,"Compiled without libexpat; cannot read %s.",fn.c_str());
+#endif
+    }
+};
+
+static int default_threads()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n>0) return n;
+#endif
+    return 1;
+}
+
+static void usage()
+{
+    std::cerr << "usage: bulk_diff [options] <pre> <post>\n"
+              << "<pre> and <post> are bulk_extractor output directories.\n"
+              << "   -s           - also show values that didn't change or got smaller\n"
+              << "   -H file      - HTML output to file\n"
+              << "   -j NN        - number of threads (default " << default_threads() << ")\n"
+              << "   -m MB        - memory for sorting before using temporary files (default "
+              << sort_memory/(1024*1024) << ")\n"
+              << "   -h           - print this message\n";
+}
+
+int main(int argc,char **argv)
+{
+    std::string opt_htmlfile;
+    int num_threads = default_threads();
+    int ch;
+    while((ch = getopt(argc,argv,"sH:j:m:h")) != -1){
+        switch(ch){
+        case 's': opt_smaller = true; break;
+        case 'H': opt_htmlfile = optarg; opt_html = true; break;
+        case 'j':
+            num_threads = atoi(optarg);
+            if(num_threads<1) errx(1,"-j must be at least 1");
+            break;
+        case 'm':
+            if(atoi(optarg)<1) errx(1,"-m must be at least 1");
+            sort_memory = (size_t)atoi(optarg)*1024*1024;
+            break;
+        case 'h': usage(); exit(0);
+        default:  usage(); exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc!=2){
+        usage();
+        exit(1);
+    }
+    std::string dname1 = argv[0];
+    std::string dname2 = argv[1];
+
+    FILE *out = stdout;
+    if(opt_html){
+        out = fopen(opt_htmlfile.c_str(),"w");
+        if(!out) err(1,"%s",opt_htmlfile.c_str());
+        fputs("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\" \"http://www.w3.org/TR/html4/strict.dtd\">\n",out);
+        fputs("<html><head>\n",out);
+        fputs("<meta http-equiv=\"Content-Type\" content=\"text/html; charset=UTF-8\"/>\n",out);
+        fputs("</head><body>\n",out);
+    }
+
+    std::string image1 = report_image_reader().read(dname1);
+    std::string image2 = report_image_reader().read(dname2);
+    {
+        const char *labels[3] = {"bulk_diff.py Version:","PRE Image:","POST Image:"};
+        std::string values[3] = {bulk_diff_version,image1,image2};
+        std::vector<size_t> w(2,0);
+        std::vector<bool> right(2,false);
+        for(int i=0;i<3;i++) w[0] = std::max(w[0],strlen(labels[i]));
+        if(opt_html){
+            right[0] = right[1] = true;
+            fputs("<table>\n",out);
+        }
+        std::vector<std::string> cells(2);
+        for(int i=0;i<3;i++){
+            cells[0] = labels[i];
+            cells[1] = values[i];
+            typeset_row(out,cells,w,right,"td");
+        }
+        if(opt_html) fputs("</table>\n",out);
+    }
+
+    std::set<std::string> files1 = report_files(dname1);
+    std::set<std::string> files2 = report_files(dname2);
+    std::vector<std::string> only1,only2,common;
+    std::set_difference(files1.begin(),files1.end(),files2.begin(),files2.end(),std::back_inserter(only1));
+    std::set_difference(files2.begin(),files2.end(),files1.begin(),files1.end(),std::back_inserter(only2));
+    std::set_intersection(files1.begin(),files1.end(),files2.begin(),files2.end(),std::back_inserter(common));
+    fflush(out);
+    if(only1.size()>0){
+        std::cout << "Files only in " << dname1 << ":\n  ";
+        for(size_t i=0;i<only1.size();i++) std::cout << " " << only1[i];
+        std::cout << "\n";
+    }
+    if(only2.size()>0){
+        std::cout << "Files only in " << dname2 << ":\n  ";
+        for(size_t i=0;i<only2.size();i++) std::cout << " " << only2[i];
+        std::cout << "\n";
+    }
+    std::cout.flush();
+
+    std::vector<hist_task *> tasks;
+    for(size_t i=0;i<common.size();i++){
+        if(common[i].find("histogram")==std::string::npos) continue;
+        tasks.push_back(new hist_task(common[i],dname1 + "/" + common[i],dname2 + "/" + common[i]));
+    }
+
+    if(opt_html){
+        fputs("<ul>\n",out);
+        for(size_t i=0;i<tasks.size();i++){
+            fprintf(out,"<li><a href='#%s'>%s</a></li>\n",tasks[i]->name.c_str(),tasks[i]->name.c_str());
+        }
+        fputs("</ul>\n<hr/>\n",out);
+    }
+
+    if(num_threads>(int)tasks.size()) num_threads = tasks.size();
+    if(num_threads>0){
+        work_queue wq(tasks,sort_memory/num_threads);
+        std::vector<pthread_t> threads(num_threads);
+        for(int i=0;i<num_threads;i++){
+            if(pthread_create(&threads[i],NULL,worker,&wq)) errx(1,"pthread_create failed");
+        }
+        for(int i=0;i<num_threads;i++){
+            pthread_join(threads[i],NULL);
+        }
+    }
+
+    /* As in bulk_diff.py, "No differences" is reported until the first histogram that has some */
+    uint64_t diffcount = 0;
+    std::vector<char> buf(65536);
+    for(size_t i=0;i<tasks.size();i++){
+        hist_task &t = *tasks[i];
+        if(opt_html){
+            fprintf(out,"<h2><a name=\"%s\">%s</a></h2>\n",t.name.c_str(),t.name.c_str());
+        } else {
+            fputc('\n',out);
+        }
+        if(t.out){
+            size_t count;
+            while((count = fread(&buf[0],1,buf.size(),t.out))>0){
+                if(fwrite(&buf[0],1,count,out)!=count) err(1,"write");
+            }
+        }
+        diffcount += t.diffcount;
+        if(diffcount==0) fprintf(out,"%s: No differences\n\n",t.name.c_str());
+        delete tasks[i];			// closes its table
+    }
+    if(fclose(out)) err(1,"write");
+    return 0;
+}
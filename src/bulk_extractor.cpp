@@ -13,6 +13,12 @@
 #include "dfxml/src/hash_t.h"
 
 #include "phase1.h"
+#include "known_blocks.h"
+#include "feature_index.h"
+#include "page_cache.h"
+#include "path_cache.h"
+#include "trace.h"
+#include "scanner_stats.h"
 
 #include <dirent.h>
 #include <ctype.h>
@@ -23,6 +29,7 @@
 #include <queue>
 #include <unistd.h>
 #include <ctype.h>
+#include <signal.h>
 
 #ifdef HAVE_EXPAT_H
 #include <expat.h>
@@ -40,6 +47,19 @@
 #include <sys/sysctl.h>
 #endif
 
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 using namespace std;
 
 /****************************************************************
@@ -206,7 +226,48 @@ public:
     }
 } printing_done;
 
-void process_path_printer(const scanner_params &sp)
+/* The stream that process_path_printer prints to: std::cout unless a server thread has set its own */
+static pthread_key_t  path_output_key;
+/* The decoder now running in this thread, and the buffers it has passed to process_path_printer */
+struct path_decoding {
+    path_decoding(const std::string &path_):path(path_),children(0){}
+    const std::string path;		// of the buffers the decoder gives
+    int children;			// buffers given so far
+};
+static pthread_key_t  path_decoding_key;
+/* Set while process_open_path tries a cached buffer; errors are reported by the full decode that follows */
+static pthread_key_t  path_quiet_key;
+static pthread_once_t path_keys_once = PTHREAD_ONCE_INIT;
+static void path_keys_init()
+{
+    pthread_key_create(&path_output_key,0);
+    pthread_key_create(&path_decoding_key,0);
+    pthread_key_create(&path_quiet_key,0);
+}
+
+static std::ostream &path_output()
+{
+    pthread_once(&path_keys_once,path_keys_init);
+    std::ostream *os = static_cast<std::ostream *>(pthread_getspecific(path_output_key));
+    return os ? *os : std::cout;
+}
+
+static void set_path_output(std::ostream *os)
+{
+    pthread_once(&path_keys_once,path_keys_init);
+    pthread_setspecific(path_output_key,os);
+}
+
+static size_t process_path_cache_size = 256*1024*1024; // memory for decoded buffers
+static path_cache path_buffers(process_path_cache_size);
+
+void process_path_printer(const scanner_params &sp);
+
+/**
+ * Print the path in sp.sbuf.pos0.path, which is what remains to be
+ * resolved of a path whose first part, resolved, gave sp.sbuf.
+ */
+static void print_path(const scanner_params &sp,const std::string &resolved)
 {
     /* 1. Get next token 
      * 2. if prefix part is a number, skip forward that much in sbuf and repeat.
@@ -216,7 +277,7 @@ void process_path_printer(const scanner_params &sp)
      * 3. If we are print, throw an exception to prevent continued analysis of buffer.
      */
 
-    if(debug & DEBUG_PRINT_STEPS) cerr << "process_path_printer " << sp.sbuf.pos0.path << "\n";
+    if(debug & DEBUG_PRINT_STEPS) cerr << "process_path_printer " << resolved << " " << sp.sbuf.pos0.path << "\n";
     string new_path = sp.sbuf.pos0.path;
     string prefix = get_and_remove_token(new_path);
 
@@ -253,21 +314,22 @@ void process_path_printer(const scanner_params &sp)
 	    print_len = sp.sbuf.bufsize-print_start;
 	}
 
+	std::ostream &os = path_output();
 	switch(scanner_params::getPrintMode(sp.print_options)){
 	case scanner_params::MODE_HTTP:
-	    std::cout << "Content-Length: "		<< print_len  << HTTP_EOL;
-	    std::cout << "Content-Range: bytes "	<< print_start << "-" << print_start+print_len-1 << HTTP_EOL;
-	    std::cout << "X-Range-Available: bytes " << 0 << "-" << sp.sbuf.bufsize-1 << HTTP_EOL;
-	    std::cout << HTTP_EOL;
-	    sp.sbuf.raw_dump(std::cout,print_start,print_len); // send to stdout as binary
+	    os << "Content-Length: "		<< print_len  << HTTP_EOL;
+	    os << "Content-Range: bytes "	<< print_start << "-" << print_start+print_len-1 << HTTP_EOL;
+	    os << "X-Range-Available: bytes " << 0 << "-" << sp.sbuf.bufsize-1 << HTTP_EOL;
+	    os << HTTP_EOL;
+	    sp.sbuf.raw_dump(os,print_start,print_len); // send to stdout as binary
 	    break;
 	case scanner_params::MODE_RAW:
-	    std::cout << print_len << HTTP_EOL;
-	    std::cout.flush();
-	    sp.sbuf.raw_dump(std::cout,print_start,print_len); // send to stdout as binary
+	    os << print_len << HTTP_EOL;
+	    os.flush();
+	    sp.sbuf.raw_dump(os,print_start,print_len); // send to stdout as binary
 	    break;
 	case scanner_params::MODE_HEX:
-	    sp.sbuf.hex_dump(std::cout,print_start,print_len);
+	    sp.sbuf.hex_dump(os,print_start,print_len);
 	    break;
 	case scanner_params::MODE_NONE:
 	    break;
@@ -279,25 +341,65 @@ void process_path_printer(const scanner_params &sp)
     if(isdigit(prefix[0])){
 	uint64_t offset = stoi64(prefix);
 	if(offset>sp.sbuf.bufsize){
-	    printf("Error: %s only has %u bytes; can't offset to %u\n",
-		   new_path.c_str(),(unsigned int)sp.sbuf.bufsize,(unsigned int)offset);
+	    if(pthread_getspecific(path_quiet_key)==0){
+		printf("Error: %s only has %u bytes; can't offset to %u\n",
+		       new_path.c_str(),(unsigned int)sp.sbuf.bufsize,(unsigned int)offset);
+	    }
 	    return;
 	}
-	process_path_printer(scanner_params(scanner_params::PHASE_SCAN,
-					    sbuf_t(new_path,sp.sbuf+offset),
-					    sp.fs,sp.print_options));
+	print_path(scanner_params(scanner_params::PHASE_SCAN,
+                                  sbuf_t(new_path,sp.sbuf+offset),
+                                  sp.fs,sp.print_options),
+                   resolved + "-" + prefix);
 	return;
     }
-    /* Find the scanner and use it */
-    scanner_t *s = be13::plugin::find_scanner(lowerstr(prefix));
+    /* Find the scanner and use it; it passes what it decodes to process_path_printer.
+     * A part may give the scanner an argument, as in XOR(0x5a); the scanner gets the whole part.
+     */
+    scanner_t *s = be13::plugin::find_scanner(lowerstr(prefix.substr(0,prefix.find('('))));
     if(s){
-        (*s)(scanner_params(scanner_params::PHASE_SCAN,
-                            sbuf_t(new_path,sp.sbuf),
-                            sp.fs,sp.print_options),
-             recursion_control_block(process_path_printer,prefix));
+        path_decoding decoding(resolved + "-" + prefix);
+        void *outer = pthread_getspecific(path_decoding_key);
+        pthread_setspecific(path_decoding_key,&decoding);
+        try {
+            (*s)(scanner_params(scanner_params::PHASE_SCAN,
+                                sbuf_t(new_path,sp.sbuf),
+                                sp.fs,sp.print_options),
+                 recursion_control_block(process_path_printer,prefix));
+        }
+        catch (...) {
+            pthread_setspecific(path_decoding_key,outer);
+            throw;
+        }
+        pthread_setspecific(path_decoding_key,outer);
         return;
     }
-    cerr << "Unknown name in path: " << prefix << "\n";
+    if(pthread_getspecific(path_quiet_key)==0) cerr << "Unknown name in path: " << prefix << "\n";
+}
+
+/**
+ * The recursion callback for the decoders. A decoder may give several
+ * buffers (ZIP members, BASE64 blocks) under the same path, and the path
+ * is printed from the first one in which it resolves. The cache holds one
+ * buffer per path, so a buffer is cached only if it is the decoder's first;
+ * a lookup in the cache then resolves in the same buffer as a full decode.
+ */
+void process_path_printer(const scanner_params &sp)
+{
+    pthread_once(&path_keys_once,path_keys_init);
+    path_decoding *decoding = static_cast<path_decoding *>(pthread_getspecific(path_decoding_key));
+    if(decoding==0){
+        print_path(sp,"");
+        return;
+    }
+    bool first = decoding->children++ == 0;
+    try {
+        print_path(sp,decoding->path);
+    }
+    catch (path_printer_finished &e) {
+        if(first) path_buffers.put(decoding->path,sp.sbuf);
+        throw;
+    }
 }
 
 /**
@@ -307,49 +409,414 @@ void process_path_printer(const scanner_params &sp)
 
 
 static size_t process_path_bufsize = 1024*1024*16; // how much to read
-static void process_open_path(const image_process &p,string path,scanner_params::PrintOptions &po)
+
+/**
+ * Resolve path in the image and print it.
+ * buf is the caller's process_path_bufsize read buffer, which is reused between calls.
+ * Returns true if the path was printed.
+ */
+static bool process_open_path(const image_process &p,string path,scanner_params::PrintOptions &po,u_char *buf)
 {
     /* Check for "/r" in path which means print raw */
     if(path.size()>2 && path.substr(path.size()-2,2)=="/r"){
 	path = path.substr(0,path.size()-2);
     }
 
+    /* make up a bogus feature recorder set and with a disabled feature recorder.
+     * Then we call the path printer, which throws an exception after the printing
+     * to prevent further printing.
+     */
+    feature_recorder_set fs(feature_recorder_set::SET_DISABLED);
+
+    /* Start from the longest decoded part of the path that is cached */
+    string cached_prefix,rest;
+    path_cache::buffer cached = path_buffers.find_prefix(path,cached_prefix,rest);
+    if(cached){
+        if(debug & DEBUG_PRINT_STEPS) cerr << "process_open_path cached " << cached_prefix << "\n";
+        pos0_t pos0(rest+"-PRINT");
+        sbuf_t sbuf(pos0,cached->size() ? &(*cached)[0] : 0,cached->size(),cached->size(),false);
+        scanner_params sp(scanner_params::PHASE_SCAN,sbuf,fs,po);
+        pthread_once(&path_keys_once,path_keys_init);
+        pthread_setspecific(path_quiet_key,&cached);
+        try {
+            print_path(sp,cached_prefix);
+        }
+        catch (path_printer_finished &e) {
+            pthread_setspecific(path_quiet_key,0);
+            return true;
+        }
+        catch (...) {
+            pthread_setspecific(path_quiet_key,0);
+            throw;
+        }
+        pthread_setspecific(path_quiet_key,0);
+        /* The decoder may give other buffers that are not cached; decode again */
+    }
+
     string prefix = get_and_remove_token(path);
     int64_t offset = stoi64(prefix);
 
     /* Get the offset. process */
-    u_char *buf = (u_char *)calloc(process_path_bufsize,1);
-    if(!buf) errx(1,"Cannot allocate buffer");
     int count = p.pread(buf,process_path_bufsize,offset);
     if(count<0){
 	cerr << p.image_fname() << ": " << strerror(errno) << " (Read Error)\n";
-	return;
+	return false;
     }
 
-    /* make up a bogus feature recorder set and with a disabled feature recorder.
-     * Then we call the path printer, which throws an exception after the printing
-     * to prevent further printing.
-     */
-    feature_recorder_set fs(feature_recorder_set::SET_DISABLED);
-
     pos0_t pos0(path+"-PRINT"); // insert the PRINT token
-    sbuf_t sbuf(pos0,buf,count,count,true); // sbuf system will free
+    sbuf_t sbuf(pos0,buf,count,count,false); // buf belongs to the caller
     scanner_params sp(scanner_params::PHASE_SCAN,sbuf,fs,po);
     try {
-        process_path_printer(sp);
+        print_path(sp,prefix);
     }
     catch (path_printer_finished &e) {
+        return true;
     }
+    return false;
 }
 
+static u_char *alloc_path_buffer()
+{
+    u_char *buf = (u_char *)malloc(process_path_bufsize);
+    if(!buf) errx(1,"Cannot allocate buffer");
+    return buf;
+}
+
+/****************************************************************
+ *** Path server
+ ****************************************************************/
+
+/**
+ * The multi-client HTTP server for -p -http=<port>, which BEViewer can
+ * use in place of the one-request-at-a-time -p -http mode on stdin.
+ * It listens on 127.0.0.1. The main thread polls the listening socket
+ * and the open connections; a connection with a request waiting is
+ * handed to one of a pool of worker threads, which serves the request
+ * and then gives a kept-alive connection back to be polled, so that a
+ * worker is never held by an idle connection. Connections idle for
+ * longer than path_server_idle_timeout are closed.
+ * Each worker has its own image_process, so that workers read the image
+ * concurrently (the image readers keep file positions and are not
+ * shared), and reuses its own read and response buffers.
+ */
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_POLL_H)
+static const int path_server_idle_timeout = 60;	// seconds a kept-alive connection may be idle
+static const int path_server_io_timeout = 10;	// seconds a worker waits on a partial request or a full send
+static const size_t path_server_max_line = 65536;
+
+/* A streambuf that builds a response in memory; clear() keeps the memory for the next one */
+class response_buf: public std::streambuf {
+    std::vector<char> v;
+public:
+    response_buf():v(65536){ clear(); }
+    void clear(){ setp(&v[0],&v[0]+v.size()); }
+    const char *data() const { return pbase(); }
+    size_t size() const { return pptr()-pbase(); }
+protected:
+    virtual int_type overflow(int_type c){
+        size_t used = size();
+        v.resize(v.size()*2);
+        setp(&v[0],&v[0]+v.size());
+        pbump(used);
+        if(c!=traits_type::eof()){
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+};
+
+/* One client connection: buffered reads of request lines and writes of responses */
+class path_connection {
+    int fd;
+    char buf[8192];
+    size_t start,end;
+    path_connection(const path_connection &);
+    path_connection &operator=(const path_connection &);
+public:
+    time_t idle_since;			// when it was last given back to be polled
+    path_connection(int fd_):fd(fd_),start(0),end(0),idle_since(time(0)){}
+    ~path_connection(){ ::close(fd); }
+    int get_fd() const { return fd; }
+    bool buffered() const { return start<end; }	// part of a request has already been read
+
+    /* Read a line without its line ending; false at end of connection */
+    bool getline(std::string &line){
+        line.clear();
+        for(;;){
+            for(size_t i=start;i<end;i++){
+                if(buf[i]=='\n'){
+                    line.append(buf+start,i-start);
+                    start = i+1;
+                    truncate_at(line,'\r');
+                    return true;
+                }
+            }
+            line.append(buf+start,end-start);
+            start = end = 0;
+            if(line.size()>path_server_max_line) return false;
+            ssize_t r = recv(fd,buf,sizeof(buf),0);
+            if(r<0 && errno==EINTR) continue;
+            if(r<=0) return false;
+            end = r;
+        }
+    }
+
+    bool write(const char *data,size_t len){
+        while(len>0){
+            ssize_t r = send(fd,data,len,0);
+            if(r<0 && errno==EINTR) continue;
+            if(r<=0) return false;
+            data += r;
+            len  -= r;
+        }
+        return true;
+    }
+    bool write(const std::string &s){ return write(s.data(),s.size()); }
+};
+
+class path_server {
+    const char *fn;
+    size_t page_size;
+    pthread_mutex_t M;			// protects the following
+    pthread_cond_t  ready;
+    std::queue<path_connection *> requests;	// connections with a request waiting, for the workers
+    std::vector<path_connection *> kept;	// kept-alive connections, for the poller
+    int wake[2];			// a pipe; written when a connection is kept
+    path_server(const path_server &);
+    path_server &operator=(const path_server &);
+
+    path_connection *next_connection(){
+        pthread_mutex_lock(&M);
+        while(requests.empty()) pthread_cond_wait(&ready,&M);
+        path_connection *c = requests.front();
+        requests.pop();
+        pthread_mutex_unlock(&M);
+        return c;
+    }
+
+    void keep(path_connection *c){
+        c->idle_since = time(0);
+        pthread_mutex_lock(&M);
+        kept.push_back(c);
+        pthread_mutex_unlock(&M);
+        char ch = 0;
+        while(::write(wake[1],&ch,1)<0 && errno==EINTR){}
+    }
+
+    /* Serve one request on c; true if the connection is to be kept open */
+    bool serve_request(path_connection &c,image_process &p,u_char *buf,response_buf &rb,std::ostream &os){
+        std::string line;
+        do {
+            if(!c.getline(line)) return false;
+        } while(line.size()==0 && c.buffered());	// tolerate blank lines between requests
+        if(line.size()==0) return true;
+
+        std::string status;
+        size_t sp1 = line.find(' ');
+        size_t sp2 = line.rfind(' ');
+        std::string version = sp2==string::npos ? "" : line.substr(sp2+1);
+        if(line.substr(0,4)!="GET ")                    status = "501 Method not implemented";
+        else if(sp1==sp2)                               status = "400 Bad request";
+        else if(version!="HTTP/1.1" && version!="HTTP/1.0") status = "505 HTTP version not supported";
+        std::string url = sp1<sp2 ? line.substr(sp1+1,sp2-sp1-1) : "";
+
+        scanner_params::PrintOptions po;
+        scanner_params::setPrintMode(po,scanner_params::MODE_HTTP);
+        bool keep_alive = (version=="HTTP/1.1");
+        bool headers_done = false;
+        while(c.getline(line)){
+            if(line.size()==0){
+                headers_done = true;
+                break;
+            }
+            size_t colon = line.find(":");
+            if(colon==string::npos){
+                status = "400 Malformed HTTP request";
+                continue;
+            }
+            string name = line.substr(0,colon);
+            string val  = line.substr(colon+1);
+            while(val.size()>0 && (val[0]==' '||val[0]=='\t')) val = val.substr(1);
+            if(lowerstr(name)=="connection"){
+                if(lowerstr(val)=="close")      keep_alive = false;
+                if(lowerstr(val)=="keep-alive") keep_alive = true;
+            }
+            po[name]=val;
+        }
+        if(!headers_done) return false;
+
+        /* The URL is the path, with a leading / */
+        if(url.size()>0 && url[0]=='/') url = url.substr(1);
+        rb.clear();
+        if(status.size()==0){
+            if(url=="info"){
+                os << "X-Image-Size: " << p.image_size() << HTTP_EOL;
+                os << "X-Image-Filename: " << p.image_fname() << HTTP_EOL;
+                os << "Content-Length: 0" << HTTP_EOL;
+                os << HTTP_EOL;
+            } else if(url.size()==0 || !isdigit(url[0])){
+                status = "404 Not found";
+            } else if(!process_open_path(p,url,po,buf)){
+                status = "404 Path cannot be resolved";
+            }
+        }
+        os.flush();
+        if(status.size()==0){
+            if(!c.write("HTTP/1.1 200 OK" + HTTP_EOL)) return false;
+            if(!keep_alive && !c.write("Connection: close" + HTTP_EOL)) return false;
+            if(!c.write(rb.data(),rb.size())) return false;
+        } else {
+            keep_alive = false;
+            if(!c.write("HTTP/1.1 " + status + HTTP_EOL + "Connection: close" + HTTP_EOL
+                        + "Content-Length: 0" + HTTP_EOL + HTTP_EOL)) return false;
+        }
+        return keep_alive;
+    }
+
+    /* Serve the waiting request and any pipelined behind it, then keep or close the connection */
+    void serve(path_connection *c,image_process &p,u_char *buf,response_buf &rb,std::ostream &os){
+        bool keep_alive;
+        do {
+            keep_alive = serve_request(*c,p,buf,rb,os);
+        } while(keep_alive && c->buffered());
+        if(keep_alive) keep(c);
+        else delete c;
+    }
+
+    void worker(){
+        image_process *p = image_process::open(fn,0,page_size,0);
+        if(p==0) errx(1,"Filename %s is invalid",fn);
+        u_char *buf = alloc_path_buffer();
+        response_buf rb;
+        std::ostream os(&rb);
+        set_path_output(&os);
+        for(;;){
+            serve(next_connection(),*p,buf,rb,os);
+        }
+    }
+    static void *worker_main(void *arg){
+        static_cast<path_server *>(arg)->worker();
+        return 0;
+    }
+
+    void accept_connection(int s,std::vector<path_connection *> &polled){
+        int fd = accept(s,0,0);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED || errno==EAGAIN || errno==EWOULDBLOCK) return;
+            err(1,"accept");
+        }
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0) & ~O_NONBLOCK);	// BSD accept() inherits O_NONBLOCK
+        struct timeval tv;
+        tv.tv_sec  = path_server_io_timeout;
+        tv.tv_usec = 0;
+        setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+        setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+        polled.push_back(new path_connection(fd));
+    }
+
+public:
+    path_server(const char *fn_,size_t page_size_):fn(fn_),page_size(page_size_),M(),ready(),requests(),kept(){
+        pthread_mutex_init(&M,0);
+        pthread_cond_init(&ready,0);
+        if(pipe(wake)) err(1,"pipe");
+        fcntl(wake[0],F_SETFL,fcntl(wake[0],F_GETFL,0) | O_NONBLOCK);
+    }
+
+    /* Listen on 127.0.0.1:port (any free port if port is 0) and serve forever */
+    void run(int port,int num_threads){
+        signal(SIGPIPE,SIG_IGN);	// a client that goes away is an error from send()
+        int s = socket(AF_INET,SOCK_STREAM,0);
+        if(s<0) err(1,"socket");
+        int on = 1;
+        setsockopt(s,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+        struct sockaddr_in addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(bind(s,(struct sockaddr *)&addr,sizeof(addr))) err(1,"bind port %d",port);
+        if(listen(s,SOMAXCONN)) err(1,"listen");
+        fcntl(s,F_SETFL,fcntl(s,F_GETFL,0) | O_NONBLOCK);	// a client may reset between poll() and accept()
+        socklen_t addrlen = sizeof(addr);
+        if(getsockname(s,(struct sockaddr *)&addr,&addrlen)) err(1,"getsockname");
+
+        if(num_threads<1) num_threads = 1;
+        for(int i=0;i<num_threads;i++){
+            pthread_t t;
+            if(pthread_create(&t,0,worker_main,this)) err(1,"pthread_create");
+            pthread_detach(t);
+        }
+        std::cout << "Listening on 127.0.0.1:" << ntohs(addr.sin_port) << "\n";
+        std::cout.flush();
+
+        std::vector<path_connection *> polled;	// idle connections
+        std::vector<struct pollfd> fds;
+        for(;;){
+            pthread_mutex_lock(&M);
+            polled.insert(polled.end(),kept.begin(),kept.end());
+            kept.clear();
+            pthread_mutex_unlock(&M);
+
+            fds.resize(2+polled.size());
+            fds[0].fd = s;
+            fds[1].fd = wake[0];
+            for(size_t i=0;i<polled.size();i++) fds[2+i].fd = polled[i]->get_fd();
+            for(size_t i=0;i<fds.size();i++){
+                fds[i].events  = POLLIN;
+                fds[i].revents = 0;
+            }
+            if(poll(&fds[0],fds.size(),1000)<0){
+                if(errno==EINTR) continue;
+                err(1,"poll");
+            }
+
+            /* Hand the connections with a request (or a close) waiting to the workers; close the idle ones */
+            time_t now = time(0);
+            std::vector<path_connection *> still_idle;
+            for(size_t i=0;i<polled.size();i++){
+                if(fds[2+i].revents){
+                    pthread_mutex_lock(&M);
+                    requests.push(polled[i]);
+                    pthread_cond_signal(&ready);
+                    pthread_mutex_unlock(&M);
+                } else if(now - polled[i]->idle_since > path_server_idle_timeout){
+                    delete polled[i];
+                } else {
+                    still_idle.push_back(polled[i]);
+                }
+            }
+            polled.swap(still_idle);
+
+            if(fds[1].revents){
+                char drain[256];
+                while(read(wake[0],drain,sizeof(drain))>0){}
+            }
+            if(fds[0].revents) accept_connection(s,polled);
+        }
+    }
+};
+#endif
+
 /**
  * process a path for a given filename.
  * Opens the image and calls the function above.
  * Also implements HTTP server with "-http" option.
  * Feature recorders disabled.
  */
-static void process_path(const char *fn,string path,size_t page_size)
+static void process_path(const char *fn,string path,size_t page_size,int num_threads)
 {
+    if(path.substr(0,6)=="-http="){
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_POLL_H)
+        path_server server(fn,page_size);
+        server.run(atoi(path.substr(6).c_str()),num_threads);
+#else
+        errx(1,"-p -http=<port> is not supported on this platform");
+#endif
+        return;
+    }
+
     image_process *pp = image_process::open(fn,0,page_size,0);
     if(pp==0){
 	if(path=="-http"){
@@ -359,6 +826,7 @@ static void process_path(const char *fn,string path,size_t page_size)
 	}
 	exit(1);
     }
+    u_char *buf = alloc_path_buffer();	// reused for every request
 
     if(path=="-"){
 	/* process path interactively */
@@ -372,7 +840,7 @@ static void process_path(const char *fn,string path,size_t page_size)
 	    if(path==".") break;
 	    scanner_params::PrintOptions po;
 	    scanner_params::setPrintMode(po,scanner_params::MODE_HEX);
-	    process_open_path(*pp,path,po);
+	    process_open_path(*pp,path,po,buf);
 	} while(true);
 	return;
     }
@@ -421,7 +889,7 @@ static void process_path(const char *fn,string path,size_t page_size)
 	    }
 
 	    /* Ready to go with path and options */
-	    process_open_path(*pp,p2,po);
+	    process_open_path(*pp,p2,po,buf);
 	} while(true);
 	return;
     }
@@ -436,7 +904,7 @@ static void process_path(const char *fn,string path,size_t page_size)
 	mode = scanner_params::MODE_HEX;
     }
     scanner_params::setPrintMode(po,mode);
-    process_open_path(*pp,path,po);
+    process_open_path(*pp,path,po,buf);
 }
 
 class bulk_extractor_restarter {
@@ -568,6 +1036,8 @@ static void usage(const char *progname)
     std::cout << "   -G NN        - specify the page size (default " << cfg.opt_page_size << ")\n";
     std::cout << "   -g NN        - specify margin (default " <<cfg.opt_margin << ")\n";
     std::cout << "   -j NN        - Number of analysis threads to run (default " <<threadpool::numCPU() << ")\n";
+    std::cout << "   -k <file>    - skip pages made only of the blocks in <file> (see build_known_blocks)\n";
+    std::cout << "   -K           - do not rescan pages that repeat earlier pages; replay their features\n";
     std::cout << "   -M nn        - sets max recursion depth (default " << scanner_def::max_depth << ")\n";
     std::cout << "   -m <max>     - maximum number of minutes to wait for memory starvation\n";
     std::cout << "                  default is " << cfg.max_bad_alloc_errors << "\n";
@@ -576,6 +1046,8 @@ static void usage(const char *progname)
     std::cout << "                  formats: r = raw; h = hex.\n";
     std::cout << "                  Specify -p - for interactive mode.\n";
     std::cout << "                  Specify -p -http for HTTP mode.\n";
+    std::cout << "                  Specify -p -http=<port> to serve HTTP on 127.0.0.1:<port>\n";
+    std::cout << "                  to many clients with -j threads (port 0 picks a free port).\n";
     std::cout << "\nParallelizing:\n";
     std::cout << "   -Y <o1>      - Start processing at o1 (o1 may be 1, 1K, 1M or 1G)\n";
     std::cout << "   -Y <o1>-<o2> - Process o1-o2\n";
@@ -765,6 +1237,8 @@ void process_find_file(const char *findfile)
 
 
 
+static bool opt_feature_index = true;
+
 int main(int argc,char **argv)
 {
 #ifdef HAVE_MCHECK
@@ -803,7 +1277,7 @@ int main(int argc,char **argv)
 
     /* Process options */
     int ch;
-    while ((ch = getopt(argc, argv, "A:B:b:C:d:E:e:F:f:G:g:Hhj:M:m:o:P:p:q:Rr:S:s:VW:w:x:Y:z:Z")) != -1) {
+    while ((ch = getopt(argc, argv, "A:B:b:C:d:E:e:F:f:G:g:Hhj:Kk:M:m:o:P:p:q:Rr:S:s:VW:w:x:Y:z:Z")) != -1) {
 	switch (ch) {
 	case 'A': feature_recorder::offset_add  = stoi64(optarg);break;
 	case 'b': feature_recorder::banner_file = optarg; break;
@@ -838,6 +1312,11 @@ int main(int argc,char **argv)
 	case 'G': cfg.opt_page_size = scaled_stoi(optarg); break;
 	case 'g': cfg.opt_margin = scaled_stoi(optarg); break;
 	case 'j': cfg.num_threads = atoi(optarg); break;
+	case 'k':
+	    delete cfg.known;		// the last -k wins
+	    cfg.known = new known_blocks(optarg);
+	    break;
+	case 'K': cfg.opt_page_cache = true; break;
 	case 'M': scanner_def::max_depth = atoi(optarg); break;
 	case 'm': cfg.max_bad_alloc_errors = atoi(optarg); break;
 	case 'o': opt_outdir = optarg;break;
@@ -912,6 +1391,16 @@ int main(int argc,char **argv)
                   "Record work start and end of each scanner in report.xml file");
     si.get_config("enable_histograms",&opt_enable_histograms,
                   "Disable generation of histograms");
+    si.get_config("feature_index",&opt_feature_index,
+                  "Write a line index (FILE.idx) beside each feature file for random access");
+    si.get_config("metrics_file",&cfg.opt_metrics_file,
+                  "While scanning, rewrite this file with Prometheus metrics (progress, threads, scanners, features)");
+    si.get_config("metrics_interval",&cfg.opt_metrics_interval,
+                  "Seconds between rewrites of metrics_file");
+    si.get_config("trace",&trace::enabled,
+                  "Record each thread's scanner calls and write them to trace.json (Chrome trace format)");
+    si.get_config("trace_ring_events",&trace::ring_events,
+                  "Events kept per thread for trace; older events are overwritten");
     si.get_config("debug_histogram_malloc_fail_frequency",&HistogramMaker::debug_histogram_malloc_fail_frequency,
                   "Set >0 to make histogram maker fail with memory allocations");
     si.get_config("hash_alg",&be_hash_name,"Specifies hash algorithm to be used for all hash calculations");
@@ -945,9 +1434,22 @@ int main(int argc,char **argv)
         }
     }
 
+    /* Some scanners have output that cannot be replayed */
+    if(cfg.opt_page_cache){
+        for(be13::plugin::scanner_vector::const_iterator it = be13::plugin::current_scanners.begin();
+            it!=be13::plugin::current_scanners.end();it++){
+            const char *reason = (*it)->enabled ? page_cache::cannot_replay((*it)->info.name) : 0;
+            if(reason){
+                std::cerr << "-K cannot be used with the " << (*it)->info.name << " scanner, as " << reason
+                          << "; repeated pages will be scanned (use -x " << (*it)->info.name << " to allow -K)\n";
+                cfg.opt_page_cache = false;
+            }
+        }
+    }
+
     if(opt_path){
 	if(argc!=1) errx(1,"-p requires a single argument.");
-	process_path(argv[0],opt_path,cfg.opt_page_size);
+	process_path(argv[0],opt_path,cfg.opt_page_size,cfg.num_threads);
 	exit(0);
     }
     if(opt_outdir.size()==0) errx(1,"error: -o outdir must be specified");
@@ -1069,8 +1571,15 @@ int main(int argc,char **argv)
     if(opt_sampling_params.size()>0) BulkExtractor_Phase1::set_sampling_parameters(cfg,opt_sampling_params);
 
     xreport->add_timestamp("phase1 start");
+    if(trace::enabled || cfg.opt_metrics_file.size()) scanner_stats::wrap_scanners();
     phase1.run(*p,fs,seen_page_ids);
     phase1.wait_for_workers(*p);
+    delete cfg.known;			// only the workers use it
+    cfg.known = 0;
+    if(trace::enabled){
+        trace::write_json(opt_outdir + "/trace.json");
+        if(cfg.opt_quiet==0) std::cout << "Trace written to " << opt_outdir << "/trace.json\n";
+    }
     xreport->add_timestamp("phase1 end");
 
     if(cfg.opt_quiet==0) std::cout << "Phase 2. Shutting down scanners\n";
@@ -1084,6 +1593,13 @@ int main(int argc,char **argv)
     be13::plugin::phase_histogram(fs,0); // TK - add an xml error notifier!
     xreport->add_timestamp("phase3 end");
 
+    if(opt_feature_index){
+        if(cfg.opt_quiet==0) std::cout << "Phase 4. Indexing feature files\n";
+        xreport->add_timestamp("phase4 start");
+        feature_index::write_dir(opt_outdir);
+        xreport->add_timestamp("phase4 end");
+    }
+
     /* report and then print final usage information */
     xreport->push("report");
     xreport->xmlout("total_bytes",phase1.total_bytes);
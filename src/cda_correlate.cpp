@@ -0,0 +1,381 @@
+/*
+ * cda_correlate.cpp:
+ * Cross-drive correlation of bulk_extractor feature files.
+ *
+ * A native version of the Correlator in python/cda_tool.py that scales to
+ * thousands of drives. The features of one feature file (email by default)
+ * are read from many bulk_extractor report directories in parallel and
+ * merged into an inverted index file (see cda_index.h) that records, for
+ * each feature, the drives it was found on. Reports can be added to an
+ * existing index. The index is memory-mapped to answer which drives share
+ * a feature, and to make a stop list of features found on many drives.
+ */
+
+#include "bulk_extractor.h"
+#include "cda_index.h"
+#include "line_reader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <pthread.h>
+#include <tr1/unordered_map>
+
+static std::string opt_feature_file = "email";
+static size_t opt_batch = 256;
+
+/* The distinct features of one feature file of one drive, sorted */
+struct drive_features {
+    std::string report;
+    std::string name;			// from the Filename property, else the report
+    std::vector<std::pair<std::string,uint32_t> > features;
+    bool ok;
+    drive_features():report(),name(),features(),ok(false){}
+};
+
+static void read_report(drive_features &df)
+{
+    std::string fn = df.report + "/" + opt_feature_file + ".txt";
+    FILE *f = fopen(fn.c_str(),"rb");
+    if(!f){
+        warn("%s",fn.c_str());
+        return;
+    }
+    df.name = df.report;
+    bool have_name = false;
+    typedef std::tr1::unordered_map<std::string,uint32_t> counts_t;
+    counts_t counts;
+    std::string feature;
+    line_reader lr(f);
+    const char *line;
+    size_t len;
+    while(lr.getline(line,len)){
+        if(is_comment_line(line,len)){
+            static const char prop[] = "# Filename: ";
+            const char *p = line;
+            if(len>=3 && memcmp(p,"\xef\xbb\xbf",3)==0) p += 3;
+            size_t plen = line+len-p;
+            if(!have_name && plen>=sizeof(prop)-1 && memcmp(p,prop,sizeof(prop)-1)==0){
+                const char *end = line+len;
+                while(end>p && (end[-1]=='\n' || end[-1]=='\r')) end--;
+                df.name.assign(p+sizeof(prop)-1,end);
+                have_name = true;
+            }
+            continue;
+        }
+        const char *end = line+len;
+        const char *tab1 = (const char *)memchr(line,'\t',len);
+        if(!tab1) continue;
+        const char *start = tab1+1;
+        const char *tab2 = (const char *)memchr(start,'\t',end-start);
+        if(tab2){
+            end = tab2;
+        } else {
+            while(end>start && (end[-1]=='\n' || end[-1]=='\r')) end--;
+        }
+        feature.assign(start,end);
+        counts[feature]++;
+    }
+    fclose(f);
+
+    df.features.reserve(counts.size());
+    for(counts_t::const_iterator it=counts.begin();it!=counts.end();++it){
+        df.features.push_back(*it);
+    }
+    std::sort(df.features.begin(),df.features.end());
+    df.ok = true;
+}
+
+/* The reports of a batch are handed out to the threads one at a time */
+struct work_queue {
+    std::vector<drive_features> &drives;
+    size_t next;
+    pthread_mutex_t M;
+    work_queue(std::vector<drive_features> &drives_):drives(drives_),next(0),M(){
+        pthread_mutex_init(&M,NULL);
+    }
+    ~work_queue(){
+        pthread_mutex_destroy(&M);
+    }
+    drive_features *get(){
+        drive_features *ret = 0;
+        pthread_mutex_lock(&M);
+        if(next<drives.size()) ret = &drives[next++];
+        pthread_mutex_unlock(&M);
+        return ret;
+    }
+    void report(const drive_features &df){
+        pthread_mutex_lock(&M);
+        if(df.ok){
+            std::cout << df.report << ": " << df.features.size() << " distinct "
+                      << opt_feature_file << " features on " << df.name << "\n";
+        }
+        pthread_mutex_unlock(&M);
+    }
+private:
+    work_queue(const work_queue &);
+    work_queue &operator=(const work_queue &);
+};
+
+static void *worker(void *arg)
+{
+    work_queue &wq = *(work_queue *)arg;
+    drive_features *df;
+    while((df = wq.get())!=0){
+        read_report(*df);
+        wq.report(*df);
+    }
+    return 0;
+}
+
+/* A position in one of the sorted inputs to the merge */
+struct merge_cursor {
+    const char *name;
+    size_t len;
+    size_t src;				// the new drive, or drives.size() for the old index
+    uint64_t pos;
+};
+
+struct merge_cursor_greater {
+    bool operator()(const merge_cursor &a,const merge_cursor &b) const {
+        int r = cda_index::compare(a.name,a.len,b.name,b.len);
+        if(r!=0) return r>0;
+        return a.src>b.src;
+    }
+};
+
+struct posting_less {
+    bool operator()(const cda_index::posting &a,const cda_index::posting &b) const {
+        return a.drive<b.drive;
+    }
+};
+
+/**
+ * Write a new index that holds the drives and features of old (if any)
+ * followed by those of the new drives. Return the number of drives added.
+ */
+static uint32_t merge_index(const cda_index *old,const std::vector<drive_features> &drives,
+                            const std::string &outfn)
+{
+    cda_index_writer w(outfn);
+    uint32_t old_count = old ? old->drive_count() : 0;
+    for(uint32_t d=0;d<old_count;d++) w.add_drive(old->drive_name(d));
+    std::vector<uint32_t> drive_id(drives.size());
+    for(size_t i=0;i<drives.size();i++){
+        drive_id[i] = drives[i].ok ? w.add_drive(drives[i].name) : 0;
+    }
+
+    std::priority_queue<merge_cursor,std::vector<merge_cursor>,merge_cursor_greater> heap;
+    for(size_t i=0;i<drives.size();i++){
+        if(!drives[i].ok || drives[i].features.size()==0) continue;
+        merge_cursor c;
+        c.name = drives[i].features[0].first.data();
+        c.len  = drives[i].features[0].first.size();
+        c.src  = i;
+        c.pos  = 0;
+        heap.push(c);
+    }
+    if(old && old->feature_count()>0){
+        merge_cursor c;
+        c.name = old->feature_name(0,c.len);
+        c.src  = drives.size();
+        c.pos  = 0;
+        heap.push(c);
+    }
+
+    std::vector<cda_index::posting> postings;
+    while(!heap.empty()){
+        const merge_cursor first = heap.top();
+        postings.clear();
+        while(!heap.empty() && cda_index::compare(heap.top().name,heap.top().len,first.name,first.len)==0){
+            merge_cursor c = heap.top();
+            heap.pop();
+            if(c.src==drives.size()){
+                uint32_t n;
+                const cda_index::posting *p = old->postings(c.pos,n);
+                postings.insert(postings.end(),p,p+n);
+                if(++c.pos<old->feature_count()){
+                    c.name = old->feature_name(c.pos,c.len);
+                    heap.push(c);
+                }
+            } else {
+                const std::vector<std::pair<std::string,uint32_t> > &f = drives[c.src].features;
+                cda_index::posting p;
+                p.drive = drive_id[c.src];
+                p.count = f[c.pos].second;
+                postings.push_back(p);
+                if(++c.pos<f.size()){
+                    c.name = f[c.pos].first.data();
+                    c.len  = f[c.pos].first.size();
+                    heap.push(c);
+                }
+            }
+        }
+        std::sort(postings.begin(),postings.end(),posting_less());
+        w.add_feature(first.name,first.len,postings);
+    }
+    w.close();
+    uint32_t added = 0;
+    for(size_t i=0;i<drives.size();i++) if(drives[i].ok) added++;
+    return added;
+}
+
+static bool file_exists(const std::string &fn)
+{
+    return access(fn.c_str(),F_OK)==0;
+}
+
+/* Add the reports to the index, opt_batch at a time; create it if it does not exist */
+static void ingest(const std::string &indexfn,const std::vector<std::string> &reports,int num_threads)
+{
+    std::set<std::string> seen;		// drive names already in the index
+    if(file_exists(indexfn)){
+        cda_index idx(indexfn);
+        for(uint32_t d=0;d<idx.drive_count();d++) seen.insert(idx.drive_name(d));
+    }
+    std::string tmpfn = indexfn + ".new";
+    for(size_t start=0;start<reports.size();start+=opt_batch){
+        size_t end = std::min(start+opt_batch,reports.size());
+        std::vector<drive_features> drives(end-start);
+        for(size_t i=start;i<end;i++) drives[i-start].report = reports[i];
+
+        work_queue wq(drives);
+        int n = std::min((size_t)num_threads,drives.size());
+        std::vector<pthread_t> threads(n);
+        for(int i=0;i<n;i++){
+            if(pthread_create(&threads[i],NULL,worker,&wq)) errx(1,"pthread_create failed");
+        }
+        for(int i=0;i<n;i++){
+            pthread_join(threads[i],NULL);
+        }
+        for(size_t i=0;i<drives.size();i++){
+            if(!drives[i].ok) continue;
+            if(seen.find(drives[i].name)!=seen.end()){
+                warnx("%s: drive %s is already in the index; skipped",
+                      drives[i].report.c_str(),drives[i].name.c_str());
+                drives[i].ok = false;
+                drives[i].features.clear();
+                continue;
+            }
+            seen.insert(drives[i].name);
+        }
+
+        uint32_t added = 0;
+        if(file_exists(indexfn)){
+            cda_index old(indexfn);
+            added = merge_index(&old,drives,tmpfn);
+        } else {
+            added = merge_index(0,drives,tmpfn);
+        }
+        if(rename(tmpfn.c_str(),indexfn.c_str())) err(1,"%s",indexfn.c_str());
+        std::cout << indexfn << ": added " << added << " drives\n";
+    }
+}
+
+static void print_query(const cda_index &idx,const std::string &feature)
+{
+    uint64_t i;
+    if(!idx.find(feature.data(),feature.size(),i)){
+        std::cout << feature << "\t0\n";
+        return;
+    }
+    uint32_t n;
+    const cda_index::posting *p = idx.postings(i,n);
+    std::cout << feature << "\t" << n << "\n";
+    for(uint32_t j=0;j<n;j++){
+        std::cout << "\t" << idx.drive_name(p[j].drive) << "\t" << p[j].count << "\n";
+    }
+}
+
+/* Print the features found on at least min_drives drives, as --makestop does */
+static void print_stoplist(const cda_index &idx,uint32_t min_drives)
+{
+    for(uint64_t i=0;i<idx.feature_count();i++){
+        uint32_t n;
+        idx.postings(i,n);
+        if(n<min_drives) continue;
+        size_t len;
+        const char *name = idx.feature_name(i,len);
+        std::cout.write(name,len);
+        std::cout << "\t" << n << "\n";
+    }
+}
+
+static int default_threads()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n>0) return n;
+#endif
+    return 1;
+}
+
+static void usage()
+{
+    std::cerr << "usage: cda_correlate [options] indexfile [report ...]\n"
+              << "Adds the features of each bulk_extractor report directory to indexfile,\n"
+              << "which is created if it does not exist, then answers the queries.\n"
+              << "   -f name      - feature file to correlate (default " << opt_feature_file << ")\n"
+              << "   -j NN        - number of threads reading reports (default " << default_threads() << ")\n"
+              << "   -b NN        - reports merged into the index at a time (default " << opt_batch << ")\n"
+              << "   -q feature   - print the drives that have feature and its count on each (may be repeated)\n"
+              << "   -s NN        - print the features found on NN or more drives\n"
+              << "   -d           - print the drives in the index\n"
+              << "   -h           - print this message\n";
+}
+
+int main(int argc,char **argv)
+{
+    std::vector<std::string> queries;
+    uint32_t opt_stop = 0;
+    bool opt_drives = false;
+    int num_threads = default_threads();
+    int ch;
+    while((ch = getopt(argc,argv,"f:j:b:q:s:dh")) != -1){
+        switch(ch){
+        case 'f': opt_feature_file = optarg; break;
+        case 'j':
+            num_threads = atoi(optarg);
+            if(num_threads<1) errx(1,"-j must be at least 1");
+            break;
+        case 'b':
+            opt_batch = atoi(optarg);
+            if(opt_batch<1) errx(1,"-b must be at least 1");
+            break;
+        case 'q': queries.push_back(optarg); break;
+        case 's':
+            opt_stop = atoi(optarg);
+            if(opt_stop<1) errx(1,"-s must be at least 1");
+            break;
+        case 'd': opt_drives = true; break;
+        case 'h': usage(); exit(0);
+        default:  usage(); exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc<1){
+        usage();
+        exit(1);
+    }
+    std::string indexfn = argv[0];
+    std::vector<std::string> reports(argv+1,argv+argc);
+
+    if(reports.size()>0) ingest(indexfn,reports,num_threads);
+    if(!file_exists(indexfn)) errx(1,"%s: no such index; give reports to create it",indexfn.c_str());
+
+    cda_index idx(indexfn);
+    if(opt_drives){
+        for(uint32_t d=0;d<idx.drive_count();d++){
+            std::cout << idx.drive_name(d) << "\t" << idx.drive_features(d) << "\n";
+        }
+    }
+    for(size_t i=0;i<queries.size();i++) print_query(idx,queries[i]);
+    if(opt_stop>0) print_stoplist(idx,opt_stop);
+    if(!opt_drives && queries.size()==0 && opt_stop==0){
+        std::cout << indexfn << ": " << idx.drive_count() << " drives, "
+                  << idx.feature_count() << " distinct features\n";
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * cda_index.cpp:
+ * A memory-mapped inverted index of features across drives. See cda_index.h for the file layout.
+ */
+
+#include "bulk_extractor.h"
+#include "cda_index.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+const char cda_index::MAGIC[8] = {'B','E','C','D','A','I','X','1'};
+
+int cda_index::compare(const char *a,size_t alen,const char *b,size_t blen)
+{
+    int r = memcmp(a,b,alen<blen ? alen : blen);
+    if(r!=0) return r;
+    if(alen<blen) return -1;
+    if(alen>blen) return 1;
+    return 0;
+}
+
+cda_index::cda_index(const std::string &fname_):
+    fname(fname_),base(0),base_len(0),mapped(false),hdr(0),drives(0),features(0)
+{
+    int fd = open(fname.c_str(),O_RDONLY|O_BINARY);
+    if(fd<0) err(1,"%s",fname.c_str());
+    struct stat st;
+    if(fstat(fd,&st)) err(1,"%s",fname.c_str());
+    base_len = st.st_size;
+    if(base_len < sizeof(header)) errx(1,"%s: not a cda index file",fname.c_str());
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    void *m = mmap(0,base_len,PROT_READ,MAP_SHARED,fd,0);
+    if(m==MAP_FAILED) err(1,"%s: mmap",fname.c_str());
+    base = static_cast<const uint8_t *>(m);
+    mapped = true;
+#else
+    uint8_t *buf = static_cast<uint8_t *>(malloc(base_len));
+    if(buf==0) errx(1,"%s: cannot allocate %zu bytes",fname.c_str(),base_len);
+    for(size_t off=0;off<base_len;){
+        ssize_t r = read(fd,buf+off,base_len-off);
+        if(r<=0) err(1,"%s",fname.c_str());
+        off += r;
+    }
+    base = buf;
+#endif
+    close(fd);
+
+    hdr = reinterpret_cast<const header *>(base);
+    if(memcmp(hdr->magic,MAGIC,sizeof(MAGIC))!=0) errx(1,"%s: not a cda index file",fname.c_str());
+    if(hdr->drives_off > base_len || hdr->features_off > base_len ||
+       hdr->drives_off + (uint64_t)hdr->drive_count*sizeof(drive_entry) != hdr->features_off ||
+       hdr->features_off + hdr->feature_count*sizeof(feature_entry) != base_len){
+        errx(1,"%s: cda index file is truncated",fname.c_str());
+    }
+    drives   = reinterpret_cast<const drive_entry *>(base + hdr->drives_off);
+    features = reinterpret_cast<const feature_entry *>(base + hdr->features_off);
+}
+
+cda_index::~cda_index()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if(mapped) munmap(const_cast<uint8_t *>(base),base_len);
+#endif
+    if(!mapped) free(const_cast<uint8_t *>(base));
+}
+
+std::string cda_index::drive_name(uint32_t d) const
+{
+    return std::string((const char *)(base + drives[d].name_off),drives[d].name_len);
+}
+
+bool cda_index::find(const char *feature,size_t len,uint64_t &i) const
+{
+    uint64_t lo = 0;
+    uint64_t hi = hdr->feature_count;
+    while(lo<hi){
+        uint64_t mid = lo + (hi-lo)/2;
+        size_t mlen;
+        const char *mname = feature_name(mid,mlen);
+        int c = compare(mname,mlen,feature,len);
+        if(c==0){
+            i = mid;
+            return true;
+        }
+        if(c<0) lo = mid+1;
+        else    hi = mid;
+    }
+    return false;
+}
+
+/****************************************************************
+ *** cda_index_writer
+ ****************************************************************/
+
+cda_index_writer::cda_index_writer(const std::string &fname_):
+    fname(fname_),out(0),table(0),pos(0),feature_count(0),drive_names(),drive_features()
+{
+    out = fopen(fname.c_str(),"wb");
+    if(!out) err(1,"%s",fname.c_str());
+    table = tmpfile();
+    if(!table) err(1,"tmpfile");
+    cda_index::header h;
+    memset(&h,0,sizeof(h));		// rewritten by close()
+    write(&h,sizeof(h));
+}
+
+cda_index_writer::~cda_index_writer()
+{
+    if(out) fclose(out);
+    if(table) fclose(table);
+}
+
+void cda_index_writer::write(const void *buf,size_t len)
+{
+    if(len>0 && fwrite(buf,1,len,out)!=len) err(1,"%s",fname.c_str());
+    pos += len;
+}
+
+void cda_index_writer::pad()
+{
+    static const char zeros[8] = {0,0,0,0,0,0,0,0};
+    write(zeros,(8 - pos%8) % 8);
+}
+
+uint32_t cda_index_writer::add_drive(const std::string &name)
+{
+    drive_names.push_back(name);
+    drive_features.push_back(0);
+    return drive_names.size()-1;
+}
+
+void cda_index_writer::add_feature(const char *name,size_t len,const std::vector<cda_index::posting> &postings)
+{
+    cda_index::feature_entry fe;
+    fe.data_off    = pos;
+    fe.name_len    = len;
+    fe.drive_count = postings.size();
+    if(postings.size()>0) write(&postings[0],postings.size()*sizeof(cda_index::posting));
+    write(name,len);
+    pad();
+    if(fwrite(&fe,sizeof(fe),1,table)!=1) err(1,"tmpfile");
+    for(size_t i=0;i<postings.size();i++) drive_features[postings[i].drive]++;
+    feature_count++;
+}
+
+void cda_index_writer::close()
+{
+    /* Drive names, then the drive table */
+    std::vector<cda_index::drive_entry> dt(drive_names.size());
+    for(size_t d=0;d<drive_names.size();d++){
+        dt[d].name_off      = pos;
+        dt[d].name_len      = drive_names[d].size();
+        dt[d].feature_count = drive_features[d];
+        write(drive_names[d].data(),drive_names[d].size());
+        pad();
+    }
+    cda_index::header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,cda_index::MAGIC,sizeof(h.magic));
+    h.drive_count   = dt.size();
+    h.feature_count = feature_count;
+    h.drives_off    = pos;
+    if(dt.size()>0) write(&dt[0],dt.size()*sizeof(cda_index::drive_entry));
+    h.features_off  = pos;
+
+    /* Copy the feature table */
+    if(fflush(table) || fseek(table,0,SEEK_SET)) err(1,"tmpfile");
+    std::vector<char> buf(1024*1024);
+    size_t count;
+    while((count = fread(&buf[0],1,buf.size(),table))>0) write(&buf[0],count);
+    if(ferror(table)) err(1,"tmpfile");
+    fclose(table);
+    table = 0;
+
+    if(fseek(out,0,SEEK_SET) || fwrite(&h,sizeof(h),1,out)!=1) err(1,"%s",fname.c_str());
+    if(fclose(out)) err(1,"%s",fname.c_str());
+    out = 0;
+}
@@ -0,0 +1,126 @@
+#ifndef CDA_INDEX_H
+#define CDA_INDEX_H
+
+/**
+ * \file
+ * An inverted index of the features found on many drives, for cross-drive
+ * analysis. For each distinct feature it records the drives the feature
+ * was found on and how many times.
+ *
+ * The index is a file built by cda_correlate and memory-mapped read-only,
+ * so looking up a feature touches only the pages on its binary search path:
+ *
+ * \verbatim
+ *   header        (struct cda_index::header)
+ *   data          for each feature, its postings then its name;
+ *                 then the name of each drive; each padded to 8 bytes
+ *   drive table   (drive_count * struct drive_entry)
+ *   feature table (feature_count * struct feature_entry, sorted by name)
+ * \endverbatim
+ *
+ * Names are compared with memcmp, a name sorting before any longer name
+ * that it is a prefix of. The postings of a feature are sorted by drive.
+ */
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+class cda_index {
+public:
+    static const char MAGIC[8];		// "BECDAIX1"
+    struct header {
+        char     magic[8];
+        uint32_t drive_count;
+        uint32_t reserved;
+        uint64_t feature_count;
+        uint64_t drives_off;		// file offset of the drive table
+        uint64_t features_off;		// file offset of the feature table
+    };
+    struct drive_entry {
+        uint64_t name_off;
+        uint32_t name_len;
+        uint32_t feature_count;		// distinct features on the drive
+    };
+    struct feature_entry {
+        uint64_t data_off;		// postings, then the name
+        uint32_t name_len;
+        uint32_t drive_count;		// number of postings
+    };
+    struct posting {
+        uint32_t drive;
+        uint32_t count;			// times the feature was found on the drive
+    };
+
+    /* Compare two names as the feature table is sorted */
+    static int compare(const char *a,size_t alen,const char *b,size_t blen);
+
+    /* Map an index file; errx() if it is not a valid index */
+    explicit cda_index(const std::string &fname);
+    virtual ~cda_index();
+
+    uint32_t drive_count() const { return hdr->drive_count; }
+    std::string drive_name(uint32_t d) const;
+    uint32_t drive_features(uint32_t d) const { return drives[d].feature_count; }
+
+    uint64_t feature_count() const { return hdr->feature_count; }
+    const char *feature_name(uint64_t i,size_t &len) const {
+        len = features[i].name_len;
+        return (const char *)(base + features[i].data_off + features[i].drive_count*sizeof(posting));
+    }
+    const posting *postings(uint64_t i,uint32_t &count) const {
+        count = features[i].drive_count;
+        return (const posting *)(base + features[i].data_off);
+    }
+
+    /* Set i to the index of feature and return true, or return false if it is not in the index */
+    bool find(const char *feature,size_t len,uint64_t &i) const;
+
+private:
+    cda_index(const cda_index &);
+    cda_index &operator=(const cda_index &);
+
+    std::string fname;
+    const uint8_t *base;		// the mapped file
+    size_t   base_len;
+    bool     mapped;			// false if base was read into memory
+    const header        *hdr;
+    const drive_entry   *drives;
+    const feature_entry *features;
+};
+
+/**
+ * Writes an index file. Every drive is added first, then each feature in
+ * sorted order with its postings. The feature table is kept in a
+ * temporary file until close(), so memory use does not grow with the
+ * number of features.
+ */
+class cda_index_writer {
+public:
+    explicit cda_index_writer(const std::string &fname);
+    virtual ~cda_index_writer();
+
+    /* Return the number of the new drive */
+    uint32_t add_drive(const std::string &name);
+    void add_feature(const char *name,size_t len,const std::vector<cda_index::posting> &postings);
+    void close();
+
+private:
+    cda_index_writer(const cda_index_writer &);
+    cda_index_writer &operator=(const cda_index_writer &);
+
+    void write(const void *buf,size_t len);
+    void pad();
+
+    std::string fname;
+    FILE *out;
+    FILE *table;			// the feature table, until close()
+    uint64_t pos;			// bytes written to out
+    uint64_t feature_count;
+    std::vector<std::string> drive_names;
+    std::vector<uint32_t> drive_features;
+};
+
+#endif
@@ -0,0 +1,208 @@
+/**
+ * feature_index.cpp:
+ * Write the line index of a feature file. See feature_index.h for the file layout.
+ */
+
+#include "bulk_extractor.h"
+#include "feature_index.h"
+#include "line_reader.h"
+
+#include <algorithm>
+
+const char feature_index::MAGIC[8] = {'B','E','F','I','D','X','0','1'};
+
+bool feature_index::decode_path_offset(const char *p,const char *end,uint64_t &offset)
+{
+    if(p==end || *p<'0' || *p>'9') return false;
+    offset = 0;
+    for(;;){
+        uint64_t n = 0;
+        while(p<end && *p>='0' && *p<='9') n = n*10 + (*p++ - '0');
+        offset += n;
+        /* -XOR- or -XOR(mask)- */
+        if(end-p<5 || memcmp(p,"-XOR",4)!=0) return true;
+        const char *q = p+4;
+        if(*q=='('){
+            q = (const char *)memchr(q,')',end-q);
+            if(q==0) return true;
+            q++;
+        }
+        if(end-q<2 || q[0]!='-' || q[1]<'0' || q[1]>'9') return true;
+        p = q+1;
+    }
+}
+
+/* Writes little-endian uint64s through a buffer; ok() is false once a write fails */
+class le64_writer {
+    FILE *f;
+    std::vector<uint8_t> buf;
+    size_t used;
+    bool failed;
+    le64_writer(const le64_writer &);
+    le64_writer &operator=(const le64_writer &);
+public:
+    le64_writer(FILE *f_):f(f_),buf(65536),used(0),failed(false){}
+    void put(uint64_t v){
+        if(used==buf.size()) flush();
+        for(int i=0;i<8;i++) buf[used++] = (uint8_t)(v>>(i*8));
+    }
+    void flush(){
+        if(used>0 && !failed && fwrite(&buf[0],1,used,f)!=used) failed = true;
+        used = 0;
+    }
+    bool ok() const { return !failed; }
+};
+
+/* A feature's image offset and line, sorted in memory-bounded runs */
+struct offset_line {
+    uint64_t offset;
+    uint64_t line;
+    bool operator<(const offset_line &b) const {
+        return offset<b.offset || (offset==b.offset && line<b.line);
+    }
+};
+
+struct run_greater {
+    const std::vector<offset_line> &cur;
+    run_greater(const std::vector<offset_line> &cur_):cur(cur_){}
+    bool operator()(size_t a,size_t b) const { return cur[b]<cur[a]; }
+};
+
+static bool spill(std::vector<offset_line> &buf,std::vector<FILE *> &runs)
+{
+    std::sort(buf.begin(),buf.end());
+    FILE *f = tmpfile();
+    if(!f) return false;
+    runs.push_back(f);
+    if(buf.size()>0 && fwrite(&buf[0],sizeof(offset_line),buf.size(),f)!=buf.size()) return false;
+    if(fflush(f) || fseek(f,0,SEEK_SET)) return false;
+    buf.clear();
+    return true;
+}
+
+/* The files open while an index is written; closed however write_file returns */
+struct index_files {
+    FILE *in;
+    FILE *out;
+    std::vector<FILE *> runs;
+    index_files():in(0),out(0),runs(){}
+    ~index_files(){
+        if(in) fclose(in);
+        if(out) fclose(out);
+        for(size_t i=0;i<runs.size();i++) fclose(runs[i]);
+    }
+private:
+    index_files(const index_files &);
+    index_files &operator=(const index_files &);
+};
+
+/* Warn about a failed index and remove what was written of it */
+static bool index_failed(const std::string &what,const std::string &idxname)
+{
+    warn("%s",what.c_str());
+    unlink(idxname.c_str());
+    return false;
+}
+
+bool feature_index::write_file(const std::string &fname,size_t sort_memory)
+{
+    std::string idxname = fname + ".idx";
+    index_files files;
+    files.in = fopen(fname.c_str(),"rb");
+    if(!files.in) return index_failed(fname,idxname);
+    files.out = fopen(idxname.c_str(),"wb");
+    if(!files.out) return index_failed(idxname,idxname);
+    FILE *out = files.out;
+    char placeholder[sizeof(header)];
+    memset(placeholder,0,sizeof(placeholder));	// rewritten at the end
+    if(fwrite(placeholder,sizeof(placeholder),1,out)!=1) return index_failed(idxname,idxname);
+
+    /* Stream the line starts out, and collect the features' offsets */
+    const size_t max_buf = std::max(sort_memory/sizeof(offset_line),(size_t)1024);
+    std::vector<offset_line> buf;
+    std::vector<FILE *> &runs = files.runs;
+    le64_writer w(out);
+    line_reader lr(files.in);
+    const char *line;
+    size_t len;
+    uint64_t pos = 0;
+    uint64_t line_count = 0;
+    uint64_t feature_count = 0;
+    while(lr.getline(line,len)){
+        w.put(pos);
+        if(!is_comment_line(line,len)){
+            const char *tab = (const char *)memchr(line,'\t',len);
+            offset_line ol;
+            if(tab && decode_path_offset(line,tab,ol.offset)){
+                ol.line = line_count;
+                buf.push_back(ol);
+                feature_count++;
+                if(buf.size()>=max_buf && !spill(buf,runs)) return index_failed("tmpfile",idxname);
+            }
+        }
+        pos += len;
+        line_count++;
+    }
+    w.put(pos);
+    if(ferror(files.in)) return index_failed(fname,idxname);
+
+    /* Then the line numbers in offset order */
+    if(runs.size()==0){
+        std::sort(buf.begin(),buf.end());
+        for(size_t i=0;i<buf.size();i++) w.put(buf[i].line);
+    } else {
+        if(buf.size()>0 && !spill(buf,runs)) return index_failed("tmpfile",idxname);
+        std::vector<offset_line> cur(runs.size());
+        std::vector<size_t> heap;
+        for(size_t i=0;i<runs.size();i++){
+            if(fread(&cur[i],sizeof(offset_line),1,runs[i])==1) heap.push_back(i);
+        }
+        std::make_heap(heap.begin(),heap.end(),run_greater(cur));
+        while(heap.size()>0){
+            std::pop_heap(heap.begin(),heap.end(),run_greater(cur));
+            size_t i = heap.back();
+            w.put(cur[i].line);
+            if(fread(&cur[i],sizeof(offset_line),1,runs[i])==1){
+                std::push_heap(heap.begin(),heap.end(),run_greater(cur));
+            } else {
+                heap.pop_back();
+            }
+        }
+        for(size_t i=0;i<runs.size();i++){
+            if(ferror(runs[i])) return index_failed("tmpfile",idxname);
+        }
+    }
+    w.flush();
+
+    if(fseek(out,0,SEEK_SET) || fwrite(MAGIC,sizeof(MAGIC),1,out)!=1) return index_failed(idxname,idxname);
+    w.put(pos);
+    w.put(line_count);
+    w.put(feature_count);
+    w.flush();
+    if(!w.ok()) return index_failed(idxname,idxname);
+    files.out = 0;
+    if(fclose(out)) return index_failed(idxname,idxname);
+    return true;
+}
+
+void feature_index::write_dir(const std::string &outdir)
+{
+    DIR *d = opendir(outdir.c_str());
+    if(!d){
+        warn("%s",outdir.c_str());
+        return;
+    }
+    std::vector<std::string> files;
+    struct dirent *de;
+    while((de = readdir(d))!=0){
+        std::string fn = de->d_name;
+        if(fn.size()<=4 || fn.substr(fn.size()-4)!=".txt") continue;
+        if(fn.find("_histogram")!=std::string::npos) continue;
+        files.push_back(fn);
+    }
+    closedir(d);
+    std::sort(files.begin(),files.end());
+    for(size_t i=0;i<files.size();i++){
+        write_file(outdir + "/" + files[i]);	// a failure is reported and the rest are indexed
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef FEATURE_INDEX_H
+#define FEATURE_INDEX_H
+
+/**
+ * \file
+ * A line index written beside a feature file (as FILE.idx for FILE), so
+ * that readers such as bulk_extractor_reader.FeatureFile can memory-map
+ * the feature file and go straight to a line, or to the features in a
+ * range of image offsets, without reading the whole file:
+ *
+ * \verbatim
+ *   header      (struct feature_index::header)
+ *   line_start  (line_count+1 uint64_t: the file offset of each line, then the file size)
+ *   by_offset   (feature_count uint64_t: the line numbers of the features,
+ *                sorted by image offset and then line number)
+ * \endverbatim
+ *
+ * Lines are numbered from 0 and include comments. The image offset of a
+ * feature is found from its forensic path by decode_path_offset(). All
+ * integers are little-endian.
+ */
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+class feature_index {
+public:
+    static const char MAGIC[8];		// "BEFIDX01"
+    struct header {
+        char     magic[8];
+        uint64_t file_size;		// of the feature file, to detect a stale index
+        uint64_t line_count;
+        uint64_t feature_count;
+    };
+
+    /**
+     * Return the image offset of a forensic path: its first number, plus
+     * the offset within each XOR part that follows, as XOR does not move
+     * bytes; an XOR part may name its mask, as in XOR(0x5a). Any other
+     * part (GZIP, ZIP, ...) ends the walk, so a feature
+     * in decoded data is placed at the start of the data it was decoded
+     * from. Return false if the path does not start with a number.
+     */
+    static bool decode_path_offset(const char *p,const char *end,uint64_t &offset);
+
+    /* Write fname.idx for the feature file fname; sort_memory bounds the memory used.
+     * On an I/O error, warn, remove the partial fname.idx and return false.
+     */
+    static bool write_file(const std::string &fname,size_t sort_memory=256*1024*1024);
+
+    /* Index every feature file in a bulk_extractor output directory; histograms are skipped */
+    static void write_dir(const std::string &outdir);
+};
+
+#endif
@@ -8,13 +8,18 @@
 #include "bulk_extractor.h"
 #include "unicode_escape.h"
 #include "histogram.h"
-#include "utf8.h"
+#include "utf_util.h"
 
 using namespace std;
 
 ostream & operator << (ostream &os, const HistogramMaker::FrequencyReportVector &rep){
     for(HistogramMaker::FrequencyReportVector::const_iterator i = rep.begin(); i!=rep.end();i++){
-	os << "n=" << i->tally.count << "\t" << validateOrEscapeUTF8(i->value, true, true);
+	os << "n=" << i->tally.count << "\t";
+	if(ascii_plain(reinterpret_cast<const uint8_t *>(i->value.data()),i->value.size())){
+	    os << i->value;		// nothing to escape
+	} else {
+	    os << validateOrEscapeUTF8(i->value, true, true);
+	}
 	if(i->tally.count16>0) os << "\t(utf16=" << i->tally.count16<<")";
 	os << "\n";
     }
@@ -85,100 +90,49 @@ void HistogramMaker::add(const std::string &key)
     /**
      * "key" passed in is a const reference.
      * But we might want to change it. So keyToAdd points to what will be added.
-     * If we need to change key, we allocate more memory, and make keyToAdd
-     * point to the memory that was allocated. This way we only make a copy
-     * if we need to make a copy.
+     * Each conversion writes into whichever of scratch[0] and scratch[1]
+     * keyToAdd is not using, so keys are converted without allocating
+     * once those strings have grown.
      */
 
-    const std::string *keyToAdd = &key;	// should be a reference, but that doesn't work
-    std::string *tempKey = 0;		// place to hold UTF8 key
+    const std::string *keyToAdd = &key;
     bool found_utf16 = false;
     bool little_endian=false;
     if(looks_like_utf16(*keyToAdd,little_endian)){
-	/* re-image this string as UTF16*/
+	/* re-image this string as UTF-8 */
 	found_utf16 = true;
-	std::wstring utf16;
-	for(size_t i=0;i<key.size();i+=2){
-	    if(little_endian) utf16.push_back(key[i] | (key[i+1]<<8));
-	    else utf16.push_back(key[i]<<8 | (key[i+1]));
-	}
-	/* Now convert it to a UTF-8;
-	 * set tempKey to be the utf-8 string that will be erased.
-	 */
-	tempKey = new std::string;
-	try {
-	    utf8::utf16to8(utf16.begin(),utf16.end(),std::back_inserter(*tempKey));
+	std::string &utf8key = scratch_for(keyToAdd);
+	if(utf16_to_utf8(reinterpret_cast<const uint8_t *>(key.data()),key.size(),little_endian,utf8key)){
 	    /* Erase any nulls if present */
-	    while(tempKey->size()>0) {
-		size_t nullpos = tempKey->find('\000');
-		if(nullpos==string::npos) break;
-		tempKey->erase(nullpos,1);
-	    } 
-	    keyToAdd = tempKey;
-	} catch(utf8::invalid_utf16){
-	    /* Exception; bad UTF16 encoding */
-	    delete tempKey;
-	    tempKey = 0;		// give up on temp key; otherwise its invalidated below
-	}
-    }
-    
-    /* If any conversion is necessary AND we have not converted key from UTF-16 to UTF-8,
-     * then the original key is still in 'key'. Allocate tempKey and copy key to tempKey.
-     */
-    if(flags & (FLAG_LOWERCASE |FLAG_NUMERIC)){
-	if(tempKey==0){
-	    tempKey = new std::string(key);
-	    keyToAdd = tempKey;
+	    utf8key.erase(std::remove(utf8key.begin(),utf8key.end(),'\000'),utf8key.end());
+	    keyToAdd = &utf8key;
 	}
+	/* Otherwise bad UTF16 encoding; the key is added as it is */
     }
 
-
     /* Apply the flags */
-    // See: http://stackoverflow.com/questions/1081456/wchar-t-vs-wint-t
     if(flags & FLAG_LOWERCASE){
-	/* keyToAdd is UTF-8; convert to UTF-16, downcase, and convert back to UTF-8 */
-	try{
-	    std::wstring utf16key;
-	    utf8::utf8to16(tempKey->begin(),tempKey->end(),std::back_inserter(utf16key));
-	    for(std::wstring::iterator it = utf16key.begin();it!=utf16key.end();it++){
-		*it = towlower(*it);
-	    }
-	    /* erase tempKey and copy the utf16 back into tempKey as utf8 */
-	    tempKey->clear();		// erase the characters
-	    utf8::utf16to8(utf16key.begin(),utf16key.end(),std::back_inserter(*tempKey));
-	} catch(utf8::exception){
-	    /* Exception thrown during utf8 or 16 conversions.
-	     * So the string we thought was valid utf8 wasn't valid utf8 afterall.
-	     * tempKey will remain unchanged.
-	     */
+	/* keyToAdd is UTF-8; downcase it.
+	 * If it turns out not to be valid UTF-8 it is left unchanged.
+	 */
+	std::string &lower = scratch_for(keyToAdd);
+	if(utf8_tolower(reinterpret_cast<const uint8_t *>(keyToAdd->data()),keyToAdd->size(),lower)){
+	    keyToAdd = &lower;
 	}
     }
     if(flags & FLAG_NUMERIC){
-	/* keyToAdd is UTF-8; convert to UTF-16, extract digits, and convert back to UTF-8 */
-	std::string originalTempKey(*tempKey);
-	try{
-	    std::wstring utf16key;
-	    std::wstring utf16digits;
-	    utf8::utf8to16(tempKey->begin(),tempKey->end(),std::back_inserter(utf16key));
-	    for(std::wstring::iterator it = utf16key.begin();it!=utf16key.end();it++){
-		if(iswdigit(*it) || *it==static_cast<uint16_t>('+')){
-		    utf16digits.push_back(*it);
-		}
-	    }
-	    /* convert it back */
-	    tempKey->clear();		// erase the characters
-	    utf8::utf16to8(utf16digits.begin(),utf16digits.end(),std::back_inserter(*tempKey));
-	} catch(utf8::exception){
-	    /*Exception during utf8 or 16 conversions*.
-	     * So the string wasn't utf8.  Fall back to just extracting the digits
-	     */
-	    tempKey->clear();
-	    for(std::string::iterator it = originalTempKey.begin(); it!=originalTempKey.end(); it++){
+	/* keyToAdd is UTF-8; extract digits */
+	std::string &digits = scratch_for(keyToAdd);
+	if(!utf8_digits(reinterpret_cast<const uint8_t *>(keyToAdd->data()),keyToAdd->size(),digits)){
+	    /* The string wasn't utf8.  Fall back to just extracting the digits */
+	    digits.clear();
+	    for(std::string::const_iterator it = keyToAdd->begin(); it!=keyToAdd->end(); it++){
 		if(isdigit(*it)){
-		    tempKey->push_back(*it);
+		    digits.push_back(*it);
 		}
 	    }
 	}
+	keyToAdd = &digits;
     }
 
     /* For debugging low-memory handling logic,
@@ -190,10 +144,8 @@ void HistogramMaker::add(const std::string &key)
 	}
     }
 
-    h[*keyToAdd].count++;
-    if(found_utf16) h[*keyToAdd].count16++; // track how many UTF16s were converted
-    if(tempKey){				// if we allocated tempKey, free it
-	delete tempKey;
-    }
+    histogramTally &t = h[*keyToAdd];
+    t.count++;
+    if(found_utf16) t.count16++;	// track how many UTF16s were converted
 }
     
@@ -98,6 +98,10 @@ private:
     typedef std::map<std::string,histogramTally> HistogramMap;
     HistogramMap h;			// holds the histogram
     uint32_t     flags;			// see above
+    std::string  scratch[2];		// converted keys, reused by add()
+
+    /* The scratch string that key is not */
+    std::string &scratch_for(const std::string *key){ return key==&scratch[0] ? scratch[1] : scratch[0]; }
 public:
 
     /**
@@ -105,7 +109,7 @@ public:
      */
     static bool looks_like_utf16(const std::string &str,bool &little_endian); 
 
-    HistogramMaker(uint32_t flags_):h(),flags(flags_){}
+    HistogramMaker(uint32_t flags_):h(),flags(flags_),scratch(){}
     void clear(){h.clear();}
     void add(const std::string &key);	// adds a string to the histogram count
 
@@ -0,0 +1,547 @@
+/*
+ * identify_filenames.cpp:
+ * Report the file that holds each feature found by bulk_extractor.
+ *
+ * A native version of python/identify_filenames.py for large cases. The
+ * byte runs of a fiwalk DFXML file are loaded into two sorted interval
+ * indexes, one for allocated and one for unallocated files, and the
+ * feature files are annotated in parallel, one per thread, with the name
+ * and MD5 of the file whose byte run holds each feature. The output is
+ * the same as that of the Python tool.
+ */
+
+#include "bulk_extractor.h"
+#include "aftimer.h"
+#include "feature_index.h"
+#include "line_reader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <pthread.h>
+
+#ifdef HAVE_EXPAT_H
+#include <expat.h>
+#endif
+
+static bool opt_terse = false;
+static const size_t io_buffer_size = line_reader::default_buffer_size;
+
+/****************************************************************
+ *** The byte run index
+ ****************************************************************/
+
+struct byte_run_t {
+    uint64_t start;
+    uint64_t end;			// one past the last byte
+    uint32_t file;			// index into byte_run_index::files
+};
+
+/**
+ * A sorted array of byte runs. The names and MD5s of the files are kept
+ * once each, as NUL-terminated strings in a single pool.
+ */
+class byte_run_index {
+    struct file_t {
+        size_t name;			// offsets into pool
+        size_t md5;
+    };
+    struct run_less {
+        const byte_run_index &idx;
+        run_less(const byte_run_index &idx_):idx(idx_){}
+        bool operator()(const byte_run_t &a,const byte_run_t &b) const {
+            if(a.start!=b.start) return a.start<b.start;
+            if(a.end!=b.end) return a.end<b.end;
+            int r = strcmp(idx.name(a),idx.name(b)); // ties are broken as the Python tool sorted them
+            if(r!=0) return r<0;
+            return strcmp(idx.md5(a),idx.md5(b))<0;
+        }
+    };
+    std::vector<byte_run_t> runs;
+    std::vector<file_t> files;
+    std::string pool;
+public:
+    byte_run_index():runs(),files(),pool(){}
+
+    /* Add a file; return its index for add_run() */
+    uint32_t add_file(const std::string &fname,const std::string &md5val){
+        file_t f;
+        f.name = pool.size();
+        pool.append(fname);
+        pool.push_back('\0');
+        f.md5  = pool.size();
+        pool.append(md5val);
+        pool.push_back('\0');
+        files.push_back(f);
+        return files.size()-1;
+    }
+    void add_run(uint64_t img_offset,uint64_t len,uint32_t file){
+        byte_run_t r;
+        r.start = img_offset;
+        r.end   = img_offset+len;
+        r.file  = file;
+        runs.push_back(r);
+    }
+    void sort(){
+        std::sort(runs.begin(),runs.end(),run_less(*this));
+    }
+    size_t size() const { return runs.size(); }
+    const char *name(const byte_run_t &r) const { return pool.data()+files[r.file].name; }
+    const char *md5(const byte_run_t &r)  const { return pool.data()+files[r.file].md5; }
+
+    /**
+     * Return the run that starts at pos, or else the run before pos if it
+     * holds pos, or NULL. As with the Python tool, only that one run is
+     * looked at when runs overlap.
+     */
+    const byte_run_t *search(uint64_t pos) const {
+        size_t lo = 0;
+        size_t hi = runs.size();
+        while(lo<hi){			// find the first run that starts at or after pos
+            size_t mid = lo+(hi-lo)/2;
+            if(runs[mid].start<pos) lo = mid+1;
+            else hi = mid;
+        }
+        if(lo<runs.size() && runs[lo].start==pos) return &runs[lo];
+        if(lo==0) return 0;
+        const byte_run_t &prev = runs[lo-1];
+        if(prev.start<=pos && pos<prev.end) return &prev;
+        return 0;
+    }
+};
+
+/* Search the allocated files first, then the unallocated ones */
+struct byte_run_db {
+    byte_run_index allocated;
+    byte_run_index unallocated;
+    uint64_t filecount;
+    byte_run_db():allocated(),unallocated(),filecount(0){}
+
+    const byte_run_t *search(uint64_t pos,const byte_run_index *&idx) const {
+        idx = &allocated;
+        const byte_run_t *r = allocated.search(pos);
+        if(r) return r;
+        idx = &unallocated;
+        return unallocated.search(pos);
+    }
+};
+
+/****************************************************************
+ *** DFXML reader
+ ****************************************************************/
+
+/**
+ * Reads the fileobjects of a DFXML file with expat. Of each fileobject
+ * only the filename, MD5, allocation flag and the image offset and length
+ * of each byte run are kept.
+ */
+class dfxml_run_reader {
+    byte_run_db &db;
+    std::string cdata;
+    int fileobject_depth;		// 0 when not in a fileobject
+    int depth;
+    std::string hashdigest_type;
+    std::string fname;
+    std::string md5val;
+    std::string alloc;
+    std::vector<std::pair<uint64_t,uint64_t> > runs;
+
+    static bool is_one(const std::string &s){
+        return s.size()>0 && strtol(s.c_str(),0,10)==1;
+    }
+    void end_fileobject(){
+        if(runs.size()>0){
+            bool allocated = fname!="$OrphanFiles" && is_one(alloc);
+            byte_run_index &idx = allocated ? db.allocated : db.unallocated;
+            uint32_t file = idx.add_file(fname,md5val);
+            for(size_t i=0;i<runs.size();i++){
+                idx.add_run(runs[i].first,runs[i].second,file);
+            }
+        }
+        fname.clear();
+        md5val.clear();
+        alloc.clear();
+        runs.clear();
+        db.filecount++;
+        if(db.filecount % 1000000==0){
+            std::cout << "Processed " << db.filecount << " fileobjects in DFXML file\n";
+        }
+    }
+#ifdef HAVE_LIBEXPAT
+    static void startElement(void *userData,const char *name_,const char **attrs){
+        dfxml_run_reader &self = *(dfxml_run_reader *)userData;
+        self.depth++;
+        self.cdata.clear();
+        if(strcmp(name_,"fileobject")==0){
+            self.fileobject_depth = self.depth;
+            return;
+        }
+        if(self.fileobject_depth==0) return;
+        if(strcmp(name_,"hashdigest")==0){
+            self.hashdigest_type.clear();
+            for(int i=0;attrs[i] && attrs[i+1];i+=2){
+                if(strcmp(attrs[i],"type")==0) self.hashdigest_type = attrs[i+1];
+            }
+            return;
+        }
+        if(strcmp(name_,"byte_run")==0 || strcmp(name_,"run")==0){
+            const char *img_offset = 0;
+            const char *len = 0;
+            for(int i=0;attrs[i] && attrs[i+1];i+=2){
+                if(strcmp(attrs[i],"img_offset")==0) img_offset = attrs[i+1];
+                else if(strcmp(attrs[i],"len")==0) len = attrs[i+1];
+            }
+            /* Runs of a fill value have no img_offset */
+            if(img_offset && len){
+                self.runs.push_back(std::pair<uint64_t,uint64_t>(strtoull(img_offset,0,10),strtoull(len,0,10)));
+            }
+        }
+    }
+    static void endElement(void *userData,const char *name_){
+        dfxml_run_reader &self = *(dfxml_run_reader *)userData;
+        if(self.fileobject_depth>0){
+            if(self.depth==self.fileobject_depth){
+                self.end_fileobject();
+                self.fileobject_depth = 0;
+            } else if(strcmp(name_,"filename")==0){
+                self.fname = self.cdata;
+            } else if(strcmp(name_,"md5")==0){
+                self.md5val = self.cdata;
+            } else if(strcmp(name_,"alloc")==0 || strcmp(name_,"ALLOC")==0){
+                self.alloc = self.cdata;
+            } else if(strcmp(name_,"hashdigest")==0 && self.depth==self.fileobject_depth+1
+                      && strcasecmp(self.hashdigest_type.c_str(),"md5")==0){
+                self.md5val = self.cdata;
+            }
+        }
+        self.cdata.clear();
+        self.depth--;
+    }
+    static void characterDataHandler(void *userData,const XML_Char *s,int len){
+        dfxml_run_reader &self = *(dfxml_run_reader *)userData;
+        if(self.fileobject_depth>0) self.cdata.append(s,len);
+    }
+#endif
+public:
+    dfxml_run_reader(byte_run_db &db_):db(db_),cdata(),fileobject_depth(0),depth(0),
+                                        hashdigest_type(),fname(),md5val(),alloc(),runs(){}
+
+    void read(const std::string &xmlfile){
+#ifdef HAVE_LIBEXPAT
+        FILE *f = fopen(xmlfile.c_str(),"rb");
+        if(!f) err(1,"%s",xmlfile.c_str());
+        XML_Parser parser = XML_ParserCreate(NULL);
+        XML_SetUserData(parser, this);
+        XML_SetElementHandler(parser, startElement, endElement);
+        XML_SetCharacterDataHandler(parser,characterDataHandler);
+        std::vector<char> buf(io_buffer_size);
+        size_t count;
+        while((count = fread(&buf[0],1,buf.size(),f))>0){
+            if(!XML_Parse(parser,&buf[0],count,0)){
+                errx(1,"%s: XML Error: %s at line %d",xmlfile.c_str(),
+                     XML_ErrorString(XML_GetErrorCode(parser)),(int)XML_GetCurrentLineNumber(parser));
+            }
+        }
+        if(ferror(f)) err(1,"%s",xmlfile.c_str());
+        XML_Parse(parser,"",0,1);	// clear the parser
+        XML_ParserFree(parser);
+        fclose(f);
+#else
+        errx(1,"Compiled without libexpat; cannot read %s.",xmlfile.c_str());
+#endif
+    }
+};
+
+/****************************************************************
+ *** Feature files
+ ****************************************************************/
+
+/* A line of a feature file has 2 to 5 tab-separated fields and starts with a digit */
+static bool is_feature_line(const char *line,size_t len)
+{
+    if(len>0 && line[len-1]=='\n') len--;
+    int tabs = 0;
+    for(size_t i=0;i<len;i++) if(line[i]=='\t') tabs++;
+    return tabs>=1 && tabs<=4 && len>0 && line[0]>='0' && line[0]<='9';
+}
+
+static bool is_feature_file(const std::string &dir,const std::string &fname)
+{
+    if(fname.size()<4 || fname.substr(fname.size()-4)!=".txt") return false;
+    if(fname.find("_histogram")!=std::string::npos) return false;
+    if(fname.find("_stopped")!=std::string::npos) return false;
+    if(fname.find("_tags")!=std::string::npos) return false;
+    if(fname.find("wordlist")!=std::string::npos) return false;
+    FILE *f = fopen((dir+"/"+fname).c_str(),"rb");
+    if(!f) return false;
+    line_reader lr(f);
+    const char *line;
+    size_t len;
+    bool ret = false;
+    while(lr.getline(line,len)){
+        if(is_comment_line(line,len)) continue;
+        ret = is_feature_line(line,len);
+        break;
+    }
+    fclose(f);
+    return ret;
+}
+
+static std::vector<std::string> feature_files(const std::string &dir)
+{
+    std::vector<std::string> ret;
+    DIR *d = opendir(dir.c_str());
+    if(!d) err(1,"%s",dir.c_str());
+    struct dirent *de;
+    while((de = readdir(d))!=0){
+        if(is_feature_file(dir,de->d_name)) ret.push_back(de->d_name);
+    }
+    closedir(d);
+    std::sort(ret.begin(),ret.end());
+    return ret;
+}
+
+struct featurefile_stats {
+    uint64_t feature_count;
+    uint64_t located_count;
+    uint64_t unallocated_count;
+    uint64_t features_encoded;
+    featurefile_stats():feature_count(0),located_count(0),unallocated_count(0),features_encoded(0){}
+};
+
+static void process_featurefile(const byte_run_db &db,FILE *in,FILE *out)
+{
+    featurefile_stats st;
+    aftimer t;
+    t.start();
+    if(opt_terse){
+        fputs("# Position\tFeature\tFilename\n",out);
+    } else {
+        fputs("# Position\tFeature\tContext\tFilename\tFile MD5\n",out);
+    }
+    line_reader lr(in);
+    const char *line;
+    size_t len;
+    while(lr.getline(line,len)){
+        if(is_comment_line(line,len)){
+            fwrite(line,1,len,out);
+            continue;
+        }
+        if(line[len-1]=='\n') len--;
+        const char *end = line+len;
+        const char *tab1 = (const char *)memchr(line,'\t',len);
+        if(!tab1){				// not a feature; keep it
+            fwrite(line,1,len,out);
+            fputc('\n',out);
+            continue;
+        }
+        const char *tab2 = (const char *)memchr(tab1+1,'\t',end-(tab1+1));
+        const char *feature_end = tab2 ? tab2 : end;
+        st.feature_count++;
+
+        bool encoded = memchr(line,'-',tab1-line)!=0;
+        if(encoded) st.features_encoded++;
+        uint64_t offset = 0;
+        const byte_run_t *r = 0;
+        const byte_run_index *idx = 0;
+        if(feature_index::decode_path_offset(line,tab1,offset)) r = db.search(offset,idx);
+        const char *fname = "";
+        const char *md5val = "";
+        if(r){
+            st.located_count++;
+            fname  = idx->name(*r);
+            md5val = idx->md5(*r);
+        } else {
+            st.unallocated_count++;
+        }
+        fwrite(line,1,feature_end-line,out); // position and feature
+        if(!opt_terse){
+            fputc('\t',out);
+            if(tab2) fwrite(tab2+1,1,end-(tab2+1),out);
+        }
+        fputc('\t',out);
+        fputs(fname,out);
+        if(!opt_terse){
+            fputc('\t',out);
+            fputs(md5val,out);
+        }
+        fputc('\n',out);
+    }
+    t.stop();
+    fprintf(out,"# Total features input: %" PRIu64 "\n",st.feature_count);
+    fprintf(out,"# Total features located to files: %" PRIu64 "\n",st.located_count);
+    fprintf(out,"# Total features in unallocated space: %" PRIu64 "\n",st.unallocated_count);
+    fprintf(out,"# Total features in encoded regions: %" PRIu64 "\n",st.features_encoded);
+    fprintf(out,"# Total processing time: %.2f seconds\n",t.elapsed_seconds());
+}
+
+/****************************************************************
+ *** Workers
+ ****************************************************************/
+
+/* The feature files are handed out to the threads one at a time */
+struct work_queue {
+    const byte_run_db &db;
+    const std::string &indir;
+    const std::string &outdir;
+    const std::vector<std::string> &files;
+    size_t next;
+    pthread_mutex_t M;
+    work_queue(const byte_run_db &db_,const std::string &indir_,const std::string &outdir_,
+               const std::vector<std::string> &files_):
+        db(db_),indir(indir_),outdir(outdir_),files(files_),next(0),M(){
+        pthread_mutex_init(&M,NULL);
+    }
+    ~work_queue(){
+        pthread_mutex_destroy(&M);
+    }
+    /* Return the next file to do, or NULL when there are none left */
+    const std::string *get(){
+        const std::string *ret = 0;
+        pthread_mutex_lock(&M);
+        if(next<files.size()){
+            ret = &files[next++];
+            std::cout << "feature_file: " << *ret << "\n";
+        }
+        pthread_mutex_unlock(&M);
+        return ret;
+    }
+private:
+    work_queue(const work_queue &);
+    work_queue &operator=(const work_queue &);
+};
+
+static std::string output_name(const std::string &outdir,const std::string &feature_file)
+{
+    return outdir + "/annotated_" + feature_file;
+}
+
+static void *worker(void *arg)
+{
+    work_queue &wq = *(work_queue *)arg;
+    const std::string *feature_file;
+    while((feature_file = wq.get())!=0){
+        std::string infn  = wq.indir + "/" + *feature_file;
+        std::string outfn = output_name(wq.outdir,*feature_file);
+        FILE *in = fopen(infn.c_str(),"rb");
+        if(!in) err(1,"%s",infn.c_str());
+        FILE *out = fopen(outfn.c_str(),"wb");
+        if(!out) err(1,"%s",outfn.c_str());
+        setvbuf(out,0,_IOFBF,io_buffer_size);
+        process_featurefile(wq.db,in,out);
+        fclose(in);
+        if(fclose(out)) err(1,"%s",outfn.c_str());
+    }
+    return 0;
+}
+
+static int default_threads()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n>0) return n;
+#endif
+    return 1;
+}
+
+static void usage()
+{
+    std::cerr << "usage: identify_filenames [options] bulk_extractor_output outdir\n"
+              << "Identify the files that hold the features found by bulk_extractor.\n"
+              << "   -x xmlfile   - fiwalk DFXML file of the image (required)\n"
+              << "   -a           - process all feature files\n"
+              << "   -f files     - feature files to process; separate with commas\n"
+              << "   -l           - list the feature files in bulk_extractor_output and exit\n"
+              << "   -t           - terse output\n"
+              << "   -j NN        - number of threads (default " << default_threads() << ")\n"
+              << "   -h           - print this message\n"
+              << "outdir is created if it does not exist. Each feature file FILE is\n"
+              << "written to outdir/annotated_FILE, which must not exist.\n";
+}
+
+int main(int argc,char **argv)
+{
+    std::string xmlfile;
+    std::string opt_featurefiles;
+    bool opt_all  = false;
+    bool opt_list = false;
+    int num_threads = default_threads();
+    int ch;
+    while((ch = getopt(argc,argv,"x:af:ltj:h")) != -1){
+        switch(ch){
+        case 'x': xmlfile = optarg; break;
+        case 'a': opt_all = true; break;
+        case 'f': opt_featurefiles = optarg; break;
+        case 'l': opt_list = true; break;
+        case 't': opt_terse = true; break;
+        case 'j':
+            num_threads = atoi(optarg);
+            if(num_threads<1) errx(1,"-j must be at least 1");
+            break;
+        case 'h': usage(); exit(0);
+        default:  usage(); exit(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc<1 || (argc<2 && !opt_list)){
+        usage();
+        exit(1);
+    }
+    std::string indir = argv[0];
+
+    if(opt_list){
+        std::vector<std::string> files = feature_files(indir);
+        std::cout << "Feature files in " << indir << ":\n";
+        for(size_t i=0;i<files.size();i++) std::cout << files[i] << "\n";
+        exit(1);
+    }
+    std::string outdir = argv[1];
+
+    std::vector<std::string> files;
+    if(opt_featurefiles.size()>0){
+        size_t start = 0;
+        while(start<=opt_featurefiles.size()){
+            size_t comma = opt_featurefiles.find(',',start);
+            if(comma==std::string::npos) comma = opt_featurefiles.size();
+            if(comma>start) files.push_back(opt_featurefiles.substr(start,comma-start));
+            start = comma+1;
+        }
+    }
+    if(opt_all) files = feature_files(indir);
+    if(files.size()==0) errx(1,"Please request a specific feature file with -f or all feature files with -a");
+    if(xmlfile.size()==0) errx(1,"Please provide the fiwalk DFXML file of the image with -x");
+
+    struct stat st;
+    if(stat(outdir.c_str(),&st)){
+#ifdef WIN32
+        if(mkdir(outdir.c_str())) err(1,"%s",outdir.c_str());
+#else
+        if(mkdir(outdir.c_str(),0777)) err(1,"%s",outdir.c_str());
+#endif
+    } else if(!S_ISDIR(st.st_mode)){
+        errx(1,"%s must be a directory",outdir.c_str());
+    }
+    for(size_t i=0;i<files.size();i++){
+        std::string outfn = output_name(outdir,files[i]);
+        if(access(outfn.c_str(),F_OK)==0) errx(1,"%s exists",outfn.c_str());
+    }
+
+    byte_run_db db;
+    dfxml_run_reader(db).read(xmlfile);
+    db.allocated.sort();
+    db.unallocated.sort();
+    std::cout << xmlfile << ": " << db.filecount << " fileobjects, "
+              << db.allocated.size() << " allocated and "
+              << db.unallocated.size() << " unallocated byte runs\n";
+
+    work_queue wq(db,indir,outdir,files);
+    if(num_threads>(int)files.size()) num_threads = files.size();
+    std::vector<pthread_t> threads(num_threads);
+    for(int i=0;i<num_threads;i++){
+        if(pthread_create(&threads[i],NULL,worker,&wq)) errx(1,"pthread_create failed");
+    }
+    for(int i=0;i<num_threads;i++){
+        pthread_join(threads[i],NULL);
+    }
+    return 0;
+}
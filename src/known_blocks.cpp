@@ -0,0 +1,132 @@
+/**
+ * known_blocks.cpp:
+ * A memory-mapped set of known block hashes. See known_blocks.h for the file layout.
+ */
+
+#include "bulk_extractor.h"
+#include "known_blocks.h"
+#include "dfxml/src/hash_t.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+const char known_blocks::MAGIC[8] = {'B','E','K','N','O','W','N','1'};
+
+uint64_t known_blocks::bloom_probe(const uint8_t digest[16],uint32_t i,uint64_t bloom_bits)
+{
+    uint64_t h1,h2;
+    memcpy(&h1,digest,8);
+    memcpy(&h2,digest+8,8);
+    return (h1 + i*(h2|1)) & (bloom_bits-1);
+}
+
+void known_blocks::write_file(const std::string &fname,uint32_t block_size,
+                              const uint8_t *digests,uint64_t count)
+{
+    /* About 16 bits and 8 probes per digest gives a false positive rate near 0.05% */
+    header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,MAGIC,sizeof(h.magic));
+    h.block_size = block_size;
+    h.bloom_k    = 8;
+    h.bloom_bits = 1<<16;
+    while(h.bloom_bits < count*16) h.bloom_bits <<= 1;
+    h.count      = count;
+
+    std::vector<uint8_t> bloom(h.bloom_bits/8);
+    for(uint64_t n=0;n<count;n++){
+        for(uint32_t i=0;i<h.bloom_k;i++){
+            uint64_t bit = bloom_probe(digests+n*16,i,h.bloom_bits);
+            bloom[bit/8] |= 1<<(bit%8);
+        }
+    }
+
+    FILE *f = fopen(fname.c_str(),"wb");
+    if(!f) err(1,"%s",fname.c_str());
+    if(fwrite(&h,sizeof(h),1,f)!=1 ||
+       fwrite(&bloom[0],1,bloom.size(),f)!=bloom.size() ||
+       (count>0 && fwrite(digests,16,count,f)!=count)){
+        err(1,"%s",fname.c_str());
+    }
+    if(fclose(f)) err(1,"%s",fname.c_str());
+}
+
+known_blocks::known_blocks(const std::string &fname_):
+    fname(fname_),base(0),base_len(0),mapped(false),hdr(0),bloom(0),digests(0)
+{
+    int fd = open(fname.c_str(),O_RDONLY|O_BINARY);
+    if(fd<0) err(1,"%s",fname.c_str());
+    struct stat st;
+    if(fstat(fd,&st)) err(1,"%s",fname.c_str());
+    base_len = st.st_size;
+    if(base_len < sizeof(header)) errx(1,"%s: not a known blocks file",fname.c_str());
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    void *m = mmap(0,base_len,PROT_READ,MAP_SHARED,fd,0);
+    if(m==MAP_FAILED) err(1,"%s: mmap",fname.c_str());
+    base = static_cast<const uint8_t *>(m);
+    mapped = true;
+#else
+    uint8_t *buf = static_cast<uint8_t *>(malloc(base_len));
+    if(buf==0) errx(1,"%s: cannot allocate %zu bytes",fname.c_str(),base_len);
+    for(size_t off=0;off<base_len;){
+        ssize_t r = read(fd,buf+off,base_len-off);
+        if(r<=0) err(1,"%s",fname.c_str());
+        off += r;
+    }
+    base = buf;
+#endif
+    close(fd);
+
+    hdr = reinterpret_cast<const header *>(base);
+    if(memcmp(hdr->magic,MAGIC,sizeof(MAGIC))!=0) errx(1,"%s: not a known blocks file",fname.c_str());
+    if(hdr->block_size==0 || hdr->bloom_bits<8 || (hdr->bloom_bits & (hdr->bloom_bits-1))){
+        errx(1,"%s: invalid known blocks header",fname.c_str());
+    }
+    if(base_len != sizeof(header) + hdr->bloom_bits/8 + hdr->count*16){
+        errx(1,"%s: known blocks file is truncated",fname.c_str());
+    }
+    bloom   = base + sizeof(header);
+    digests = bloom + hdr->bloom_bits/8;
+}
+
+known_blocks::~known_blocks()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if(mapped) munmap(const_cast<uint8_t *>(base),base_len);
+#endif
+    if(!mapped) free(const_cast<uint8_t *>(base));
+}
+
+bool known_blocks::contains(const uint8_t digest[16]) const
+{
+    for(uint32_t i=0;i<hdr->bloom_k;i++){
+        uint64_t bit = bloom_probe(digest,i,hdr->bloom_bits);
+        if((bloom[bit/8] & (1<<(bit%8)))==0) return false;
+    }
+    uint64_t lo = 0;
+    uint64_t hi = hdr->count;
+    while(lo<hi){
+        uint64_t mid = lo + (hi-lo)/2;
+        int c = memcmp(digests+mid*16,digest,16);
+        if(c==0) return true;
+        if(c<0) lo = mid+1;
+        else    hi = mid;
+    }
+    return false;
+}
+
+bool known_blocks::all_known(const uint8_t *buf,size_t len) const
+{
+    const size_t bs = hdr->block_size;
+    if(len==0 || len % bs != 0) return false;
+    for(size_t off=0;off<len;off+=bs){
+        md5_t md5 = md5_generator::hash_buf(buf+off,bs);
+        if(!contains(md5.digest)) return false;
+    }
+    return true;
+}
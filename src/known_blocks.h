@@ -0,0 +1,70 @@
+#ifndef KNOWN_BLOCKS_H
+#define KNOWN_BLOCKS_H
+
+/**
+ * \file
+ * A set of known block hashes (for example, the block hashes of an NSRL-style
+ * known-file set), used to skip pages that contain nothing but known blocks.
+ *
+ * The set is a file built by build_known_blocks and memory-mapped read-only,
+ * so any number of threads may query it. It holds a Bloom filter followed by
+ * the sorted MD5 digests of the blocks:
+ *
+ * \verbatim
+ *   header        (struct known_blocks::header)
+ *   bloom filter  (bloom_bits/8 bytes)
+ *   digests       (count * 16 bytes, sorted by memcmp)
+ * \endverbatim
+ *
+ * Almost every block of a typical image is not in the set, and the Bloom
+ * filter answers those without touching the digests. Blocks that pass the
+ * filter are confirmed by binary search.
+ */
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+class known_blocks {
+public:
+    static const char MAGIC[8];		// "BEKNOWN1"
+    struct header {
+        char     magic[8];
+        uint32_t block_size;		// bytes hashed per block
+        uint32_t bloom_k;		// probes per digest
+        uint64_t bloom_bits;		// a power of two
+        uint64_t count;			// number of digests
+    };
+
+    /* Bloom probe i of a digest; digests are uniform, so their halves serve as the two hashes */
+    static uint64_t bloom_probe(const uint8_t digest[16],uint32_t i,uint64_t bloom_bits);
+
+    /* Write a set file; digests are 16-byte MD5s and must be sorted and unique */
+    static void write_file(const std::string &fname,uint32_t block_size,
+                           const uint8_t *digests,uint64_t count);
+
+    /* Map a set file; errx() if it is not a valid set */
+    explicit known_blocks(const std::string &fname);
+    virtual ~known_blocks();
+
+    uint32_t block_size() const { return hdr->block_size; }
+    uint64_t size() const { return hdr->count; }
+    bool contains(const uint8_t digest[16]) const;
+
+    /* True if buf[0..len) is a whole number of blocks and every one is known */
+    bool all_known(const uint8_t *buf,size_t len) const;
+
+private:
+    known_blocks(const known_blocks &);
+    known_blocks &operator=(const known_blocks &);
+
+    std::string fname;
+    const uint8_t *base;		// the mapped file
+    size_t   base_len;
+    bool     mapped;			// false if base was read into memory
+    const header  *hdr;
+    const uint8_t *bloom;
+    const uint8_t *digests;
+};
+
+#endif
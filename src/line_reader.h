@@ -0,0 +1,62 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+/**
+ * \file
+ * Read the lines of a feature file through a large buffer, for the tools
+ * that post-process bulk_extractor output.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+class line_reader {
+    FILE *f;
+    std::vector<char> buf;
+    size_t start;
+    size_t end;
+    line_reader(const line_reader &);
+    line_reader &operator=(const line_reader &);
+public:
+    static const size_t default_buffer_size = 1024*1024;
+
+    line_reader(FILE *f_,size_t bufsize=default_buffer_size):f(f_),buf(bufsize),start(0),end(0){}
+
+    /* Set line and len to the next line, with its newline if it has one; return false at EOF */
+    bool getline(const char *&line,size_t &len){
+        for(;;){
+            const char *nl = (const char *)memchr(&buf[0]+start,'\n',end-start);
+            if(nl){
+                line  = &buf[0]+start;
+                len   = nl+1-line;
+                start += len;
+                return true;
+            }
+            if(start>0){			// move the partial line to the front
+                memmove(&buf[0],&buf[0]+start,end-start);
+                end -= start;
+                start = 0;
+            }
+            if(end==buf.size()) buf.resize(buf.size()*2);
+            size_t count = fread(&buf[0]+end,1,buf.size()-end,f);
+            if(count==0){
+                if(end==0) return false;
+                line  = &buf[0];	// the last line has no newline
+                len   = end;
+                start = end = 0;
+                return true;
+            }
+            end += count;
+        }
+    }
+};
+
+/* A comment line of a feature file starts with '#', perhaps after a UTF-8 BOM */
+inline bool is_comment_line(const char *line,size_t len)
+{
+    if(len>=4 && memcmp(line,"\xef\xbb\xbf#",4)==0) return true;
+    return len>=1 && line[0]=='#';
+}
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * metrics.cpp:
+ * Periodically write the progress of phase 1 as Prometheus metrics.
+ * See metrics.h for the metrics written.
+ */
+
+#include "bulk_extractor.h"
+#include "metrics.h"
+#include "threadpool.h"
+#include "scanner_stats.h"
+#include "be13_api/cppmutex.h"
+
+/* Seconds on the monotonic clock if there is one, for the elapsed time */
+static double now()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC,&ts)==0) return (double)ts.tv_sec + (double)ts.tv_nsec/1000000000.0;
+#endif
+    struct timeval tv;
+    gettimeofday(&tv,0);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/* Escape a label value: backslash, double-quote and newline */
+static std::string label(const std::string &s)
+{
+    std::string ret;
+    for(std::string::const_iterator it=s.begin();it!=s.end();it++){
+        switch(*it){
+        case '\\': ret += "\\\\"; break;
+        case '"':  ret += "\\\""; break;
+        case '\n': ret += "\\n"; break;
+        default:   ret += *it;
+        }
+    }
+    return ret;
+}
+
+static void header(std::ostream &os,const char *name,const char *type,const char *help)
+{
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " " << type << "\n";
+}
+
+/* The per-scanner calls and time, as stat_callback writes them to report.xml */
+struct scanner_stat {
+    std::string name;
+    uint64_t calls;
+    double seconds;
+};
+
+static void metrics_stat_callback(void *user,const std::string &name,uint64_t calls,double seconds)
+{
+    scanner_stat s;
+    s.name = name;
+    s.calls = calls;
+    s.seconds = seconds;
+    ((std::vector<scanner_stat> *)user)->push_back(s);
+}
+
+/* Return the resident and peak resident set sizes in bytes; 0 if not known */
+static void get_rss(uint64_t &rss,uint64_t &max_rss)
+{
+    rss = 0;
+    max_rss = 0;
+    FILE *f = fopen("/proc/self/statm","r");
+    if(f){
+        unsigned long size=0,resident=0;
+        if(fscanf(f,"%lu %lu",&size,&resident)==2){
+            rss = (uint64_t)resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(f);
+    }
+#ifdef HAVE_GETRUSAGE
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF,&ru)==0){
+#ifdef __APPLE__
+        max_rss = ru.ru_maxrss;			// bytes
+#else
+        max_rss = (uint64_t)ru.ru_maxrss * 1024;	// kilobytes
+#endif
+    }
+#endif
+}
+
+metrics_writer::metrics_writer(const std::string &fname_,uint32_t interval_,threadpool &tp_,uint64_t image_size_):
+    fname(fname_),interval(interval_>0 ? interval_ : 1),tp(tp_),image_size(image_size_),t0(now()),
+    M(),C(),bytes_read(0),stopping(false),started(false),thread()
+{
+    if(pthread_mutex_init(&M,NULL)) errx(1,"metrics_writer: pthread_mutex_init failed");
+    if(pthread_cond_init(&C,NULL)) errx(1,"metrics_writer: pthread_cond_init failed");
+    write(false);			// so the file exists as soon as the scan starts
+    if(pthread_create(&thread,NULL,start_thread,(void *)this)) errx(1,"metrics_writer: pthread_create failed");
+    started = true;
+}
+
+metrics_writer::~metrics_writer()
+{
+    finish();
+    pthread_cond_destroy(&C);
+    pthread_mutex_destroy(&M);
+}
+
+void metrics_writer::add_bytes(uint64_t n)
+{
+    pthread_mutex_lock(&M);
+    bytes_read += n;
+    pthread_mutex_unlock(&M);
+}
+
+void metrics_writer::finish()
+{
+    if(!started) return;
+    pthread_mutex_lock(&M);
+    stopping = true;
+    pthread_cond_signal(&C);
+    pthread_mutex_unlock(&M);
+    pthread_join(thread,NULL);
+    started = false;
+    write(true);
+}
+
+void *metrics_writer::run()
+{
+    pthread_mutex_lock(&M);
+    while(!stopping){
+        /* pthread_cond_timedwait takes a time of day */
+        struct timeval tv;
+        gettimeofday(&tv,0);
+        struct timespec ts;
+        ts.tv_sec  = tv.tv_sec + interval;
+        ts.tv_nsec = tv.tv_usec * 1000;
+        while(!stopping && pthread_cond_timedwait(&C,&M,&ts)!=ETIMEDOUT){
+        }
+        if(stopping) break;
+        pthread_mutex_unlock(&M);
+        write(false);
+        pthread_mutex_lock(&M);
+    }
+    pthread_mutex_unlock(&M);
+    return 0;
+}
+
+void metrics_writer::write(bool complete)
+{
+    pthread_mutex_lock(&M);
+    uint64_t bytes = bytes_read;
+    pthread_mutex_unlock(&M);
+
+    size_t queued = 0;
+    int nfree = 0;
+    std::vector<std::string> status;
+    tp.get_status(queued,nfree,status);
+
+    std::vector<scanner_stat> stats;
+    scanner_stats::get_stats(&stats,metrics_stat_callback);
+
+    uint64_t rss,max_rss;
+    get_rss(rss,max_rss);
+
+    double elapsed = now() - t0;
+    if(elapsed<0) elapsed = 0;		// the time of day stepped back
+    std::stringstream ss;
+    ss.precision(6);
+    ss << std::fixed;
+
+    header(ss,"bulk_extractor_image_bytes","gauge","Size of the image being scanned.");
+    ss << "bulk_extractor_image_bytes " << image_size << "\n";
+    header(ss,"bulk_extractor_bytes_read_total","counter","Bytes of the image read by phase 1.");
+    ss << "bulk_extractor_bytes_read_total " << bytes << "\n";
+    header(ss,"bulk_extractor_elapsed_seconds","gauge","Seconds since phase 1 started.");
+    ss << "bulk_extractor_elapsed_seconds " << elapsed << "\n";
+    header(ss,"bulk_extractor_read_mb_per_second","gauge","Average read rate since phase 1 started.");
+    ss << "bulk_extractor_read_mb_per_second " << (elapsed>0 ? bytes/elapsed/1000000.0 : 0) << "\n";
+
+    header(ss,"bulk_extractor_queue_depth","gauge","Pages waiting for a worker thread.");
+    ss << "bulk_extractor_queue_depth " << queued << "\n";
+    header(ss,"bulk_extractor_threads","gauge","Worker threads.");
+    ss << "bulk_extractor_threads " << status.size() << "\n";
+    header(ss,"bulk_extractor_threads_busy","gauge","Worker threads processing or about to process a page.");
+    ss << "bulk_extractor_threads_busy " << (int)status.size() - nfree << "\n";
+    /* The thread_status names the page being processed, so it is not a label: each page would be a new series */
+    header(ss,"bulk_extractor_thread_busy","gauge","1 if the worker thread is processing a page.");
+    for(size_t i=0;i<status.size();i++){
+        const std::string &st = status[i];
+        ss << "bulk_extractor_thread_busy{thread=\"" << i << "\"} " << (st.size() && st!="Free" ? 1 : 0) << "\n";
+    }
+
+    header(ss,"bulk_extractor_scanner_seconds_total","counter","Seconds spent in each scanner, including the scanners it calls on decoded data.");
+    for(std::vector<scanner_stat>::const_iterator it=stats.begin();it!=stats.end();it++){
+        ss << "bulk_extractor_scanner_seconds_total{scanner=\"" << label(it->name) << "\"} " << it->seconds << "\n";
+    }
+    header(ss,"bulk_extractor_scanner_calls_total","counter","Calls of each scanner, including calls on decoded data.");
+    for(std::vector<scanner_stat>::const_iterator it=stats.begin();it!=stats.end();it++){
+        ss << "bulk_extractor_scanner_calls_total{scanner=\"" << label(it->name) << "\"} " << it->calls << "\n";
+    }
+
+    header(ss,"bulk_extractor_features_total","counter","Features written by each feature recorder.");
+    for(feature_recorder_map::const_iterator it = tp.fs.frm.begin();it!=tp.fs.frm.end();it++){
+        uint64_t count = 0;
+        {
+            cppmutex::lock lock(it->second->Mf);	// the workers count under the recorder's lock
+            count = it->second->count;
+        }
+        ss << "bulk_extractor_features_total{recorder=\"" << label(it->second->name) << "\"} " << count << "\n";
+    }
+
+    header(ss,"bulk_extractor_resident_bytes","gauge","Resident set size.");
+    ss << "bulk_extractor_resident_bytes " << rss << "\n";
+    header(ss,"bulk_extractor_max_resident_bytes","gauge","Peak resident set size.");
+    ss << "bulk_extractor_max_resident_bytes " << max_rss << "\n";
+    header(ss,"bulk_extractor_scan_complete","gauge","1 once every page has been scanned.");
+    ss << "bulk_extractor_scan_complete " << (complete ? 1 : 0) << "\n";
+
+    /* Write beside the file and rename, so that a reader never sees a partial file */
+    std::string tmpname = fname + ".tmp";
+    FILE *f = fopen(tmpname.c_str(),"w");
+    if(!f){
+        warn("%s",tmpname.c_str());
+        return;
+    }
+    std::string out = ss.str();
+    bool ok = fwrite(out.data(),1,out.size(),f)==out.size();
+    if(fclose(f)) ok = false;
+    if(!ok || rename(tmpname.c_str(),fname.c_str())){
+        warn("%s",fname.c_str());
+        unlink(tmpname.c_str());
+    }
+}
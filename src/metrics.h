@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * \file
+ * Live metrics for a running scan. While phase 1 runs, a background thread
+ * rewrites a file in the Prometheus text exposition format every interval
+ * seconds, so that a job scheduler (or node_exporter's textfile collector)
+ * can follow the scan without parsing stdout:
+ *
+ * \verbatim
+ *   bulk_extractor_image_bytes                       size of the image
+ *   bulk_extractor_bytes_read_total                  bytes read by phase 1
+ *   bulk_extractor_elapsed_seconds                   since phase 1 started
+ *   bulk_extractor_read_mb_per_second                average since phase 1 started
+ *   bulk_extractor_queue_depth                       sbufs waiting for a worker
+ *   bulk_extractor_threads / _threads_busy
+ *   bulk_extractor_thread_busy{thread}               1 while the thread processes a page
+ *   bulk_extractor_scanner_seconds_total{scanner}    kept by scanner_stats, as fs's stats
+ *   bulk_extractor_scanner_calls_total{scanner}      cannot be read while the workers run
+ *   bulk_extractor_features_total{recorder}          features written so far
+ *   bulk_extractor_resident_bytes / _max_resident_bytes
+ *   bulk_extractor_scan_complete                     1 once the workers are done
+ * \endverbatim
+ *
+ * The file is written beside itself and renamed, so a reader never sees a
+ * partial file.
+ */
+
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+
+class metrics_writer {
+public:
+    metrics_writer(const std::string &fname,uint32_t interval,class threadpool &tp,uint64_t image_size);
+    virtual ~metrics_writer();		// calls finish()
+
+    void add_bytes(uint64_t n);		// called by the producer for each page read
+    void finish();			// stop the thread and write the final metrics
+
+private:
+    metrics_writer(const metrics_writer &);
+    metrics_writer &operator=(const metrics_writer &);
+
+    static void *start_thread(void *arg){return ((metrics_writer *)arg)->run();};
+    void *run();
+    void write(bool complete);
+
+    const std::string fname;
+    const uint32_t interval;		// seconds
+    class threadpool &tp;
+    const uint64_t image_size;
+    double t0;				// when phase 1 started
+
+    pthread_mutex_t M;			// protects the following variables
+    pthread_cond_t  C;			// signalled by finish()
+    uint64_t bytes_read;
+    bool     stopping;
+    bool     started;
+    pthread_t thread;
+};
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * page_cache.cpp:
+ * Skip pages that repeat earlier pages and replay their features.
+ * See page_cache.h.
+ */
+
+#include "bulk_extractor.h"
+#include "page_cache.h"
+
+#include <fstream>
+
+page_cache::page_cache():hits(0),features_replayed(0),M(),first(),sources(),repeats()
+{
+    if(pthread_mutex_init(&M,NULL)) errx(1,"pthread_mutex_init failed");
+}
+
+page_cache::~page_cache()
+{
+    pthread_mutex_destroy(&M);
+}
+
+bool page_cache::check(const sbuf_t &sbuf)
+{
+    if(sbuf.pos0.isRecursive()) return false; // only pages of a disk image have offsets to rebase
+
+    page_key k;
+    k.md5      = md5_generator::hash_buf(sbuf.buf,sbuf.bufsize);
+    k.pagesize = sbuf.pagesize;
+    k.bufsize  = sbuf.bufsize;
+
+    pthread_mutex_lock(&M);
+    std::pair<std::map<page_key,uint64_t>::iterator,bool> r = first.insert(std::make_pair(k,sbuf.pos0.offset));
+    if(!r.second){
+        repeat rp;
+        rp.src = r.first->second;
+        rp.dst = sbuf.pos0.offset;
+        repeats.push_back(rp);
+        sources[rp.src] = sbuf.pagesize;
+        hits++;
+    }
+    pthread_mutex_unlock(&M);
+    return !r.second;
+}
+
+/* Scanners with output that is not in their feature files, or that
+ * report features at offsets outside the page the feature starts in
+ */
+static const struct {
+    const char *name;
+    const char *reason;
+} unreplayable[] = {
+    {"hashid","it reports its features after the scan returns"},
+    {"net","it writes packets.pcap outside the feature files"},
+    {"json","it reports an object where the object ends, which may be in the margin"},
+    {"gps","it reports a record where the record ends, which may be in the margin"},
+    {"accts","it reports BitLocker keys that start in the margin"},
+    {"elf","it reports executables that start in the margin"},
+    {"exiv2","it reports images that start in the margin"},
+    {"kml","it carves files that start in the margin"},
+    {"vcard","it carves cards that start in the margin"},
+    {"extx","its features have no offsets"},
+    {"bulk","its tags are not replayed"},
+    {"lift","its tags are not replayed"},
+    {0,0}
+};
+
+const char *page_cache::cannot_replay(const std::string &scanner_name)
+{
+    for(int i=0;unreplayable[i].name;i++){
+        if(scanner_name==unreplayable[i].name) return unreplayable[i].reason;
+    }
+    return 0;
+}
+
+/* A top-level feature line starts with its decimal offset and a tab */
+static bool top_level_offset(const std::string &line,uint64_t &offset,size_t &tab)
+{
+    offset = 0;
+    size_t i = 0;
+    while(i<line.size() && isdigit(line[i])){
+        offset = offset*10 + (line[i]-'0');
+        i++;
+    }
+    if(i==0 || i>=line.size() || line[i]!='\t') return false;
+    tab = i;
+    return true;
+}
+
+static bool is_directory(const std::string &fname)
+{
+    struct stat st;
+    return stat(fname.c_str(),&st)==0 && S_ISDIR(st.st_mode);
+}
+
+/* The features of a first copy, as read from the feature files */
+struct source_line {
+    feature_recorder *fr;
+    uint64_t    delta;			// offset within the page
+    std::string rest;			// the line after the offset
+};
+struct source_features {
+    source_features():carved(false),lines(){}
+    bool carved;
+    std::vector<source_line> lines;
+};
+
+void page_cache::replay(feature_recorder_set &fs,std::vector<uint64_t> &rescan)
+{
+    if(repeats.size()==0) return;
+
+    std::map<uint64_t,source_features> found;
+
+    /* Collect the features of the first copies from the feature files */
+    fs.flush_all();
+    for(feature_recorder_map::const_iterator it = fs.frm.begin();it!=fs.frm.end();it++){
+        feature_recorder *fr = it->second;
+        std::ifstream in((fr->outdir + "/" + fr->name + ".txt").c_str());
+        if(!in.is_open()) continue;
+        bool carves = is_directory(fr->outdir + "/" + fr->name); // carved files go in a directory named for the recorder
+        std::string line;
+        while(getline(in,line)){
+            uint64_t offset=0;
+            size_t tab=0;
+            if(line.size()==0 || line[0]=='#') continue;
+            if(!top_level_offset(line,offset,tab)) continue;
+            int64_t image_offset = (int64_t)offset - feature_recorder::offset_add;
+            if(image_offset<0) continue;	// before the image; not from one of its pages
+            offset = (uint64_t)image_offset;
+
+            std::map<uint64_t,size_t>::const_iterator s = sources.upper_bound(offset);
+            if(s==sources.begin()) continue;
+            --s;
+            if(offset >= s->first + s->second) continue;
+
+            source_features &sf = found[s->first];
+            if(carves){
+                sf.carved = true;
+                continue;
+            }
+            source_line sl;
+            sl.fr    = fr;
+            sl.delta = offset - s->first;
+            sl.rest  = line.substr(tab);
+            sf.lines.push_back(sl);
+        }
+    }
+
+    /* Write them again for each repeat */
+    for(std::vector<repeat>::const_iterator it = repeats.begin();it!=repeats.end();it++){
+        std::map<uint64_t,source_features>::const_iterator sf = found.find(it->src);
+        if(sf==found.end()) continue;	// the first copy had no features
+        if(sf->second.carved){
+            rescan.push_back(it->dst);
+            continue;
+        }
+        for(std::vector<source_line>::const_iterator jt = sf->second.lines.begin();jt!=sf->second.lines.end();jt++){
+            std::stringstream ss;
+            ss << (it->dst + jt->delta + feature_recorder::offset_add) << jt->rest;
+            jt->fr->write(ss.str());
+            features_replayed++;
+        }
+    }
+    fs.flush_all();
+}
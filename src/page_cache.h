@@ -0,0 +1,79 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+/**
+ * \file
+ * A cache of the pages of a disk image that have already been scanned,
+ * so that a page that repeats byte for byte (duplicated files, VM templates,
+ * volume shadow copies) is not scanned again.
+ *
+ * Pages are keyed by the MD5 of the whole sbuf, margin included, so a repeat
+ * gives every scanner exactly the same input. Instead of scanning a repeat,
+ * the features found in its first copy are replayed from the feature files
+ * once phase 1 is done, with pos0 moved to the repeat.
+ *
+ * Only features in the first copy's page (not its margin) are replayed.
+ * This is only right for scanners that report a feature at its start, and
+ * only from the page in which it starts: write_buf() drops features in the
+ * margin, and most scanners that call write() stop at pagesize. Only
+ * top-level features are replayed; a scan of the repeat would skip its
+ * recursive buffers as previously processed. A repeat of a page that carved
+ * files is rescanned, so that its files are carved again.
+ *
+ * Scanners that report features elsewhere (json reports an object where it
+ * ends, so an object in the margin would be lost from the repeat and one
+ * from the page before the first copy would be copied onto it), and output
+ * that does not go through the feature files, cannot be replayed; the cache
+ * is not used if a scanner listed by cannot_replay() is enabled.
+ */
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "dfxml/src/hash_t.h"
+
+class page_cache {
+public:
+    page_cache();
+    virtual ~page_cache();
+
+    /* Return true if sbuf repeats an earlier page and need not be scanned; threadsafe */
+    bool check(const sbuf_t &sbuf);
+
+    /* Called once the workers are idle. Write the features of every repeat
+     * and return in rescan the image offsets of repeats that must be scanned.
+     */
+    void replay(feature_recorder_set &fs,std::vector<uint64_t> &rescan);
+
+    /* If the scanner's output cannot be replayed, return why; otherwise 0 */
+    static const char *cannot_replay(const std::string &scanner_name);
+
+    uint64_t hits;			// pages found to repeat
+    uint64_t features_replayed;		// lines written by replay
+
+private:
+    page_cache(const page_cache &);
+    page_cache &operator=(const page_cache &);
+
+    struct page_key {
+        md5_t  md5;
+        size_t pagesize;
+        size_t bufsize;
+        bool operator<(const page_key &k) const {
+            if(pagesize!=k.pagesize) return pagesize<k.pagesize;
+            if(bufsize!=k.bufsize) return bufsize<k.bufsize;
+            return md5<k.md5;
+        }
+    };
+    struct repeat {
+        uint64_t src;			// offset of the first copy
+        uint64_t dst;			// offset of the repeat
+    };
+
+    pthread_mutex_t M;			// protects the following
+    std::map<page_key,uint64_t> first;	// offset of each page's first copy
+    std::map<uint64_t,size_t> sources;	// first copies that repeat, and their page sizes
+    std::vector<repeat> repeats;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * path_cache.cpp:
+ * An LRU cache of the buffers decoded while resolving forensic paths.
+ * See path_cache.h.
+ */
+
+#include "bulk_extractor.h"
+#include "path_cache.h"
+
+path_cache::path_cache(size_t max_bytes_):M(),max_bytes(max_bytes_),bytes(0),lru(),index()
+{
+    if(pthread_mutex_init(&M,NULL)) errx(1,"pthread_mutex_init failed");
+}
+
+path_cache::~path_cache()
+{
+    pthread_mutex_destroy(&M);
+}
+
+path_cache::buffer path_cache::get(const std::string &path)
+{
+    buffer b;
+    pthread_mutex_lock(&M);
+    std::map<std::string,entry_list::iterator>::iterator it = index.find(path);
+    if(it!=index.end()){
+        lru.splice(lru.begin(),lru,it->second);
+        b = it->second->buf;
+    }
+    pthread_mutex_unlock(&M);
+    return b;
+}
+
+void path_cache::put(const std::string &path,const sbuf_t &sbuf)
+{
+    if(sbuf.bufsize>max_bytes) return;
+    if(get(path)) return;		// already cached; get() made it the most recent
+
+    /* Copy outside the lock */
+    buffer b(new std::vector<uint8_t>(sbuf.buf,sbuf.buf+sbuf.bufsize));
+
+    pthread_mutex_lock(&M);
+    if(index.find(path)==index.end()){
+        entry e;
+        e.path = path;
+        e.buf  = b;
+        lru.push_front(e);
+        index[path] = lru.begin();
+        bytes += sbuf.bufsize;
+        while(bytes>max_bytes){
+            bytes -= lru.back().buf->size();
+            index.erase(lru.back().path);
+            lru.pop_back();		// a buffer still in use is freed by its last user
+        }
+    }
+    pthread_mutex_unlock(&M);
+}
+
+path_cache::buffer path_cache::find_prefix(const std::string &path,std::string &prefix,std::string &rest)
+{
+    /* Try each part from the right that is a decoder name; the first part is the image offset */
+    for(size_t end = path.size();end!=std::string::npos && end>0;end = path.rfind('-',end-1)){
+        size_t start = path.rfind('-',end-1);
+        if(start==std::string::npos) break;
+        start++;
+        if(start==end || isdigit(path[start])) continue;	// an offset, not a decoder
+        buffer b = get(path.substr(0,end));
+        if(b){
+            prefix = path.substr(0,end);
+            rest   = end<path.size() ? path.substr(end+1) : "";
+            return b;
+        }
+    }
+    return buffer();
+}
@@ -0,0 +1,62 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+/**
+ * \file
+ * A memory-bounded LRU cache of the buffers decoded while resolving
+ * forensic paths with -p, so that a path that shares its decoding with
+ * an earlier one does not decode again.
+ *
+ * A buffer is keyed by the path that produced it, up to and including the
+ * decoder: resolving 123456-GZIP-0-ZIP-4096-BASE64-100 caches the buffers
+ * for 123456-GZIP, 123456-GZIP-0-ZIP and 123456-GZIP-0-ZIP-4096-BASE64.
+ * A later 123456-GZIP-0-ZIP-8192-BASE64-0 then starts from the cached
+ * ZIP member instead of the image. Only buffers on which a path resolved
+ * are cached, so a cached buffer is the one the decoders would give again.
+ */
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <tr1/memory>
+
+class path_cache {
+public:
+    typedef std::tr1::shared_ptr<const std::vector<uint8_t> > buffer;
+
+    path_cache(size_t max_bytes);
+    virtual ~path_cache();
+
+    /* Return the buffer decoded for path, or an empty pointer; threadsafe */
+    buffer get(const std::string &path);
+
+    /* Cache a copy of the buffer decoded for path; threadsafe */
+    void put(const std::string &path,const sbuf_t &sbuf);
+
+    /**
+     * Return the longest path that starts path and ends in a decoder name,
+     * and whose buffer is cached, or an empty pointer if there is none. The remaining
+     * part of path (after a '-') is returned in rest.
+     */
+    buffer find_prefix(const std::string &path,std::string &prefix,std::string &rest);
+
+private:
+    path_cache(const path_cache &);
+    path_cache &operator=(const path_cache &);
+
+    struct entry {
+        std::string path;
+        buffer buf;
+    };
+    typedef std::list<entry> entry_list;
+
+    pthread_mutex_t M;			// protects the following
+    size_t max_bytes;
+    size_t bytes;			// in the cached buffers
+    entry_list lru;			// most recently used first
+    std::map<std::string,entry_list::iterator> index;
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include "bulk_extractor.h"
 #include "phase1.h"
 #include "threadpool.h"
+#include "page_cache.h"
+#include "metrics.h"
+#include "trace.h"
 
 void BulkExtractor_Phase1::msleep(uint32_t msec)
 {
@@ -79,9 +82,15 @@ void BulkExtractor_Phase1::run(image_process &p,feature_recorder_set &fs,
                                seen_page_ids_t &seen_page_ids)
 {
 
+    trace::set_thread_name("producer");
     md5g = new md5_generator();		// keep track of MD5
     uint64_t md5_next = 0;					// next byte to hash
     tp = new threadpool(config.num_threads,fs,xreport);			// 
+    tp->known = config.known;
+    if(config.opt_page_cache) tp->pages = new page_cache();
+    if(config.opt_metrics_file.size()){
+        metrics = new metrics_writer(config.opt_metrics_file,config.opt_metrics_interval,*tp,p.image_size());
+    }
     uint64_t page_ctr=0;
     xreport.push("runtime","xmlns:debug=\"http://www.afflib.org/bulk_extractor/debug\"");
 
@@ -143,6 +152,7 @@ void BulkExtractor_Phase1::run(image_process &p,feature_recorder_set &fs,
                         }
                     }
                     total_bytes += sbuf->pagesize;
+                    if(metrics) metrics->add_bytes(sbuf->pagesize);
                         
                     /***************************
                      **** SCHEDULE THE WORK ****
@@ -180,10 +190,8 @@ void BulkExtractor_Phase1::run(image_process &p,feature_recorder_set &fs,
     }
 }
 
-void BulkExtractor_Phase1::wait_for_workers(image_process &p)
+void BulkExtractor_Phase1::wait_for_free_threads()
 {
-    /* Now wait for all of the threads to be free */
-    tp->mode = 1;			// waiting for workers to finish
     time_t wait_start = time(0);
     for(int32_t counter = 0;;counter++){
         int num_remaining = config.num_threads - tp->get_free_count();
@@ -212,7 +220,46 @@ void BulkExtractor_Phase1::wait_for_workers(image_process &p)
             break;
         }
     }
+}
+
+void BulkExtractor_Phase1::wait_for_workers(image_process &p)
+{
+    /* Now wait for all of the threads to be free */
+    tp->mode = 1;			// waiting for workers to finish
+    wait_for_free_threads();
+
+    /* Replay the features of repeated pages; those that must be scanned are scheduled now */
+    if(tp->pages){
+        page_cache *pages = tp->pages;
+        std::vector<uint64_t> rescan;
+        pages->replay(tp->fs,rescan);
+        tp->pages = 0;
+        for(std::vector<uint64_t>::const_iterator it = rescan.begin();it!=rescan.end();it++){
+            image_process::iterator pit = p.begin();
+            pit.seek_block(*it / config.opt_page_size);
+            sbuf_t *sbuf = get_sbuf(pit);
+            if(sbuf) tp->schedule_work(sbuf);
+        }
+        wait_for_free_threads();
+        if(config.opt_quiet==0){
+            std::cout << "Repeated pages: " << pages->hits << " (" << pages->features_replayed
+                      << " features replayed, " << rescan.size() << " pages rescanned)\n";
+        }
+        xreport.xmlout("page_cache_hits",pages->hits);
+        xreport.xmlout("page_cache_features_replayed",pages->features_replayed);
+        xreport.xmlout("page_cache_rescans",(uint64_t)rescan.size());
+        delete pages;
+    }
     if(config.opt_quiet==0) std::cout << "All Threads Finished!\n";
+    if(metrics){
+        delete metrics;			// writes the final metrics
+        metrics = 0;
+    }
+
+    if(tp->known){
+        if(config.opt_quiet==0) std::cout << "Pages of only known blocks skipped: " << tp->known_pages_skipped << "\n";
+        xreport.xmlout("known_pages_skipped",tp->known_pages_skipped);
+    }
 	
     xreport.pop();			// pop runtime
     /* We can write out the source info now, since we (might) know the hash */
@@ -4,6 +4,7 @@
 #include "aftimer.h"
 #include "threadpool.h"
 #include "image_process.h"
+#include "known_blocks.h"
 #include "dfxml/src/dfxml_writer.h"
 #include "dfxml/src/hash_t.h"
 
@@ -30,7 +31,11 @@ public:
             retry_seconds(60),
             num_threads(1),             // 
             sampling_fraction(1.0),
-            sampling_passes(1){}
+            sampling_passes(1),
+            known(0),
+            opt_page_cache(false),
+            opt_metrics_file(),
+            opt_metrics_interval(10){}
                  
         size_t opt_page_size;
         size_t opt_margin;
@@ -45,10 +50,15 @@ public:
         u_int num_threads;
         double sampling_fraction;       // for random sampling
         u_int  sampling_passes;
+        const class known_blocks *known; // pages of only these blocks are not scanned
+        bool opt_page_cache;            // replay the features of repeated pages
+        std::string opt_metrics_file;   // if set, rewrite Prometheus metrics here while scanning
+        uint32_t opt_metrics_interval;  // seconds between rewrites
 
         void validate(){
             if(opt_offset_start % opt_page_size != 0) errx(1,"ERROR: start offset must be a multiple of the page size\n");
             if(opt_offset_end % opt_page_size != 0) errx(1,"ERROR: end offset must be a multiple of the page size\n");
+            if(known && opt_page_size % known->block_size() != 0) errx(1,"ERROR: page size must be a multiple of the known block size\n");
         };
     };
 private:
@@ -59,7 +69,9 @@ private:
     static std::string minsec(time_t tsec);                      // return "5 min 10 sec" string
 
     class threadpool *tp;
+    class metrics_writer *metrics;
     void print_tp_status();
+    void wait_for_free_threads();       // wait until the work queue is drained
 
 
 public:
@@ -122,7 +134,7 @@ public:
 #endif
 
     BulkExtractor_Phase1(dfxml_writer &xreport_,aftimer &timer_,Config &config_):
-        tp(),xreport(xreport_),timer(timer_),config(config_),notify_ctr(0),total_bytes(0),md5g(){}
+        tp(),metrics(),xreport(xreport_),timer(timer_),config(config_),notify_ctr(0),total_bytes(0),md5g(){}
 
     void run(image_process &p,feature_recorder_set &fs, seen_page_ids_t &seen_page_ids);
     void wait_for_workers(image_process &p);
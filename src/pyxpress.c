@@ -73,6 +73,7 @@
 #include "config.h"
 #include "pyxpress.h"
 #include <stdint.h>
+#include <string.h>
 
 /* This one is arleady defined on Windows */
 
@@ -87,6 +88,48 @@ typedef uint16_t USHORT;
 #define DELTA_PAGE ((2 * PAGE_SIZE) - 1)
 #define UNCOMPRESSED_BLOCK_SIZE (PAGE_SIZE * 0x10)
 
+/* Number of literals that follow: the run of clear bits below bit IndicatorBit of Indicator */
+static uint32_t literal_run(uint32_t Indicator,uint32_t IndicatorBit)
+{
+    uint32_t rest = IndicatorBit<32 ? (Indicator & ((1U<<IndicatorBit)-1)) : Indicator;
+    uint32_t n = 0;
+    if(rest==0) return IndicatorBit;
+#ifdef __GNUC__
+    n = IndicatorBit - 32 + __builtin_clz(rest);
+#else
+    while(((rest >> (IndicatorBit-1-n)) & 1)==0) n++;
+#endif
+    return n;
+}
+
+/* Copy Length bytes from Distance bytes back. The copy may overlap itself,
+ * which repeats the last Distance bytes. Slack is the room in the output
+ * after the copy; with 8 bytes of it, matches are copied 8 bytes at a time.
+ */
+static void copy_match(unsigned char *dst,uint32_t Distance,uint32_t Length,uint32_t Slack)
+{
+    const unsigned char *src = dst - Distance;
+    uint32_t i;
+    if(Distance>=8 && Slack>=8){
+        for(i=0;i<Length;i+=8) memcpy(dst+i,src+i,8);
+        return;
+    }
+    if(Distance>=Length){
+        memcpy(dst,src,Length);
+        return;
+    }
+    if(Distance==1){
+        memset(dst,src[0],Length);
+        return;
+    }
+    for(i=0;i<Length;i++) dst[i] = src[i];
+}
+
+/* Decompress a run of Xpress (LZ77 + indicator bits) data.
+ * Runs of literals and matches are copied whole rather than a byte at a time.
+ * The output is the same as the original SandMan decoder, except that a
+ * literal is not read from past the end of the input.
+ */
 unsigned long Xpress_Decompress(const unsigned char *InputBuffer,
 				unsigned long InputSize,
 				unsigned char *OutputBuffer,
@@ -99,7 +142,7 @@ unsigned long Xpress_Decompress(const unsigned char *InputBuffer,
     uint32_t Length=0;
     uint32_t Offset=0;
     uint32_t NibbleIndex=0;
-    //uint32_t NibbleIndicator = XPRESS_ENCODE_MAGIC;
+    uint32_t Run=0;
 
     while ((OutputIndex < OutputSize) && (InputIndex<InputSize) ) {
         if (IndicatorBit == 0) {
@@ -111,77 +154,61 @@ unsigned long Xpress_Decompress(const unsigned char *InputBuffer,
             InputIndex += sizeof(uint32_t);
             IndicatorBit = 32; 
         }
-        IndicatorBit--;
-
-	//* check whether the bit specified by IndicatorBit is set or not 
-	//* set in Indicator. For example, if IndicatorBit has value 4 
-	//* check whether the 4th bit of the value in Indicator is set 
 
-        if (((Indicator >> IndicatorBit) & 1) == 0) {
-	    if(OutputIndex>=OutputSize) return OutputIndex;
-            OutputBuffer[OutputIndex] = InputBuffer[InputIndex]; 
-            InputIndex += sizeof(UCHAR);
-            OutputIndex += sizeof(UCHAR);
-        }
-        else {
-	    if(InputIndex+1 >= InputSize) return OutputIndex;
-            Length = (unsigned)((InputBuffer[InputIndex + 1] << 8) | InputBuffer[InputIndex]);
-            
-            /*
-	      if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0))
-	      {
-	      printf("DECOMP: READ AT [0x%08X] = %04X \n", InputIndex, Length);
-	      }
-            */
-
-            InputIndex += sizeof(USHORT); 
-            Offset = Length / 8;
-            Length = Length % 8;
-
-            //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--1 Len: %02X (%d)\n", Length, Length);
-            if (Length == 7) {
-                if (NibbleIndex == 0) {
-                    NibbleIndex = InputIndex;
-		    if(InputIndex>=InputSize) return OutputIndex;
-                    Length = InputBuffer[InputIndex] % 16; 
-                    //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--2 Len: %02X (%d)\n", Length, Length);
-                    InputIndex += sizeof(UCHAR);
-                }
-                else {
-                    Length = InputBuffer[NibbleIndex] / 16;
-                    //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--3 Len: %02X (%d)\n", Length, Length);
-                    NibbleIndex = 0;
-                }
-
-                if (Length == 15) {
-		    if (InputIndex>=InputSize) return OutputIndex;
-                    Length = InputBuffer[InputIndex];
-                    //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--4 Len: %02X (%d)\n", Length, Length);
-                    InputIndex += sizeof(UCHAR); 
-		    if (Length == 255) {
-			if(InputIndex+2>=InputSize) return OutputIndex;
-			Length = (unsigned)((InputBuffer[InputIndex + 1] << 8)) | InputBuffer[InputIndex];
-			InputIndex += sizeof(USHORT);
-			Length -= (15 + 7); 
-		    }
-                    Length += 15; 
-                    //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--5 Len: %02X (%d)\n", Length, Length);
-                }
-                Length += 7;
-                //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--6 Len: %02X (%d)\n", Length, Length);
-            }
-
-            Length += 3;
-            //if ((OutputIndex > 0xD0) && (OutputIndex < 0xF0)) printf("--7 Len: %02X (%d)\n", Length, Length);
-            //if (Length > 280) printf("DECOMP DEBUG: [0x%08X]->[0x%08X] Len: %d Offset: %08X\n", 
-            //    OutputIndex, InputIndex, Length, Offset);
-            while (Length != 0) {
-                if ((OutputIndex >= OutputSize) || ((Offset + 1) >= OutputIndex)) break;
-                OutputBuffer[OutputIndex] = OutputBuffer[OutputIndex - Offset - 1];
-                OutputIndex += sizeof(UCHAR);
-                Length -= sizeof(UCHAR);
-            }
-        }
+	/* Each clear indicator bit is a literal byte; copy them all at once */
+	Run = literal_run(Indicator,IndicatorBit);
+	if (Run > 0) {
+	    if (Run > OutputSize - OutputIndex) Run = OutputSize - OutputIndex;
+	    if (Run > InputSize - InputIndex) Run = InputSize - InputIndex;
+	    if (Run == 0) return OutputIndex; /* the indicator was the last of the input */
+	    memcpy(OutputBuffer + OutputIndex, InputBuffer + InputIndex, Run);
+	    OutputIndex += Run;
+	    InputIndex += Run;
+	    IndicatorBit -= Run;
+	    continue;
+	}
+
+	/* A set bit is a match */
+        IndicatorBit--;
+	if(InputIndex+1 >= InputSize) return OutputIndex;
+	Length = (unsigned)((InputBuffer[InputIndex + 1] << 8) | InputBuffer[InputIndex]);
+	InputIndex += sizeof(USHORT); 
+	Offset = Length / 8;
+	Length = Length % 8;
+
+	if (Length == 7) {
+	    if (NibbleIndex == 0) {
+		NibbleIndex = InputIndex;
+		if(InputIndex>=InputSize) return OutputIndex;
+		Length = InputBuffer[InputIndex] % 16; 
+		InputIndex += sizeof(UCHAR);
+	    }
+	    else {
+		Length = InputBuffer[NibbleIndex] / 16;
+		NibbleIndex = 0;
+	    }
+
+	    if (Length == 15) {
+		if (InputIndex>=InputSize) return OutputIndex;
+		Length = InputBuffer[InputIndex];
+		InputIndex += sizeof(UCHAR); 
+		if (Length == 255) {
+		    if(InputIndex+2>=InputSize) return OutputIndex;
+		    Length = (unsigned)((InputBuffer[InputIndex + 1] << 8)) | InputBuffer[InputIndex];
+		    InputIndex += sizeof(USHORT);
+		    Length -= (15 + 7); 
+		}
+		Length += 15; 
+	    }
+	    Length += 7;
+	}
+	Length += 3;
+
+	/* Matches that reach back to (or before) the first byte are dropped */
+	if ((Offset + 1) >= OutputIndex) continue;
+	if (Length > OutputSize - OutputIndex) Length = OutputSize - OutputIndex;
+	copy_match(OutputBuffer + OutputIndex, Offset + 1, Length, OutputSize - OutputIndex - Length);
+	OutputIndex += Length;
     }
     return OutputIndex;
 }
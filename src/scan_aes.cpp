@@ -32,6 +32,9 @@
 #include "config.h"
 #include "bulk_extractor_i.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 /* old aes.h file */
@@ -367,6 +370,78 @@ int valid_aes256_schedule(const unsigned char * in)
 }
     
 
+/*
+ * Fast rejection.
+ *
+ * Almost every offset of real data fails the very first bytes of the
+ * schedule check, so it pays to test those bytes before calling the
+ * validators above. Two tests are used, both of which are implied by
+ * a valid schedule:
+ *
+ * 1. The linear test. The word after the first computed word is just the
+ *    XOR of two earlier words; no S-box is involved:
+ *       AES128: w[5] = w[1] ^ w[4]
+ *       AES192: w[7] = w[1] ^ w[6]
+ *       AES256: w[9] = w[1] ^ w[8]
+ *    This is checked for 16 consecutive offsets at a time. A random offset
+ *    passes with probability 2^-32.
+ *
+ * 2. The first-round test. The first computed word is
+ *    w[Nk] = w[0] ^ SubWord(RotWord(w[Nk-1])) ^ rcon, checked a word at a
+ *    time with the same rcon index that the validator uses.
+ */
+
+struct aes_candidates_t {
+    uint32_t k128;			// bit n set if offset n may start an AES128 schedule
+    uint32_t k192;
+    uint32_t k256;
+};
+
+/* Return a bitmask of the offsets 0..15 from p at which
+ * p[n+a+k] == p[n+b+k] ^ p[n+c+k] for k=0..3.
+ * Reads 32 bytes starting at p+a, p+b and p+c.
+ */
+static inline uint32_t aes_linear_candidates(const u_char *p,size_t a,size_t b,size_t c)
+{
+    uint32_t zero = 0;			// bit n set if byte n satisfies the relation
+#ifdef __SSE2__
+    const __m128i z = _mm_setzero_si128();
+    for(int half=0;half<2;half++){
+	const size_t o = half*16;
+	__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+a+o)),
+				  _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+b+o)),
+						_mm_loadu_si128((const __m128i *)(p+c+o))));
+	zero |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x,z)) << o;
+    }
+#else
+    for(int n=0;n<32;n++){
+	if(p[a+n] == (p[b+n] ^ p[c+n])) zero |= 1U << n;
+    }
+#endif
+    /* An offset is a candidate if four bytes in a row satisfy the relation */
+    return (zero & (zero>>1) & (zero>>2) & (zero>>3)) & 0xffff;
+}
+
+static inline aes_candidates_t aes_find_candidates(const u_char *p)
+{
+    aes_candidates_t c;
+    c.k128 = aes_linear_candidates(p,20,4,16);
+    c.k192 = aes_linear_candidates(p,28,4,24);
+    c.k256 = aes_linear_candidates(p,36,4,32);
+    return c;
+}
+
+static inline bool aes_first_round_ok(const unsigned char *in,size_t key_size,unsigned char rc)
+{
+    const unsigned char *prev = in + key_size - 4;	// w[Nk-1]
+    const unsigned char *next = in + key_size;	// w[Nk]
+    return next[0]==(in[0] ^ sbox[prev[1]] ^ rc)
+	&& next[1]==(in[1] ^ sbox[prev[2]])
+	&& next[2]==(in[2] ^ sbox[prev[3]])
+	&& next[3]==(in[3] ^ sbox[prev[0]]);
+}
+
+
 // FindAES version 1.0 by Jesse Kornblum
 // http://jessekornblum.com/tools/findaes/
 // This code is public domain.
@@ -419,6 +494,7 @@ void scan_aes(const class scanner_params &sp,const recursion_control_block &rcb)
 	uint32_t counts[256];
 	memset(counts,0,sizeof(counts));
 	int32_t distinct_counts = 0;	// how many distinct counts do we have?
+	aes_candidates_t candidates = {0,0,0}; // for the 16 offsets starting at pos & ~15
 
 	/* Initialize the sliding window */
 	for (size_t pos = 0; pos < WINDOW_SIZE ; pos++)	{
@@ -442,17 +518,29 @@ void scan_aes(const class scanner_params &sp,const recursion_control_block &rcb)
 		}
 	    }
 
+	    /* The candidate reads stay within the last WINDOW_SIZE bytes of the sbuf */
+	    if(pos % 16 == 0){
+		candidates = aes_find_candidates(sp.sbuf.buf + pos);
+	    }
+
 	    if(distinct_counts>10){
 		const u_char *p2 = sp.sbuf.buf + pos;
-		if (valid_aes128_schedule(p2)) {
+		const uint32_t bit = 1U << (pos % 16);
+		if ((candidates.k128 & bit)
+		    && aes_first_round_ok(p2, AES128_KEY_SIZE, rcon[1])
+		    && valid_aes128_schedule(p2)) {
 		    string key = key_to_string(p2, AES128_KEY_SIZE);
 		    aes_recorder->write(sp.sbuf.pos0+pos,key,string("AES128"));
 		}
-		if (valid_aes192_schedule(p2)) {
+		if ((candidates.k192 & bit)
+		    && aes_first_round_ok(p2, AES192_KEY_SIZE, rcon[0]) // valid_aes192_schedule starts at rcon[0]
+		    && valid_aes192_schedule(p2)) {
 		    string key = key_to_string(p2, AES192_KEY_SIZE);
 		    aes_recorder->write(sp.sbuf.pos0+pos,key,string("AES192"));
 		}
-		if (valid_aes256_schedule(p2)) {
+		if ((candidates.k256 & bit)
+		    && aes_first_round_ok(p2, AES256_KEY_SIZE, rcon[1])
+		    && valid_aes256_schedule(p2)) {
 		    string key = key_to_string(p2, AES256_KEY_SIZE);
 		    aes_recorder->write(sp.sbuf.pos0+pos,key,string("AES256"));
 		}
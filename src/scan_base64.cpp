@@ -2,6 +2,12 @@
 #include "bulk_extractor_i.h"
 #include "base64_forensic.h"
 
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static bool base64array[256];
 u_int base64_min = 128;			// don't bother with smaller than this
 
@@ -11,13 +17,41 @@ inline bool isbase64(unsigned char ch)
     return base64array[ch];
 }
 
+#ifdef __SSE2__
+static inline __m128i in_range64(__m128i c,char lo,char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c,_mm_set1_epi8(lo-1)),_mm_cmplt_epi8(c,_mm_set1_epi8(hi+1)));
+}
+#endif
+
+/* skip64 - returns the offset of the first character in [start,end) that is not base64, or end.
+ * This is the classifier for all of the scanning below; with SSE2 it looks at 16 bytes at a time.
+ */
+static size_t skip64(const sbuf_t &sbuf,size_t start,size_t end)
+{
+    if(end>sbuf.bufsize) end = sbuf.bufsize;
+#ifdef __SSE2__
+    for(;start+16<=end;start+=16){
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sbuf.buf+start));
+        __m128i valid = _mm_or_si128(in_range64(c,'A','Z'),in_range64(c,'a','z'));
+        valid = _mm_or_si128(valid,in_range64(c,'0','9'));
+        valid = _mm_or_si128(valid,_mm_cmpeq_epi8(c,_mm_set1_epi8('+')));
+        valid = _mm_or_si128(valid,_mm_cmpeq_epi8(c,_mm_set1_epi8('/')));
+        uint32_t m = ~_mm_movemask_epi8(valid) & 0xffff;
+        if(m) return start+__builtin_ctz(m);
+    }
+#endif
+    for(;start<end;start++){
+        if(isbase64(sbuf.buf[start])==false) return start;
+    }
+    return end;
+}
+
 /* find64 - returns true if a region contains base64 code, but only if it also has something over F */
 inline ssize_t find64(const sbuf_t &sbuf,unsigned char ch,size_t start)
 {
-    for(;start<sbuf.bufsize;start++){
-	if(sbuf[start]==ch) return start;
-	if(isbase64(sbuf[start])==false) return -1;
-    }
+    start = skip64(sbuf,start,sbuf.bufsize);
+    if(start<sbuf.bufsize && sbuf[start]==ch) return start;
     return -1;
 }
 
@@ -56,83 +90,93 @@ void scan_base64(const class scanner_params &sp,const recursion_control_block &r
 	 * Note that this doesn't scan base64-encoded blobs smaller than two lines.
 	 * Perhaps we should do that.
 	 */
+	std::vector<unsigned char> base64_target; // reused for every block in this sbuf
 	for(size_t i=0;i<sbuf.pagesize;i++){
-	    if(i==0 || sbuf[i]=='\n' ){
-		/* Try to figure out the line width; we only decode base64
-		 * if we see two lines of the same width.
-		 */
-		ssize_t w1 = find64(sbuf,'\n',i+1);
-		if(w1<0){
-		    return;		// no second delim
-		}
+	    if(i>0 && sbuf[i]!='\n'){	// only the start of the sbuf and line starts
+		const void *nl = memchr(sbuf.buf+i,'\n',sbuf.pagesize-i);
+		if(nl==0) break;
+		i = static_cast<const unsigned char *>(nl) - sbuf.buf;
+	    }
+	    /* Try to figure out the line width; we only decode base64
+	     * if we see two lines of the same width.
+	     */
+	    ssize_t w1 = find64(sbuf,'\n',i+1);
+	    if(w1<0){
+		return;		// no second delim
+	    }
 
-		ssize_t linewidth1 = w1-i;	// including \n
-		if(i==0) linewidth1 += 1;	// if we were not on a newline, add one
+	    ssize_t linewidth1 = w1-i;	// including \n
+	    if(i==0) linewidth1 += 1;	// if we were not on a newline, add one
 	    
-		if(linewidth1 < minlinewidth){
-		    i=w1;		// skip past this block
-		    continue;
-		} 
-
-		ssize_t w2 = find64(sbuf,'\n',w1+1);
-		if(w2<0){
-		    return;		// no third delim
-		}
-		ssize_t linewidth2 = w2-w1;
+	    if(linewidth1 < minlinewidth){
+		i=w1;		// skip past this block
+		continue;
+	    } 
+
+	    ssize_t w2 = find64(sbuf,'\n',w1+1);
+	    if(w2<0){
+		return;		// no third delim
+	    }
+	    ssize_t linewidth2 = w2-w1;
 	
-		if(linewidth1 != linewidth2){
-		    i=w2;	// lines are different sized; skip past both
-		    continue;
-		}
+	    if(linewidth1 != linewidth2){
+		i=w2;	// lines are different sized; skip past both
+		continue;
+	    }
 	
-		/* Now scan from w2 until we find a terminator:
-		 * - the '='.
-		 * - characters not in base64
-		 * - the end of the sbuf.
+	    /* Now scan from w2 until we find a terminator:
+	     * - the '='.
+	     * - characters not in base64
+	     * - the end of the sbuf.
+	     */
+	    for(size_t j=w2+1;j<sbuf.size();j++){
+		/* Runs of base64 between line ends need no attention;
+		 * skip to the next line end, non-base64 character, or the last character.
+		 */
+		size_t next_eol = j + (linewidth1 - (j-w2) % linewidth1) % linewidth1;
+		j = skip64(sbuf,j,min(next_eol,sbuf.size()-1));
+
+		/* Each line should be the same size. if this is an even module of
+		 * the start of the line and we don't have a line end, then the lines
+		 * are not properly formed.
+		 */
+		if(((j-w2) % linewidth1==0) && sbuf[j]!='\n'){
+		    i = j;		// advance to the end of this section
+		    break;		// break out of the j loop
+		}
+
+		/* If we found a character that indicates the end of a BASE64 block
+		 * (a '=' or a '-' or a space), or we found an invalid base64
+		 * charcter, or if we are on the last character of the sbuf,
+		 * then attempt to decode.
 		 */
-		for(size_t j=w2+1;j<sbuf.size();j++){
-		    /* Each line should be the same size. if this is an even module of
-		     * the start of the line and we don't have a line end, then the lines
-		     * are not properly formed.
-		     */
-		    if(((j-w2) % linewidth1==0) && sbuf[j]!='\n'){
-			i = j;		// advance to the end of this section
-			break;		// break out of the j loop
+		char ch = sbuf[j];
+		bool eof = (j+1==sbuf.size());
+		if(eof || ch=='=' || ch=='-' || ch==' ' || (!isbase64(ch) && ch!='\n' && ch!='\r')){
+		    size_t base64_len = j-i;
+		    if(eof || ch=='-') base64_len += 1;	// we can include the termination character
+
+		    if(!eof && base64_len<base64_min){	// a short line?
+			i = j;			// skip this junk
+			continue; 
 		    }
 
-		    /* If we found a character that indicates the end of a BASE64 block
-		     * (a '=' or a '-' or a space), or we found an invalid base64
-		     * charcter, or if we are on the last character of the sbuf,
-		     * then attempt to decode.
-		     */
-		    char ch = sbuf[j];
-		    bool eof = (j+1==sbuf.size());
-		    if(eof || ch=='=' || ch=='-' || ch==' ' || (!isbase64(ch) && ch!='\n' && ch!='\r')){
-			size_t base64_len = j-i;
-			if(eof || ch=='-') base64_len += 1;	// we can include the termination character
-
-			if(!eof && base64_len<base64_min){	// a short line?
-			    i = j;			// skip this junk
-			    continue; 
-			}
-
-			/* Found the end of the base64 string; process. */
-
-                        managed_malloc<unsigned char>base64_target(base64_len);
-			const char *src = (const char *)(sbuf.buf+i);
-			if(base64_len + i > sbuf.bufsize){ // make sure it doesn't go beyond buffer
-			    base64_len = sbuf.bufsize-i;
-			}
-			int conv_len = b64_pton_forensic(src, base64_len, // src,srclen
-							 base64_target.buf, base64_len); // target, targetlen
-			if(conv_len>0){
-			    const pos0_t pos0_base64 = (sbuf.pos0 + i) + rcb.partName;
-			    const sbuf_t sbuf_base64(pos0_base64, base64_target.buf,conv_len,conv_len,false); // we will free
-			    (*rcb.callback)(scanner_params(sp,sbuf_base64));
-			}
-			i = j;			// advance past this section
-			break;			// break out of the j loop
+		    /* Found the end of the base64 string; process. */
+
+		    if(base64_target.size() < base64_len) base64_target.resize(base64_len);
+		    const char *src = (const char *)(sbuf.buf+i);
+		    if(base64_len + i > sbuf.bufsize){ // make sure it doesn't go beyond buffer
+			base64_len = sbuf.bufsize-i;
+		    }
+		    int conv_len = b64_pton_forensic(src, base64_len, // src,srclen
+						     &base64_target[0], base64_len); // target, targetlen
+		    if(conv_len>0){
+			const pos0_t pos0_base64 = (sbuf.pos0 + i) + rcb.partName;
+			const sbuf_t sbuf_base64(pos0_base64, &base64_target[0],conv_len,conv_len,false); // we will free
+			(*rcb.callback)(scanner_params(sp,sbuf_base64));
 		    }
+		    i = j;			// advance past this section
+		    break;			// break out of the j loop
 		}
 	    }
 	}
@@ -273,34 +273,31 @@ size_t sd_acv_min_buf = 4096;
 
 
 /**
- * Internal histogram class, can also handle entropy calculations
+ * Internal histogram class, can also handle entropy calculations.
+ *
+ * Everything lives in fixed-size arrays, so a histogram can be built on the
+ * stack for every block without touching the heap. Bytes are counted into
+ * four interleaved tables that are summed at the end; this keeps runs of the
+ * same byte value from serializing on one counter, and the final merge is a
+ * straight vector add.
  */
 class histogram {
 public:;
     class hist_element {
     public:;
-	hist_element(uint8_t v,uint32_t c):val(v),count(c){};
-	hist_element(const hist_element &ce):val(ce.val),count(ce.count){};
 	uint8_t  val;			// the value
 	uint32_t count;			// how many we have seen
-	static int inverse_frequency(const hist_element *a,const hist_element *b){
-	    return a->count > b->count;
+	static bool inverse_frequency(const hist_element &a,const hist_element &b){
+	    return a.count > b.count;
 	}
     };
     
-    histogram():counts(){}
-    virtual ~histogram(){
-	for(vector<hist_element *>::const_iterator it = counts.begin();it!=counts.end();it++){
-	    delete *it;
-	}
-	counts.clear();
-    }
-	
-    /* Entropy array is a precomputed array of p*log(p) where p=counts/blocksize
+    histogram():hist(),counts(),unique(0){}
+
+    /* Entropy array is a precomputed array of -p*log2(p) where p=counts/blocksize
      * index is number of counts.
      */
     static vector<float> entropy_array;
-    vector<hist_element *> counts;	// histogram counts, sorted by most popular
     static void precalc_entropy_array(int blocksize) {
 	entropy_array.clear();
 	for(int i=0;i<blocksize+1;i++){
@@ -309,32 +306,82 @@ public:;
 	}
     }
     uint32_t hist[256];			// counts of each byte value
+    hist_element counts[256];		// the first unique entries are valid
+    int unique;				// number of distinct byte values
+
     void add(const uint8_t *buf,size_t len){
-	memset(hist,0,sizeof(hist));
-	for(size_t i=0;i<len;i++){
-	    hist[buf[i]]++;
+	uint32_t h4[4][256];
+	memset(h4,0,sizeof(h4));
+	size_t i=0;
+	for(;i+4<=len;i+=4){
+	    h4[0][buf[i]]++;
+	    h4[1][buf[i+1]]++;
+	    h4[2][buf[i+2]]++;
+	    h4[3][buf[i+3]]++;
+	}
+	for(;i<len;i++){
+	    h4[0][buf[i]]++;
+	}
+	for(int j=0;j<256;j++){
+	    hist[j] = h4[0][j] + h4[1][j] + h4[2][j] + h4[3][j];
+	}
+    }
+    /**
+     * Histogram of buf[i]+buf[i+1] (mod 256), wrapping around at the end.
+     * This is the histogram of the autocorrelation buffer, computed
+     * without materializing the buffer.
+     */
+    void add_autocorrelation(const uint8_t *buf,size_t len){
+	uint32_t h4[4][256];
+	memset(h4,0,sizeof(h4));
+	size_t i=0;
+	for(;i+5<=len;i+=4){
+	    h4[0][(uint8_t)(buf[i]   + buf[i+1])]++;
+	    h4[1][(uint8_t)(buf[i+1] + buf[i+2])]++;
+	    h4[2][(uint8_t)(buf[i+2] + buf[i+3])]++;
+	    h4[3][(uint8_t)(buf[i+3] + buf[i+4])]++;
+	}
+	for(;i+1<len;i++){
+	    h4[0][(uint8_t)(buf[i] + buf[i+1])]++;
+	}
+	if(len>0) h4[0][(uint8_t)(buf[len-1] + buf[0])]++;
+	for(int j=0;j<256;j++){
+	    hist[j] = h4[0][j] + h4[1][j] + h4[2][j] + h4[3][j];
 	}
     }
     /**
-     * Calculate the number of unique values and sort them.
+     * Calculate the number of unique values.
+     * The values are left in byte order; call sort_by_frequency() if they are needed
+     * in order of popularity.
      */
     void calc_distribution(){	
+	unique = 0;
 	for(int i=0;i<256;i++){
-	    if(hist[i]) counts.push_back(new hist_element(i,hist[i]));
+	    if(hist[i]){
+		counts[unique].val   = i;
+		counts[unique].count = hist[i];
+		unique++;
+	    }
 	}
-	/* And sort it by frequency */
-	sort(counts.begin(),counts.end(),hist_element::inverse_frequency);
     }
-    float entropy() {
+    void sort_by_frequency(){
+	sort(counts,counts+unique,hist_element::inverse_frequency);
+    }
+    /**
+     * The entropy of the histogram, which must have been sorted by frequency.
+     * The terms are summed in float, most popular first, so that the value
+     * compared with opt_high_entropy and reported in bulk_tags is unchanged.
+     */
+    float entropy() const {
 	float eval = 0;
-	for(vector<hist_element *>::const_iterator it = counts.begin();it!=counts.end();it++){
-	    float p = (float)(*it)->count / (float)opt_bulk_block_size;
+	for(int i=0;i<unique;i++){
+	    float p = (float)counts[i].count / (float)opt_bulk_block_size;
 	    eval += -p * log2(p);
 	}
 	return eval;
     }
-    int unique_counts() {
-	return counts.size();
+    int unique_counts() const {
+	return unique;
     };
 };
 vector<float> histogram::entropy_array;	// where things get store
@@ -343,7 +390,7 @@ vector<float> histogram::entropy_array;	// where things get store
 /* 
  * This is currently a quick-and-dirty tester for the random vs. huffman characterizer.
  * The goal is to turn it into the general purpose production framework.
- * Returns true if 
+ * sbufhist must have been sorted by frequency.
  */
 
 double sd_autocorrelation_cosine_variance(const sbuf_t &sbuf,const histogram &sbufhist)
@@ -351,42 +398,40 @@ double sd_autocorrelation_cosine_variance(const sbuf_t &sbuf,const histogram &sb
     if(sbuf.bufsize<sd_acv_min_buf) return 0;
     if(sbuf.bufsize==0) return 0;
 
-    /* Create the autocorolation buffer */
-    managed_malloc<uint8_t>autobuf(sbuf.bufsize);
-    if(autobuf.buf){
-	for(size_t i=0;i<sbuf.bufsize-1;i++){
-	    autobuf.buf[i] = sbuf[i] + sbuf[i+1];
-	}
-	autobuf.buf[sbuf.bufsize-1] = sbuf[sbuf.bufsize-1] + sbuf[0];
-
-	/* Get a histogram for autobuf */
-	histogram autohist;
-	autohist.add(autobuf.buf,sbuf.bufsize);
-	autohist.calc_distribution();
-
-	/* Now compute the cosine similarity */
-	double dotproduct = 0.0;
-	for(size_t i=0; i < sbufhist.counts.size()  && i < autohist.counts.size() && i<256;
-	    i++){
-	    dotproduct += sbufhist.counts[i]->count * autohist.counts[i]->count;
-	}
+    /* Get a histogram for the autocorrelation of the buffer */
+    histogram autohist;
+    autohist.add_autocorrelation(sbuf.buf,sbuf.bufsize);
+    autohist.calc_distribution();
+    autohist.sort_by_frequency();
 
-	double mag_squared1 = 0.0;
-	double mag_squared2 = 0.0;
-	for(size_t i=0;i<256;i++){
-	    if(i < sbufhist.counts.size()){
-		mag_squared1 += sbufhist.counts[i]->count * sbufhist.counts[i]->count;
-	    }
-	    if(i < autohist.counts.size()){
-		mag_squared2 += autohist.counts[i]->count * autohist.counts[i]->count;
-	    }
-	}
-	double mag1 = sqrt(mag_squared1);
-	double mag2 = sqrt(mag_squared2);
-	double cosinesim = dotproduct / (mag1 * mag2);
-	return cosinesim;
+    /* Now compute the cosine similarity */
+    double dotproduct = 0.0;
+    for(int i=0; i < sbufhist.unique && i < autohist.unique; i++){
+	dotproduct += sbufhist.counts[i].count * autohist.counts[i].count;
+    }
+
+    double mag_squared1 = 0.0;
+    double mag_squared2 = 0.0;
+    for(int i=0;i<sbufhist.unique;i++){
+	mag_squared1 += sbufhist.counts[i].count * sbufhist.counts[i].count;
+    }
+    for(int i=0;i<autohist.unique;i++){
+	mag_squared2 += autohist.counts[i].count * autohist.counts[i].count;
+    }
+    double mag1 = sqrt(mag_squared1);
+    double mag2 = sqrt(mag_squared2);
+    double cosinesim = dotproduct / (mag1 * mag2);
+    return cosinesim;
+}
+
+/* Count the number of FF 00 pairs, which are common in JPEG entropy-coded data */
+static inline size_t count_ff00(const uint8_t *buf,size_t len)
+{
+    size_t count = 0;
+    for(size_t i=0;i+1<len;i++){
+	count += (buf[i]==0xff) & (buf[i+1]==0x00); // branch-free so that it vectorizes
     }
-    else return 0;
+    return count;
 }
 
 /**
@@ -398,47 +443,40 @@ double sd_autocorrelation_cosine_variance(const sbuf_t &sbuf,const histogram &sb
 
 static inline void bulk_ngram_entropy(const sbuf_t &sbuf,feature_recorder *bulk,feature_recorder *bulk_tags)
 {
-    /* Quickly compute the histogram */ 
-
-    /* Scan for a repeating ngram */
+    /* Scan for a repeating ngram.
+     * The block repeats with period ngram_size exactly when it is equal to itself
+     * shifted by ngram_size bytes, so each test is a single memcmp().
+     */
     for(size_t ngram_size = 1; ngram_size < 20; ngram_size++){
-	bool ngram_match = true;
-	for(size_t i=ngram_size;i<sbuf.pagesize && ngram_match;i++){
-	    if(sbuf[i%ngram_size]!=sbuf[i]) ngram_match = false;
-	}
-	if(ngram_match){
-	    stringstream ss;
-	    ss << CONSTANT << "(";
-	    for(size_t i=0;i<ngram_size;i++){
-		char buf[16];
-		snprintf(buf,sizeof(buf),"0x%02x",sbuf[i]);
-		if(i>0) ss << ' ';
-		ss << buf;
-	    }
-	    ss << ")";
-	    bulk_tags->write_tag(sbuf,ss.str());
-	    return;			// ngram is better than entropy
+	if(ngram_size < sbuf.pagesize
+	   && memcmp(sbuf.buf,sbuf.buf+ngram_size,sbuf.pagesize-ngram_size)!=0) continue;
+
+	stringstream ss;
+	ss << CONSTANT << "(";
+	for(size_t i=0;i<ngram_size;i++){
+	    char buf[16];
+	    snprintf(buf,sizeof(buf),"0x%02x",sbuf[i]);
+	    if(i>0) ss << ' ';
+	    ss << buf;
 	}
+	ss << ")";
+	bulk_tags->write_tag(sbuf,ss.str());
+	return;			// ngram is better than entropy
     }
 
-
     /* Couldn't find ngram; check entropy and FF00 counts...*/
-    size_t ff00_count=0;
     histogram h;
     h.add(sbuf.buf,sbuf.pagesize);
     h.calc_distribution();		
 
-    for(size_t i=0;i<sbuf.pagesize-1;i++){
-	if(sbuf[i]==0xff && sbuf[i+1]==0x00) ff00_count++;
-    }
-
     if(sbuf.pagesize<=4096){		// we only tuned for 4096
-	if(ff00_count>2 && h.unique_counts()>=220){
+	if(h.unique_counts()>=220 && count_ff00(sbuf.buf,sbuf.pagesize)>2){
 	    bulk_tags->write_tag(sbuf,JPEG);
 	    return;
 	}
     }
 
+    h.sort_by_frequency();
     float entropy = h.entropy();
 
     stringstream ss;
@@ -457,13 +495,12 @@ static inline void bulk_ngram_entropy(const sbuf_t &sbuf,feature_recorder *bulk,
 	ss << "low entropy ( S=" << entropy << ")";
 	if(h.unique_counts() < 5){
 	    ss << " Unique Counts: " << h.unique_counts() << " ";
-	    for(vector<histogram::hist_element *>::const_iterator it = h.counts.begin();it!=h.counts.end();it++){
-		ss << (int)((*it)->val) << ":" << (*it)->count << " ";
+	    for(int i=0;i<h.unique_counts();i++){
+		ss << (int)(h.counts[i].val) << ":" << h.counts[i].count << " ";
 	    }
 	}
     }
 }
-    
 
 static inline void bulk_bitlocker(const sbuf_t &sbuf,feature_recorder *bulk,feature_recorder *bulk_tags)
 {
@@ -9,6 +9,10 @@
 #include "scan_ccns2.h"
 #include "utils.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 int scan_ccns2_debug=0;
 
 
@@ -145,7 +149,7 @@ static int histogram_test(const char *digits)
 /** Return the value of the first 4 digites of a buffer, as an integer */
 static int int4(const char *cc)
 {
-    char buf[5];
+    char buf[5] = {0,0,0,0,0};		// a short number is just the digits present
     for(int i=0;i<4 && cc[i];i++){
 	buf[i] = cc[i];
     }
@@ -156,7 +160,7 @@ static int int4(const char *cc)
 /** Return the value of the first 6 digites of a buffer, as an integer */
 static int int6(const char *cc)
 {
-    char buf[7];
+    char buf[7] = {0,0,0,0,0,0,0};
     for(int i=0;i<6 && cc[i];i++){
 	buf[i] = cc[i];
     }
@@ -180,79 +184,74 @@ static int pattern_test(const char *digits)
  *
  * revised prefix test based on Wikipedia bank card number table
  * http://en.wikipedia.org/wiki/Bank_card_number
+ *
+ * The table gives, for each number length, the ranges of the first six digits
+ * that are allowed. A four-digit prefix abcd is the range abcd00-abcd99.
  */
 
+struct ccn_prefix_range {
+    int len;
+    int lo;
+    int hi;
+};
+
+static const ccn_prefix_range ccn_prefixes[] = {
+    {13,400000,499999},			// Visa; legacy as all 13-digits are deprecated
+    {14,300000,305099},			// Diners Club Carte Blanche (DC-CB)
+    {14,360000,399999},			// Diners Club International (DC-Int)
+    {15,201400,201499},			// Diners Club enRoute (DC-eR)
+    {15,214900,214999},			// Diners Club enRoute (DC-eR)
+    {15,340000,349999},			// American Express (AmEx)
+    {15,370000,379999},			// American Express (AmEx)
+    {16,352800,358999},			// JCB (JCB)
+    {16,400000,499999},			// Visa (Visa), including 417500
+    {16,510000,599999},			// MasterCard (MC), including BankCard 560221-560225 and 5610
+    {16,601100,601199},			// Discovery (Disc)
+    {16,622126,622925},			// China UnionPay (CUP)
+    {16,624000,626999},			// China UnionPay (CUP)
+    {16,628200,628899},			// China UnionPay (CUP)
+    {16,630400,630499},			// Laser (Lasr)
+    {16,633400,633499},			// Solo (Solo)
+    {16,670600,670699},			// Laser (Lasr)
+    {16,670900,670999},			// Laser (Lasr)
+    {16,676700,676799},			// Solo (Solo)
+    {16,677100,677199},			// Laser (Lasr)
+    {16,644000,659999},			// Discovery (Disc)
+    {17,622126,622925},			// China UnionPay (CUP)
+    {17,624000,626999},			// China UnionPay (CUP)
+    {17,628200,628899},			// China UnionPay (CUP)
+    {17,630400,630499},			// Laser (Lasr)
+    {17,670600,670699},			// Laser (Lasr)
+    {17,670900,670999},			// Laser (Lasr)
+    {17,677100,677199},			// Laser (Lasr)
+    {18,622126,622925},			// China UnionPay (CUP)
+    {18,624000,626999},			// China UnionPay (CUP)
+    {18,628200,628899},			// China UnionPay (CUP)
+    {18,630400,630499},			// Laser (Lasr)
+    {18,633400,633499},			// Solo (Solo)
+    {18,670600,670699},			// Laser (Lasr)
+    {18,670900,670999},			// Laser (Lasr)
+    {18,676700,676799},			// Solo (Solo)
+    {18,677100,677199},			// Laser (Lasr)
+    {19,622126,622925},			// China UnionPay (CUP)
+    {19,624000,626999},			// China UnionPay (CUP)
+    {19,628200,628899},			// China UnionPay (CUP)
+    {19,630400,630499},			// Laser (Lasr)
+    {19,633400,633499},			// Solo (Solo)
+    {19,670600,670699},			// Laser (Lasr)
+    {19,670900,670999},			// Laser (Lasr)
+    {19,676700,676799},			// Solo (Solo)
+    {19,677100,677199},			// Laser (Lasr)
+};
+
 static int prefix_test(const char *digits)
 {
     int len = strlen(digits);
-    int a = int4(digits);
     int b = int6(digits);
 
-    switch(len){
-    case 13:
-        if(digits[0]=='4') return 0; // Legacy as all 13-digits are deprecated
-	return -1;
-    case 14:
-	if(a>=3000 && a<=3050) return 0; // Diners Club Carte Blanche (DC-CB)
-	if(a>=3600 && a<=3999) return 0; // Diners Club International (DC-Int)
-	return -1;
-    case 15:
-	if(a==2014) return 0; // Diners Club enRoute (DC-eR)
-	if(a==2149) return 0; // Diners Club enRoute (DC-eR)
-	if(a>=3400 && a<=3499) return 0; // American Express (AmEx)
-	if(a>=3700 && a<=3799) return 0; // American Express (AmEx)
-	return -1;
-    case 16:
-	if(a>=3528 && a<=3589) return 0; // JCB (JCB)
-	if(a>=4000 && a<=4999) return 0; // Visa (Visa)
-	if(b==417500) return 0; // Visa (Visa)
-	if(a>=5100 && a<=5999) return 0; // MasterCard (MC)
-	if(b>=560221 && b<=560225) return 0; // BankCard (BC)
-	if(a==5610) return 0; // BankCard (BC)
-	if(a==6011) return 0; // Discovery (Disc)
-	if(b>=622126 && b<=622925) return 0; // China UnionPay (CUP)
-	if(b>=624000 && b<=626999) return 0; // China UnionPay (CUP)
-	if(b>=628200 && b<=628899) return 0; // China UnionPay (CUP)
-	if(a==6304) return 0; // Laser (Lasr)
-	if(a==6334) return 0; // Solo (Solo)
-	if(a==6706) return 0; // Laser (Lasr)
-	if(a==6709) return 0; // Laser (Lasr)
-	if(a==6767) return 0; // Solo (Solo)
-	if(a==6771) return 0; // Laser (Lasr)
-	if(a>=6440 && a<=6499) return 0; // Discovery (Disc)
-	if(a>=6500 && a<=6599) return 0; // Discovery (Disc)
-	return -1;
-    case 17:
-	if(b>=622126 && b<=622925) return 0; // China UnionPay (CUP)
-	if(b>=624000 && b<=626999) return 0; // China UnionPay (CUP)
-	if(b>=628200 && b<=628899) return 0; // China UnionPay (CUP)
-	if(a==6304) return 0; // Laser (Lasr)
-	if(a==6706) return 0; // Laser (Lasr)
-	if(a==6709) return 0; // Laser (Lasr)
-	if(a==6771) return 0; // Laser (Lasr)
-      	return -1;
-    case 18:
-	if(b>=622126 && b<=622925) return 0; // China UnionPay (CUP)
-	if(b>=624000 && b<=626999) return 0; // China UnionPay (CUP)
-	if(b>=628200 && b<=628899) return 0; // China UnionPay (CUP)
-	if(a==6304) return 0; // Laser (Lasr)
-	if(a==6334) return 0; // Solo (Solo)
-	if(a==6706) return 0; // Laser (Lasr)
-	if(a==6709) return 0; // Laser (Lasr)
-	if(a==6767) return 0; // Solo (Solo)
-	if(a==6771) return 0; // Laser (Lasr)
-      	return -1;
-    case 19:
-	if(b>=622126 && b<=622925) return 0; // China UnionPay (CUP)
-	if(b>=624000 && b<=626999) return 0; // China UnionPay (CUP)
-	if(b>=628200 && b<=628899) return 0; // China UnionPay (CUP)
-	if(a==6304) return 0; // Laser (Lasr)
-	if(a==6334) return 0; // Solo (Solo)
-	if(a==6706) return 0; // Laser (Lasr)
-	if(a==6709) return 0; // Laser (Lasr)
-	if(a==6767) return 0; // Solo (Solo)
-	if(a==6771) return 0; // Laser (Lasr)
-      	return -1;
+    for(size_t i=0;i<sizeof(ccn_prefixes)/sizeof(ccn_prefixes[0]);i++){
+        const ccn_prefix_range &r = ccn_prefixes[i];
+        if(r.len==len && b>=r.lo && b<=r.hi) return 0;
     }
     return -1;
 }
@@ -347,6 +346,127 @@ bool  valid_phone(const sbuf_t &sbuf,size_t pos,size_t len)
 }
 
 
+/****************************************************************
+ *** Batch validation
+ ****************************************************************/
+
+/* Digit values of a number, right-aligned and zero-padded to 32 bytes.
+ * Leading zeros add nothing to the Luhn sum, so every slot is summed the same way.
+ */
+struct luhn_slot {
+    uint8_t v[32];
+};
+
+static void luhn_fill(luhn_slot &slot,const char *digits)
+{
+    size_t len = strlen(digits);
+    memset(slot.v,0,sizeof(slot.v)-len);
+    for(size_t i=0;i<len;i++) slot.v[sizeof(slot.v)-len+i] = digit_val(digits[i]);
+}
+
+/* Luhn sums of count slots. Counting from the right, every second digit
+ * is doubled, and a doubled digit over 9 has 9 taken off.
+ */
+static void luhn_sums(const luhn_slot *slots,size_t count,int *sums)
+{
+#ifdef __SSE2__
+    const __m128i dbl  = _mm_set1_epi16(0x00ff); // the even bytes of a slot are doubled
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_setzero_si128();
+    for(size_t n=0;n<count;n++){
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(slots[n].v));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(slots[n].v+16));
+        v0 = _mm_add_epi8(v0,_mm_and_si128(v0,dbl));
+        v1 = _mm_add_epi8(v1,_mm_and_si128(v1,dbl));
+        v0 = _mm_sub_epi8(v0,_mm_and_si128(_mm_cmpgt_epi8(v0,nine),nine));
+        v1 = _mm_sub_epi8(v1,_mm_and_si128(_mm_cmpgt_epi8(v1,nine),nine));
+        __m128i s = _mm_sad_epu8(_mm_add_epi8(v0,v1),zero);
+        sums[n] = _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s,8));
+    }
+#else
+    static const int doubled[] = { 0,2,4,6,8,1,3,5,7,9 };
+    for(size_t n=0;n<count;n++){
+        int chk = 0;
+        for(size_t i=0;i<sizeof(slots[n].v);i+=2){
+            chk += doubled[slots[n].v[i]] + slots[n].v[i+1];
+        }
+        sums[n] = chk;
+    }
+#endif
+}
+
+/* The window tests of valid_ccn(), on the sbuf bytes around a candidate */
+static bool ccn_window_test(const sbuf_t &sbuf,const acct_candidate &c)
+{
+    const size_t window = 4;
+    char before[window+1];
+    for(size_t i=0;i<window;i++) before[i] = sbuf[c.pos-window+i]; // 0 before the start of the sbuf
+    before[window] = 0;
+    if(only_hex_digits(before,window) && !only_dec_digits(before,window)){
+        RETURN(false,"failed before hex test");
+    }
+    if(c.check_len < c.len){
+        char after[window+1];	// ends with the feature, as flex ended yytext with a NUL
+        memset(after,0,sizeof(after));
+        for(size_t i=0;i<window && c.check_len+i<c.len;i++) after[i] = sbuf[c.pos+c.check_len+i];
+        if(only_hex_digits(after,window) && !only_dec_digits(after,window)){
+            RETURN(false,"failed after hex test");
+        }
+    }
+    return true;
+}
+
+/**
+ * Validate all of the candidates of an sbuf. The CCN tests are the same as
+ * valid_ccn(), but the Luhn sums of the numbers that pass the cheap tests
+ * are computed together.
+ */
+void valid_accts(const sbuf_t &sbuf,const std::vector<acct_candidate> &cands,std::vector<bool> &valid)
+{
+    valid.assign(cands.size(),false);
+
+    std::vector<size_t>    ccns;		// candidates that passed the nondigit and prefix tests
+    std::vector<luhn_slot> slots;
+    for(size_t i=0;i<cands.size();i++){
+        const acct_candidate &c = cands[i];
+        switch(c.test){
+        case acct_candidate::NONE:
+            valid[i] = true;
+            break;
+        case acct_candidate::PHONE:
+            valid[i] = valid_phone(sbuf,c.pos,c.len);
+            break;
+        case acct_candidate::CCN: {
+            if(c.check_len>19) break;	// too long
+            char digits[20];
+            memset(digits,0,sizeof(digits));
+            if(extract_digits_and_test((const char *)sbuf.buf+c.pos,c.check_len,digits)) break;
+            if(prefix_test(digits)) break;
+            luhn_slot slot;
+            luhn_fill(slot,digits);
+            ccns.push_back(i);
+            slots.push_back(slot);
+            break;
+        }
+        }
+    }
+    if(ccns.size()==0) return;
+
+    std::vector<int> sums(ccns.size());
+    luhn_sums(&slots[0],slots.size(),&sums[0]);
+    for(size_t n=0;n<ccns.size();n++){
+        if(sums[n]%10 != 0) continue;	// failed ccv1 test
+        const acct_candidate &c = cands[ccns[n]];
+        char digits[20];
+        memset(digits,0,sizeof(digits));
+        extract_digits_and_test((const char *)sbuf.buf+c.pos,c.check_len,digits);
+        if(pattern_test(digits))   continue;
+        if(histogram_test(digits)) continue;
+        valid[ccns[n]] = ccn_window_test(sbuf,c);
+    }
+}
+
+
 
 #ifdef DEBUG
 static int validate_ccn_debug(const char *buf,int buflen)
@@ -2,7 +2,29 @@
 #define SCAN_CCNS2_H
 /* scan_ccns2.cpp --- here because it's used in both scan_accts.flex and scan_ccns2.cpp
  */
+#include <vector>
+
 bool  valid_ccn(const char *buf,int buflen);
 bool  valid_phone(const sbuf_t &sbuf,size_t pos,size_t len);
 extern int scan_ccns2_debug;
+
+/**
+ * A feature found by scan_accts, to be validated with the others in its sbuf.
+ * The feature is len bytes at pos. A CCN candidate is validated on its first
+ * check_len bytes; the bytes after those are looked at only if they are part
+ * of the feature, as valid_ccn() found a NUL after the flex match.
+ */
+struct acct_candidate {
+    enum test_t {NONE=0,CCN=1,PHONE=2};
+    acct_candidate(class feature_recorder *fr_,test_t test_,size_t pos_,size_t len_,size_t check_len_):
+        fr(fr_),test(test_),pos(pos_),len(len_),check_len(check_len_){}
+    class feature_recorder *fr;
+    test_t test;
+    size_t pos;
+    size_t len;
+    size_t check_len;
+};
+
+/* Set valid[i] for each candidate; NONE candidates are always valid */
+void  valid_accts(const sbuf_t &sbuf,const std::vector<acct_candidate> &cands,std::vector<bool> &valid);
 #endif
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "bulk_extractor_i.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,7 @@ using namespace std;
 #endif
 
 uint32_t   gzip_max_uncompr_size = 256*1024*1024; // don't decompress objects larger than this
+static const uint16_t trace_inflate = trace::intern("gzip:inflate","decompress");
 
 extern "C"
 void scan_gzip(const class scanner_params &sp,const recursion_control_block &rcb)
@@ -70,7 +72,10 @@ void scan_gzip(const class scanner_params &sp,const recursion_control_block &rcb
 
 		    int r = inflateInit2(&zs,16+MAX_WBITS);
 		    if(r==0){
-			r = inflate(&zs,Z_SYNC_FLUSH);
+			{
+			    trace::scope ts(trace_inflate,pos0.offset+(cc-sbuf.buf),sp.depth);
+			    r = inflate(&zs,Z_SYNC_FLUSH);
+			}
 			/* Ignore the error code; process data if we got any */
 			if(zs.total_out>0){	
 			    /* run decompress.buf through the recognizer.
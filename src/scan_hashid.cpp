@@ -34,9 +34,16 @@
 #include <dfxml/src/hash_t.h>
 
 #include <iostream>
+#include <deque>
+#include <vector>
+#include <pthread.h>
 #include <unistd.h>	// for getpid
 #include <sys/types.h>	// for getpid
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // static values that can be set from config
 static size_t chunk_size = 4096;
 static size_t sector_size = 512;
@@ -50,6 +57,227 @@ static bool scanner_is_usable = true;
 // the hashdb query service
 static hashdb::query_t* query = 0;
 
+// ************************************************************
+// multi-buffer MD5
+// ************************************************************
+// Chunks are hashed four at a time.  With SSE2 each 32-bit lane of the
+// MD5 state holds one chunk, so one pass over the 64 MD5 steps advances
+// all four hashes.  All four buffers must have the same length, which is
+// always true for chunks.
+
+#ifdef __SSE2__
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+static const int md5_r[4][4] = {{7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}};
+
+static inline uint32_t md5_load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);           // MD5 words are little-endian, as is every SSE2 host
+    return v;
+}
+
+// process one 64-byte block from each of the four lanes
+static void md5_x4_block(__m128i state[4], const uint8_t* const blocks[4]) {
+    __m128i w[16];
+    for (int j = 0; j < 16; j++) {
+        w[j] = _mm_set_epi32(md5_load32(blocks[3] + j*4), md5_load32(blocks[2] + j*4),
+                             md5_load32(blocks[1] + j*4), md5_load32(blocks[0] + j*4));
+    }
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        __m128i f;
+        int g;
+        switch (i / 16) {
+            case 0:  f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d)); g = i;              break;
+            case 1:  f = _mm_or_si128(_mm_and_si128(d, b), _mm_andnot_si128(d, c)); g = (5*i + 1) % 16; break;
+            case 2:  f = _mm_xor_si128(_mm_xor_si128(b, c), d);                     g = (3*i + 5) % 16; break;
+            default: f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones))); g = (7*i) % 16;     break;
+        }
+        const int r = md5_r[i / 16][i % 4];
+        __m128i t = _mm_add_epi32(_mm_add_epi32(a, f), _mm_add_epi32(w[g], _mm_set1_epi32(md5_k[i])));
+        t = _mm_or_si128(_mm_sll_epi32(t, _mm_cvtsi32_si128(r)), _mm_srl_epi32(t, _mm_cvtsi32_si128(32 - r)));
+        a = d;
+        d = c;
+        c = b;
+        b = _mm_add_epi32(b, t);
+    }
+    state[0] = _mm_add_epi32(state[0], a);
+    state[1] = _mm_add_epi32(state[1], b);
+    state[2] = _mm_add_epi32(state[2], c);
+    state[3] = _mm_add_epi32(state[3], d);
+}
+#endif
+
+// hash four buffers of length len
+static void md5_x4(const uint8_t* const bufs[4], size_t len, md5_t md5s[4]) {
+#ifdef __SSE2__
+    __m128i state[4] = {_mm_set1_epi32(0x67452301), _mm_set1_epi32(0xefcdab89),
+                        _mm_set1_epi32(0x98badcfe), _mm_set1_epi32(0x10325476)};
+    const uint8_t* blocks[4];
+    size_t offset = 0;
+    for (; offset + 64 <= len; offset += 64) {
+        for (int lane = 0; lane < 4; lane++) blocks[lane] = bufs[lane] + offset;
+        md5_x4_block(state, blocks);
+    }
+
+    // the padding is the same for every lane since the lengths are the same
+    const size_t rem = len - offset;
+    const size_t tail_len = (rem + 9 <= 64) ? 64 : 128;
+    uint8_t tails[4][128];
+    const uint64_t bits = (uint64_t)len * 8;
+    for (int lane = 0; lane < 4; lane++) {
+        memset(tails[lane], 0, tail_len);
+        memcpy(tails[lane], bufs[lane] + offset, rem);
+        tails[lane][rem] = 0x80;
+        for (int j = 0; j < 8; j++) tails[lane][tail_len - 8 + j] = (uint8_t)(bits >> (8*j));
+    }
+    for (size_t t = 0; t < tail_len; t += 64) {
+        for (int lane = 0; lane < 4; lane++) blocks[lane] = tails[lane] + t;
+        md5_x4_block(state, blocks);
+    }
+
+    uint32_t words[4][4];
+    for (int j = 0; j < 4; j++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(words[j]), state[j]);
+    }
+    for (int lane = 0; lane < 4; lane++) {
+        for (int j = 0; j < 4; j++) memcpy(md5s[lane].digest + j*4, &words[j][lane], 4);
+    }
+#else
+    for (int lane = 0; lane < 4; lane++) md5s[lane] = md5_generator::hash_buf(bufs[lane], len);
+#endif
+}
+
+// ************************************************************
+// batched queries
+// ************************************************************
+// Scan threads hash their chunks and queue them here without waiting.
+// A single query thread takes everything that has queued up, up to
+// max_query_hashes, and issues it to hashdb as one request.  Scan threads
+// only wait if max_pending_hashes are already waiting for the query thread.
+
+static const size_t max_query_hashes = 65536;
+static const size_t max_pending_hashes = 1024*1024;
+
+struct hashid_chunk_t {
+    uint64_t offset;                    // offset of the chunk in the sbuf
+    uint8_t digest[16];
+};
+
+struct hashid_batch_t {
+    hashid_batch_t(feature_recorder* p_recorder, const pos0_t& p_pos0) :
+                   recorder(p_recorder), pos0(p_pos0), chunks() {}
+    feature_recorder* recorder;
+    pos0_t pos0;                        // pos0 of the sbuf the chunks came from
+    std::vector<hashid_chunk_t> chunks;
+};
+
+static pthread_mutex_t batch_M;         // protects the following
+static pthread_cond_t batch_ready;      // to the query thread
+static pthread_cond_t batch_space;      // to the scan threads
+static std::deque<hashid_batch_t*> batch_queue;
+static size_t pending_hashes = 0;
+static bool query_thread_done = false;
+static pthread_t query_thread;
+
+// send one request for a set of batches and record the features found
+static void query_batches(const std::vector<hashid_batch_t*>& batches) {
+    hashdb::hashes_request_md5_t request;
+    hashdb::hashes_response_md5_t response;
+
+    // the query id indexes the chunks in batch order
+    std::vector<std::pair<const hashid_batch_t*, const hashid_chunk_t*> > ids;
+    for (std::vector<hashid_batch_t*>::const_iterator b = batches.begin(); b != batches.end(); ++b) {
+        for (std::vector<hashid_chunk_t>::const_iterator c = (*b)->chunks.begin(); c != (*b)->chunks.end(); ++c) {
+            request.push_back(hashdb::hash_request_md5_t(ids.size(), c->digest));
+            ids.push_back(std::make_pair(*b, &*c));
+        }
+    }
+    if (request.size() == 0) {
+        return;
+    }
+
+    int status = query->query_hashes_md5(request, response);
+    if (status != 0) {
+        std::cerr << "Error in hashid hash query\n";
+        return;
+    }
+
+    // record each feature in the response
+    for (std::vector<hashdb::hash_response_md5_t>::const_iterator it = response.begin(); it != response.end(); ++it) {
+        if (it->id >= ids.size()) {
+            continue;
+        }
+        const hashid_batch_t* batch = ids[it->id].first;
+
+        // get the variables together for the feature
+        pos0_t pos0 = batch->pos0 + ids[it->id].second->offset;
+
+        // convert uint8_t[] to md5
+        md5_t md5;
+        memcpy(md5.digest, it->digest, 16);
+
+        std::string feature = md5.hexdigest();
+        stringstream ss;
+        ss << it->duplicates_count;
+        std::string context = ss.str();
+
+        // record the feature
+        batch->recorder->write(pos0, feature, context);
+    }
+}
+
+static void* query_worker(void* arg __attribute__((unused))) {
+    while (true) {
+        std::vector<hashid_batch_t*> batches;
+        pthread_mutex_lock(&batch_M);
+        while (batch_queue.empty() && !query_thread_done) {
+            pthread_cond_wait(&batch_ready, &batch_M);
+        }
+        if (batch_queue.empty()) {
+            // done and drained
+            pthread_mutex_unlock(&batch_M);
+            break;
+        }
+        size_t count = 0;
+        while (!batch_queue.empty() &&
+               (count == 0 || count + batch_queue.front()->chunks.size() <= max_query_hashes)) {
+            count += batch_queue.front()->chunks.size();
+            batches.push_back(batch_queue.front());
+            batch_queue.pop_front();
+        }
+        pending_hashes -= count;
+        pthread_cond_broadcast(&batch_space);
+        pthread_mutex_unlock(&batch_M);
+
+        query_batches(batches);
+        for (std::vector<hashid_batch_t*>::iterator b = batches.begin(); b != batches.end(); ++b) {
+            delete *b;
+        }
+    }
+    return 0;
+}
+
+// hand a batch to the query thread
+static void submit_batch(hashid_batch_t* batch) {
+    pthread_mutex_lock(&batch_M);
+    while (pending_hashes >= max_pending_hashes) {
+        pthread_cond_wait(&batch_space, &batch_M);
+    }
+    pending_hashes += batch->chunks.size();
+    batch_queue.push_back(batch);
+    pthread_cond_signal(&batch_ready);
+    pthread_mutex_unlock(&batch_M);
+}
+
 extern "C"
 void scan_hashid(const class scanner_params &sp,
                  const recursion_control_block &rcb) {
@@ -189,6 +417,16 @@ void scan_hashid(const class scanner_params &sp,
                               << "Cannot continue.\n";
                     exit(1);
                 }
+
+                // start the query thread
+                pthread_mutex_init(&batch_M, NULL);
+                pthread_cond_init(&batch_ready, NULL);
+                pthread_cond_init(&batch_space, NULL);
+                if (pthread_create(&query_thread, NULL, query_worker, NULL)) {
+                    std::cerr << "Error.  Unable to start the hashid query thread.\n"
+                              << "Cannot continue.\n";
+                    exit(1);
+                }
             }
             return;
         }
@@ -205,60 +443,35 @@ void scan_hashid(const class scanner_params &sp,
             // get the sbuf
             const sbuf_t& sbuf = sp.sbuf;
 
-            // allocate big space on heap for request and response
-            hashdb::hashes_request_md5_t* request =
-                                 new hashdb::hashes_request_md5_t;
-            hashdb::hashes_response_md5_t* response =
-                                 new hashdb::hashes_response_md5_t;
-
-            // populate request with chunk hashes calculated from sbuf
-            // use i as query id so that later it can be used as the feature
-            // offset
-            for (size_t i=0; i + chunk_size <= sbuf.pagesize; i += chunk_size) {
-                // calculate the hash
+            // hash the chunks, four at a time, into a batch for the query thread
+            // the chunk offset is used later as the feature offset
+            hashid_batch_t* batch = new hashid_batch_t(md5_recorder, sbuf.pos0);
+            size_t i = 0;
+            for (; i + 4 * chunk_size <= sbuf.pagesize; i += 4 * chunk_size) {
+                const uint8_t* bufs[4] = {sbuf.buf + i, sbuf.buf + i + chunk_size,
+                                          sbuf.buf + i + 2 * chunk_size, sbuf.buf + i + 3 * chunk_size};
+                md5_t md5s[4];
+                md5_x4(bufs, chunk_size, md5s);
+                for (int lane = 0; lane < 4; lane++) {
+                    hashid_chunk_t chunk;
+                    chunk.offset = i + lane * chunk_size;
+                    memcpy(chunk.digest, md5s[lane].digest, 16);
+                    batch->chunks.push_back(chunk);
+                }
+            }
+            for (; i + chunk_size <= sbuf.pagesize; i += chunk_size) {
                 md5_t md5 = md5_generator::hash_buf(sbuf.buf + i, chunk_size);
-
-                // convert md5 to uint8_t[]
-                // note: could optimize and typecast instead.
-                uint8_t digest[16];
-                memcpy(digest, md5.digest, 16);
-
-                // add the hash to the query hash request
-                request->push_back(hashdb::hash_request_md5_t(i, digest));
+                hashid_chunk_t chunk;
+                chunk.offset = i;
+                memcpy(chunk.digest, md5.digest, 16);
+                batch->chunks.push_back(chunk);
             }
 
-            // perform the query
-            int status2 = query->query_hashes_md5(*request, *response);
-std::cout << "scan_hashid query " << query->query_status() << " query_hashes_md5: " << status2 << "\n";
-
-            if (status2 == 0) {
-                // record each feature in the response
-                for (std::vector<hashdb::hash_response_md5_t>::const_iterator it = response->begin(); it != response->end(); ++it) {
-
-                    // get the variables together for the feature
-                    pos0_t pos0 = sbuf.pos0 + it->id;
-
-                    // convert uint8_t[] to md5
-                    md5_t md5;
-                    memcpy(md5.digest,it->digest, 16);
-
-                    std::string feature = md5.hexdigest();
-                    stringstream ss;
-                    ss << it->duplicates_count;
-                    std::string context = ss.str();
-
-                    // record the feature
-                    md5_recorder->write(pos0, feature, context);
-                }
-            } else {
-                // the query failed
-                std::cerr << "Error in hashid hash query\n";
+            if (batch->chunks.size() == 0) {
+                delete batch;
+                return;
             }
-
-            // deallocate big space on heap for request and response
-            delete request;
-            delete response;
-
+            submit_batch(batch);
             return;
         }
 
@@ -268,6 +481,13 @@ std::cout << "scan_hashid query " << query->query_status() << " query_hashes_md5
                 return;
             }
 
+            // let the query thread drain the queue, then stop it
+            pthread_mutex_lock(&batch_M);
+            query_thread_done = true;
+            pthread_cond_signal(&batch_ready);
+            pthread_mutex_unlock(&batch_M);
+            pthread_join(query_thread, NULL);
+
             // deallocate hashdb query service resources
             delete query;
             return;
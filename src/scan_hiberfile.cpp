@@ -2,10 +2,12 @@
 #include "bulk_extractor_i.h"
 #include "image_process.h"
 #include "pyxpress.h"
+#include "trace.h"
 
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 
 #define ZLIB_CONST
@@ -23,9 +25,86 @@
 
 static const int windows_page_size = 4096;
 static const int min_uncompr_size = 4096; // allow at least this much when uncompressing
+static const uint16_t trace_xpress = trace::intern("hiberfile:xpress","decompress");
 
 using namespace std;
 
+/**
+ * Each thread keeps its decompression buffer between calls, so that a page
+ * full of Xpress blocks does not allocate a buffer for every one.
+ * The buffer is in use while the decompressed data is being recursively
+ * scanned; a nested call (there should be none, as HIBER data is not
+ * rescanned for HIBER) gets a buffer of its own.
+ */
+struct hiber_buffer {
+    hiber_buffer():buf(0),size(0),in_use(false){}
+    u_char *buf;
+    size_t  size;
+    bool    in_use;
+};
+
+static pthread_key_t  hiber_buffer_key;
+static pthread_once_t hiber_buffer_once = PTHREAD_ONCE_INIT;
+
+static void hiber_buffer_free(void *arg)
+{
+    hiber_buffer *hb = static_cast<hiber_buffer *>(arg);
+    free(hb->buf);
+    delete hb;
+}
+
+static void hiber_buffer_init()
+{
+    pthread_key_create(&hiber_buffer_key,hiber_buffer_free);
+}
+
+static hiber_buffer *get_hiber_buffer()
+{
+    pthread_once(&hiber_buffer_once,hiber_buffer_init);
+    hiber_buffer *hb = static_cast<hiber_buffer *>(pthread_getspecific(hiber_buffer_key));
+    if(hb==0){
+        hb = new hiber_buffer();
+        pthread_setspecific(hiber_buffer_key,hb);
+    }
+    return hb;
+}
+
+static const u_char xpress_magic[8] = {0x81,0x81,0x78,0x70,0x72,0x65,0x73,0x73}; // "\x81\x81xpress"
+
+/* Decompress the Xpress block at cc and recursively scan it, a Windows page at a time */
+static void process_xpress_block(const scanner_params &sp,const recursion_control_block &rcb,
+                                 const unsigned char *cc,u_char *decomp_buf,size_t max_uncompr_size_,
+                                 size_t compr_size)
+{
+    const sbuf_t &sbuf = sp.sbuf;
+    const pos0_t &pos0 = sp.sbuf.pos0;
+    const u_char *compressed_buf = cc+32;		 // "the header contains 32 bytes"
+
+    int decompress_size = 0;
+    {
+        trace::scope ts(trace_xpress,pos0.offset+(cc-sbuf.buf),sp.depth);
+        decompress_size = Xpress_Decompress(compressed_buf,compr_size,
+                                            decomp_buf,max_uncompr_size_);
+    }
+
+    if(decompress_size>0){
+        const ssize_t pos = cc-sbuf.buf;
+        const pos0_t pos0_hiber = (pos0 + pos) + rcb.partName;
+        const sbuf_t sbuf_new(pos0_hiber,decomp_buf,decompress_size,decompress_size,false);
+
+        /* sbuf_new is an sbuf that may extend over multiple pages.
+         * Unfortunately the pages are not logically connected, because they are physical memory, and it is
+         * highly unlikely that adjacent logical pages will have adjacent physical pages. Therefore we now
+         * break up this sbuf into 4096 byte chunks and process each individually. This prevents scanners like the JPEG carver
+         * from inadvertantly reassembling objects that make no semantic sense.
+         */
+        for(size_t start = 0; start < sbuf_new.bufsize; start += windows_page_size){
+            const sbuf_t sbuf2(sbuf_new,start,windows_page_size);
+            (*rcb.callback)(scanner_params(sp,sbuf2)); // recurse
+        }
+    }
+}
+
 /**
  * scan_hiberfile:
  * Look for elements of the hibernation file and decompress them.
@@ -59,16 +138,17 @@ void scan_hiberfile(const class scanner_params &sp,const recursion_control_block
 	}
 
 
-	for(const unsigned char *cc=sbuf.buf ;
-	    cc < sbuf.buf + sbuf.pagesize && cc<sbuf.buf+sbuf.bufsize-38 ;
-	    cc++){
+	if(sbuf.bufsize<=38) return;
+	const unsigned char *end = sbuf.buf + (sbuf.pagesize < sbuf.bufsize-38 ? sbuf.pagesize : sbuf.bufsize-38);
+	for(const unsigned char *cc=sbuf.buf ; cc < end ; cc++){
 
 	    /**
 	     * http://www.pyflag.net/pyflag/src/lib/pyxpress.c
              * Decompress each block separetly 
 	     */
-	    if(cc[0]==0x81 && cc[1]==0x81 && cc[2]==0x78 && cc[3]==0x70 &&
-	       cc[4]==0x72 && cc[5]==0x65 && cc[6]==0x73 && cc[7]==0x73){
+	    cc = static_cast<const unsigned char *>(memchr(cc,xpress_magic[0],end-cc));
+	    if(cc==0) break;
+	    if(memcmp(cc,xpress_magic,sizeof(xpress_magic))==0){
 
 		u_int compressed_length = (((cc[9]<<8) + (cc[10] << 16) + (cc[11]<<24)) >> 10) + 1;
 		const u_char *compressed_buf = cc+32;		 // "the header contains 32 bytes"
@@ -79,28 +159,27 @@ void scan_hiberfile(const class scanner_params &sp,const recursion_control_block
                     max_uncompr_size_=min_uncompr_size; // it should at least be this large!
                 }
 
-		managed_malloc<u_char>decomp(max_uncompr_size_);
-
-
-		int decompress_size = Xpress_Decompress(compressed_buf,compr_size,
-							decomp.buf,max_uncompr_size_);
-
-		if(decompress_size>0){
-		    const ssize_t pos = cc-sbuf.buf;
-		    const pos0_t pos0_hiber = (pos0 + pos) + rcb.partName;
-		    const sbuf_t sbuf_new(pos0_hiber,decomp.buf,decompress_size,decompress_size,false);
-
-                    /* sbuf_new is an sbuf that may extend over multiple pages.
-                     * Unfortunately the pages are not logically connected, because they are physical memory, and it is
-                     * highly unlikely that adjacent logical pages will have adjacent physical pages. Therefore we now
-                     * break up this sbuf into 4096 byte chunks and process each individually. This prevents scanners like the JPEG carver
-                     * from inadvertantly reassembling objects that make no semantic sense.
-                     */
-                    for(size_t start = 0; start < sbuf_new.bufsize; start += windows_page_size){
-                        const sbuf_t sbuf2(sbuf_new,start,windows_page_size);
-                        (*rcb.callback)(scanner_params(sp,sbuf2)); // recurse
-                    }
+		hiber_buffer *hb = get_hiber_buffer();
+		if(hb->in_use){
+		    managed_malloc<u_char>decomp(max_uncompr_size_);
+		    process_xpress_block(sp,rcb,cc,decomp.buf,max_uncompr_size_,compr_size);
+		    continue;
+		}
+		if(hb->size < max_uncompr_size_){
+		    u_char *nbuf = static_cast<u_char *>(realloc(hb->buf,max_uncompr_size_));
+		    if(nbuf==0) throw std::bad_alloc();
+		    hb->buf  = nbuf;
+		    hb->size = max_uncompr_size_;
+		}
+		hb->in_use = true;
+		try {
+		    process_xpress_block(sp,rcb,cc,hb->buf,max_uncompr_size_,compr_size);
+		}
+		catch (...) {
+		    hb->in_use = false;
+		    throw;
 		}
+		hb->in_use = false;
 	    }
 	}
     }
@@ -32,6 +32,12 @@ SOFTWARE.
 #include "bulk_extractor_i.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <map>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 class json_checker {
     static const int stacksize=256;	// max stack
@@ -49,6 +55,8 @@ public:
     int check_char(int next_char);
     int done();
     bool check_if_done();
+    bool in_string() const;
+    int depth() const { return top; }	// number of open containers
 };
 
 
@@ -236,6 +244,11 @@ bool json_checker::check_if_done()
     return state==OK && top==0;
 }
 
+bool json_checker::in_string() const
+{
+    return state==ST;
+}
+
 int json_checker::done()
 {
 /*
@@ -427,6 +440,119 @@ int json_checker::check_char(int next_char)
  ** Make the JSON validator work with bulk_extractor
  */
 
+/*
+ * Candidate regions are validated once.  A checker that runs off the end of
+ * the buffer leaves behind where each container it opened was closed and how
+ * many commas it held; starts inside that region are then answered from the
+ * index instead of being re-validated once per nesting level.  A fresh
+ * checker started at a nested container sees exactly the same transitions
+ * until the container closes, so the answer is the same.
+ *
+ * String bodies are skipped 16 bytes at a time up to the next quote,
+ * backslash or control character, which are the only bytes that change
+ * the checker's state inside a string.
+ */
+struct json_container {
+    size_t   open;			// offset of the { or [
+    size_t   close;			// offset of the matching } or ]
+    uint32_t commas;			// commas inside; comma_count at open while still open
+    bool     closed;			// false if the buffer ended first
+};
+typedef std::map<size_t,json_container> json_index; // by open offset
+
+struct json_trace {
+    json_trace():open(),closed(){}
+    std::vector<json_container> open;	// innermost last
+    std::vector<json_container> closed;
+};
+
+enum json_result {
+    JSON_REJECTED,			// stopped at an invalid character
+    JSON_DONE,				// stopped at the closing bracket
+    JSON_EOB				// reached the end of the buffer
+};
+
+/* Return the first offset in [i,len) holding a { or [, or len */
+static size_t json_next_open(const uint8_t *buf,size_t i,size_t len)
+{
+#ifdef __SSE2__
+    const __m128i lcurb = _mm_set1_epi8('{');
+    const __m128i lsqrb = _mm_set1_epi8('[');
+    for(;i+16<=len;i+=16){
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf+i));
+        uint32_t m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v,lcurb),_mm_cmpeq_epi8(v,lsqrb)));
+        if(m) return i+__builtin_ctz(m);
+    }
+#endif
+    for(;i<len;i++){
+        if(buf[i]=='{' || buf[i]=='[') return i;
+    }
+    return len;
+}
+
+/* Return the first offset in [i,len) that can end or escape a string body, or len */
+static size_t json_skip_string(const uint8_t *buf,size_t i,size_t len)
+{
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backs = _mm_set1_epi8('\\');
+    const __m128i ctl   = _mm_set1_epi8(0x1f);
+    for(;i+16<=len;i+=16){
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf+i));
+        __m128i s = _mm_or_si128(_mm_cmpeq_epi8(v,quote),_mm_cmpeq_epi8(v,backs));
+        s = _mm_or_si128(s,_mm_cmpeq_epi8(_mm_min_epu8(v,ctl),v));
+        uint32_t m = _mm_movemask_epi8(s);
+        if(m) return i+__builtin_ctz(m);
+    }
+#endif
+    for(;i<len;i++){
+        if(buf[i]=='"' || buf[i]=='\\' || buf[i]<0x20) return i;
+    }
+    return len;
+}
+
+/*
+ * Run a json_checker from pos. On JSON_REJECTED and JSON_DONE, *stop is the
+ * offset of the last character examined and *commas the number of commas seen.
+ * trace records the containers opened along the way.
+ */
+static json_result json_check_region(const sbuf_t &sbuf,size_t pos,json_trace &trace,
+                                     size_t *stop,uint32_t *commas)
+{
+    json_checker jc;
+    trace.open.clear();
+    trace.closed.clear();
+    for(size_t i=pos;i<sbuf.bufsize;i++){
+        if(jc.in_string()){
+            i = json_skip_string(sbuf.buf,i,sbuf.bufsize);
+            if(i>=sbuf.bufsize) break;
+        }
+        const int depth = jc.depth();
+        const uint8_t ch = sbuf.buf[i];
+        if(jc.check_char(ch)){		// is character invalid?
+            *stop = i;
+            return JSON_REJECTED;
+        }
+        if(jc.depth()>depth){
+            json_container c = {i,0,jc.comma_count,false};
+            trace.open.push_back(c);
+        } else if(jc.depth()<depth){
+            json_container c = trace.open.back();
+            trace.open.pop_back();
+            c.close  = i;
+            c.commas = jc.comma_count - c.commas;
+            c.closed = true;
+            trace.closed.push_back(c);
+        }
+        if((ch==']' || ch=='}') && jc.check_if_done()){
+            *stop = i;
+            *commas = jc.comma_count;
+            return JSON_DONE;
+        }
+    }
+    return JSON_EOB;
+}
+
 static bool is_json_second_char[256];		// shared between all threads
 static be13::hash_def hasher;
 
@@ -458,27 +584,43 @@ void scan_json(const class scanner_params &sp,const recursion_control_block &rcb
 	feature_recorder *fr = sp.fs.get_name("json");
         fr->set_flag(feature_recorder::FLAG_XML);
 
-	for(size_t pos = 0;pos+1<sbuf.pagesize;pos++){
-	    /* Find the beginning of a json object. This will improve later... */
-	    if((sbuf[pos]=='{' || sbuf[pos]=='[') && is_json_second_char[sbuf[pos+1]]){
-		json_checker jc;
-		for(size_t i=pos;i<sbuf.bufsize;i++){
-		    if(jc.check_char(sbuf[i])){ // is character invalid?
-			pos = i;		    // yes
-			break;
+	json_index index;			// containers from checkers that ran off the end of the buffer
+	json_trace trace;
+	const size_t last = sbuf.pagesize>0 ? sbuf.pagesize-1 : 0; // need pos+1<pagesize
+	for(size_t pos = json_next_open(sbuf.buf,0,last);pos<last;pos = json_next_open(sbuf.buf,pos+1,last)){
+	    /* pos is the beginning of a json object if the next byte is plausible */
+	    if(!is_json_second_char[sbuf[pos+1]]) continue;
+
+	    size_t stop = 0;
+	    uint32_t commas = 0;
+	    json_result res;
+	    json_index::const_iterator it = index.find(pos);
+	    if(it!=index.end()){
+		/* Already validated as part of an enclosing region */
+		res    = it->second.closed ? JSON_DONE : JSON_EOB;
+		stop   = it->second.close;
+		commas = it->second.commas;
+	    } else {
+		res = json_check_region(sbuf,pos,trace,&stop,&commas);
+		if(res==JSON_EOB){
+		    for(std::vector<json_container>::const_iterator c=trace.closed.begin();c!=trace.closed.end();c++){
+			index[c->open] = *c;
 		    }
-		    if((sbuf[i]==']' || sbuf[i]=='}') && jc.check_if_done()){
-			// Only write JSON objects with more than 2 commas
-			if(jc.comma_count > 2 ){
-			    sbuf_t json(sbuf,pos,i-pos+1);
-                            std::string json_hash = (*hasher.func)(json.buf,json.bufsize);
-			    fr->write(sbuf.pos0+i,json.asString(),json_hash);;
-			}
-			pos = i;		// skip to the end
-			break;
+		    for(std::vector<json_container>::const_iterator c=trace.open.begin();c!=trace.open.end();c++){
+			index[c->open] = *c;
 		    }
 		}
 	    }
+	    if(res==JSON_EOB) continue;		// ran off the end; try the next byte
+	    if(res==JSON_DONE){
+		// Only write JSON objects with more than 2 commas
+		if(commas > 2 ){
+		    sbuf_t json(sbuf,pos,stop-pos+1);
+		    std::string json_hash = (*hasher.func)(json.buf,json.bufsize);
+		    fr->write(sbuf.pos0+stop,json.asString(),json_hash);
+		}
+	    }
+	    pos = stop;				// skip to the end or past the invalid character
 	}
     }
 }
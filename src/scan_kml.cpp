@@ -19,7 +19,7 @@
 #include <sstream>
 
 
-#include "utf8.h"
+#include "utf_util.h"
 
 using namespace std;
 
@@ -56,9 +56,8 @@ void scan_kml(const class scanner_params &sp,const recursion_control_block &rcb)
 	    if(ekml_loc==-1) return;
 	    ssize_t kml_len = (ekml_loc-xml_loc)+6;
 
-	    /* verify the utf-8 */
-	    std::string possible_kml = sbuf.substr(xml_loc,kml_len);
-	    if(utf8::find_invalid(possible_kml.begin(),possible_kml.end()) == possible_kml.end()){
+	    /* verify the utf-8 in place */
+	    if(utf8_valid(sbuf.buf+xml_loc,kml_len)){
 		/* No invalid UTF-8 */
 		kml_recorder->carve(sbuf,xml_loc,kml_len,hasher);
 		i = ekml_loc + 6;	// skip past end of </kml>
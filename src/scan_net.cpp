@@ -27,6 +27,7 @@
 #include "be13_api/utils.h"
 
 #include <set>
+#include <string>
 #include <tr1/unordered_set>
 
 #include <sys/types.h>
@@ -48,9 +49,14 @@
 typedef char sa_family_t;
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Hardcoded tunings */
 
 #define PCAP_MAX_PKT_LEN    65535	// The longest a packet may be; longer values make wireshark refuse to load
+static const size_t PCAP_FLUSH_SIZE = 4*1024*1024; // packets buffered per carver before writing
 static const uint16_t sane_ports[] = {80, 443, 53, 25, 110, 143, 993, 587, 23, 22, 21, 20, 119, 123};
 static const uint16_t sane_ports_len = sizeof(sane_ports) / sizeof(uint16_t);
 
@@ -211,6 +217,47 @@ struct be_udphdr {
 };
 
 
+/**
+ * Sum buf[0..len) as little-endian 16-bit words, without folding.
+ * The even and odd octets are summed separately, which gives the same
+ * total as adding the words and lets SSE2 take 16 octets at a time.
+ * A trailing odd octet is ignored; all of our headers are whole words.
+ */
+static uint64_t le16_word_sum(const uint8_t *buf,size_t len)
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero   = _mm_setzero_si128();
+    const __m128i lomask = _mm_set1_epi16(0x00ff);
+    __m128i acc_lo = zero;
+    __m128i acc_hi = zero;
+    for(;i+16<=len;i+=16){
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf+i));
+        acc_lo = _mm_add_epi64(acc_lo,_mm_sad_epu8(_mm_and_si128(v,lomask),zero));
+        acc_hi = _mm_add_epi64(acc_hi,_mm_sad_epu8(_mm_srli_epi16(v,8),zero));
+    }
+    uint64_t part[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(part),acc_lo); lo = part[0]+part[1];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(part),acc_hi); hi = part[0]+part[1];
+#endif
+    for(;i+1<len;i+=2){
+        lo += buf[i];
+        hi += buf[i+1];
+    }
+    return lo + (hi<<8);
+}
+
+/* fold a ones-complement sum down to 16 bits */
+static uint16_t fold_cksum(uint64_t sum)
+{
+    while(sum>>16){
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
 /**
  * Computes the checksum for IPv6 TCP, UDP and ICMPv6. 
  * 
@@ -229,82 +276,55 @@ static uint16_t IPv6L3Chksum(const sbuf_t &sbuf, u_int chksum_byteoffset)
 {
     const struct ip6_hdr *ip6 = sbuf.get_struct_ptr<struct ip6_hdr>(0);
     if(ip6==0) return 0;		// cannot compute; not enough data
-	
-    int len = ntohs(ip6->ip6_plen) + 40;/* payload len + size of pseudo hdr */
-    uint32_t sum = 0;			// 
-    u_int octets_processed = 0;
 
-    /** We start counting at offset 8, which is the source address
-     *  which is followed by the ipv6 dst addr field and then the tcp
-     * payload
+    /* We start counting at offset 8, which is the source address,
+     * which is followed by the ipv6 dst addr field and then the tcp payload.
+     * The pseudo header length and next header take the place of the word at
+     * offset 40; after that the octet count runs two behind the buffer offset,
+     * so the word left out is the one at chksum_byteoffset+2.  The payload is
+     * summed through 40+ip6_plen, rounded up to a whole word.  This is the word
+     * selection of the original word-at-a-time loop and is kept so that the
+     * set of packets accepted does not change.
+     *
+     * Every word is summed little-endian, as le16_word_sum does, whatever the
+     * host's byte order; the result is swapped to the native order of th_sum.
      */
-    for(size_t i=8; i+1<sbuf.bufsize && len>0 ;i+=2){
-	if(i==40){			// reached the end of ipv6 header
-	    sum += ip6->ip6_plen;
-	    if(sum & 0x80000000){   /* if high order bit set, fold */
-		sum = (sum & 0xFFFF) + (sum >> 16);
-	    }
-
-	    /* putting the nxt pseudo header field in network-byte order via SHL(8) */
-	    sum += (uint16_t)(ip6->ip6_nxt << 8);			
-	    if(sum & 0x80000000){   /* if high order bit set, fold */
-		sum = (sum & 0xFFFF) + (sum >> 16);
-	    }
-	    len -= 8; 	    /* we've processed 8 octets in the pseudo header */
-	    octets_processed += 8;
-	} else {
-	    /* check if we are at the offset of the L3 chksum field*/
-	    if ((octets_processed != chksum_byteoffset)) {
-		sum += sbuf.get16u(i);
-		if(sum & 0x80000000){   /* if high order bit set, fold */
-		    sum = (sum & 0xFFFF) + (sum >> 16);
-		}
-	    }
-
-	    /* update len and octets_processed */
-	    len -= 2;
-	    octets_processed += 2;
-	}
-    }
-    while( (sum & 0xFFFF0000) > 0 ){
-	sum = (sum & 0xFFFF) + (sum >> 16);
+    const size_t wend = sbuf.bufsize & ~(size_t)1; // only whole words inside the buffer
+    uint64_t sum = le16_word_sum(sbuf.buf+8,32);
+    if(wend>=42){
+        sum += sbuf.buf[4] | (sbuf.buf[5]<<8);	// ip6_plen
+        /* the nxt pseudo header field is the second octet of its word */
+        sum += (uint16_t)(ip6->ip6_nxt << 8);
+
+        size_t plen = ntohs(ip6->ip6_plen);
+        size_t end  = 42 + ((plen+1) & ~(size_t)1);
+        if(end > wend) end = wend;
+        sum += le16_word_sum(sbuf.buf+42,end-42);
+
+        size_t skip = chksum_byteoffset+2;
+        if(skip>=42 && skip+2<=end) sum -= sbuf.buf[skip] | (sbuf.buf[skip+1]<<8);
     }
-
-    return ~sum;			// return the complement of the checksum
+    uint16_t r = fold_cksum(sum);
+#ifdef WORDS_BIGENDIAN
+    r = (uint16_t)((r>>8) | (r<<8));	// the sum was taken little-endian; th_sum is native
+#endif
+    return ~r;				// return the complement of the checksum
 }
 
-/* compute an Internet-style checksum, from Stevens */
-#  ifdef HAVE_DIAGNOSTIC_CAST_ALIGN
-#    pragma GCC diagnostic ignored "-Wcast-align"
-#  endif
+/* compute an Internet-style checksum, from Stevens.
+ * The checksum field itself (octets 10 and 11) is left out of the sum.
+ */
 static uint16_t cksum(const struct be13::ip4 * const ip, int len) 
 {
-    long  sum = 0;  /* assume 32 bit long, 16 bit short */
-    const uint16_t *ipp = (uint16_t *) ip;
-    int   octets_processed = 0;
-
-    while (len > 1) {
-        if (octets_processed != 10) {
-            sum += *ipp;
-            if(sum & 0x80000000){   /* if high order bit set, fold */
-                sum = (sum & 0xFFFF) + (sum >> 16);
-	    }
-        }
-        ipp++;
-        len -= 2;
-        octets_processed+=2;
-    }
-
-    if (len) sum += *ipp;     /* take care of left over byte */
-
-    while(sum>>16){
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    return ~sum;
+    const uint8_t *ipp = reinterpret_cast<const uint8_t *>(ip);
+    uint64_t sum = le16_word_sum(ipp,len);
+    if(len>=12) sum -= ipp[10] | (ipp[11]<<8);
+    uint16_t r = fold_cksum(sum);
+#ifdef WORDS_BIGENDIAN
+    r = (uint16_t)((r>>8) | (r<<8));	// the sum was taken little-endian; ip_sum is native
+#endif
+    return ~r;
 }
-#  ifdef HAVE_DIAGNOSTIC_CAST_ALIGN
-#    pragma GCC diagnostic warning "-Wcast-align"
-#  endif
 
 /* determine if an integer is a power of two; used for the TTL */
 static bool isPowerOfTwo(const uint8_t val) 
@@ -591,12 +611,116 @@ static bool   likely_valid_pcap_header(const sbuf_t &sbuf,struct pcap_hdr &h)
     return true;
 }
 
+/*
+ * Candidate prefilter.
+ *
+ * Every carver below rejects an offset on a handful of fixed bytes before it
+ * does any real work. net_candidate_at() tests those bytes for all of them at
+ * once; an offset that fails can't be carved and is skipped without building
+ * an sbuf for it. Each test is a necessary condition of the matching carver:
+ *   - pcap file:    magic d4 c3 b2 a1
+ *   - pcap record:  seconds between 1990 and 2020, useconds, cap_len and
+ *                   pkt_len high bytes zero
+ *   - ethernet:     ethertype 0x0800 or 0x86dd followed by 0x45 or 0x6_
+ *   - IPv4:         0x45, ip_off 0 or DF, TCP or UDP
+ *   - IPv6:         0x6_, next header TCP, UDP or ICMPv6
+ *   - sockaddr_in:  AF_INET in octet 0 or 1, sin_zero all zero
+ *   - _TCPT_OBJECT: pool_size 0x33.. and "T" of the signature
+ * The tests need 16 bytes; offsets closer than that to the end of the buffer
+ * are always passed through to the carvers.
+ */
+static const size_t NET_CANDIDATE_WINDOW = 16;
+
+static inline bool net_candidate_at(const uint8_t *b)
+{
+    if(b[0]==0xd4) return true;
+    if(b[3]>=0x25 && b[3]<=0x5e && (b[7]|b[10]|b[11]|b[14]|b[15])==0) return true;
+    if(((b[12]==0x08 && b[13]==0x00) || (b[12]==0x86 && b[13]==0xdd)) &&
+       (b[14]==0x45 || (b[14] & 0xF0)==0x60)) return true;
+    if(b[0]==0x45 && b[7]==0 && (b[6]==0 || b[6]==0x40) &&
+       (b[9]==IPPROTO_TCP || b[9]==IPPROTO_UDP)) return true;
+    if((b[0] & 0xF0)==0x60 &&
+       (b[6]==IPPROTO_TCP || b[6]==IPPROTO_UDP || b[6]==IPPROTO_ICMPV6)) return true;
+    if((b[0]==AF_INET || b[1]==AF_INET) &&
+       (b[8]|b[9]|b[10]|b[11]|b[12]|b[13]|b[14]|b[15])==0) return true;
+    if(b[2]==0x33 && b[4]==0x54) return true;
+    return false;
+}
+
+#ifdef __SSE2__
+static inline __m128i net_eq(const __m128i v,uint8_t c)
+{
+    return _mm_cmpeq_epi8(v,_mm_set1_epi8((char)c));
+}
+
+/* net_candidate_at() for the 16 offsets b..b+15; bit n is set if b+n is a candidate.
+ * Reads b[0..30].
+ */
+static uint32_t net_candidate_mask(const uint8_t *b)
+{
+    __m128i v[NET_CANDIDATE_WINDOW];
+    for(size_t k=0;k<NET_CANDIDATE_WINDOW;k++){
+        v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b+k));
+    }
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i hinib = _mm_set1_epi8((char)0xF0);
+
+    __m128i m = net_eq(v[0],0xd4);
+
+    __m128i secs = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v[3],_mm_set1_epi8(0x25)),v[3]),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(v[3],_mm_set1_epi8(0x5e)),v[3]));
+    __m128i hi = _mm_or_si128(_mm_or_si128(v[7],v[10]),_mm_or_si128(_mm_or_si128(v[11],v[14]),v[15]));
+    m = _mm_or_si128(m,_mm_and_si128(secs,_mm_cmpeq_epi8(hi,zero)));
+
+    __m128i etype = _mm_or_si128(_mm_and_si128(net_eq(v[12],0x08),net_eq(v[13],0x00)),
+                                 _mm_and_si128(net_eq(v[12],0x86),net_eq(v[13],0xdd)));
+    __m128i ipv   = _mm_or_si128(net_eq(v[14],0x45),net_eq(_mm_and_si128(v[14],hinib),0x60));
+    m = _mm_or_si128(m,_mm_and_si128(etype,ipv));
+
+    __m128i ip4 = _mm_and_si128(_mm_and_si128(net_eq(v[0],0x45),net_eq(v[7],0)),
+                                _mm_and_si128(_mm_or_si128(net_eq(v[6],0),net_eq(v[6],0x40)),
+                                              _mm_or_si128(net_eq(v[9],IPPROTO_TCP),net_eq(v[9],IPPROTO_UDP))));
+    m = _mm_or_si128(m,ip4);
+
+    __m128i ip6 = _mm_and_si128(net_eq(_mm_and_si128(v[0],hinib),0x60),
+                                _mm_or_si128(_mm_or_si128(net_eq(v[6],IPPROTO_TCP),net_eq(v[6],IPPROTO_UDP)),
+                                             net_eq(v[6],IPPROTO_ICMPV6)));
+    m = _mm_or_si128(m,ip6);
+
+    __m128i sin_zero = _mm_or_si128(_mm_or_si128(_mm_or_si128(v[8],v[9]),_mm_or_si128(v[10],v[11])),
+                                    _mm_or_si128(_mm_or_si128(v[12],v[13]),_mm_or_si128(v[14],v[15])));
+    __m128i sa = _mm_and_si128(_mm_or_si128(net_eq(v[0],AF_INET),net_eq(v[1],AF_INET)),
+                               _mm_cmpeq_epi8(sin_zero,zero));
+    m = _mm_or_si128(m,sa);
+
+    m = _mm_or_si128(m,_mm_and_si128(net_eq(v[2],0x33),net_eq(v[4],0x54)));
+    return (uint32_t)_mm_movemask_epi8(m);
+}
+#endif
+
+/* Return the first offset in [i,end) at which a carver might succeed, or end */
+static size_t next_net_candidate(const sbuf_t &sbuf,size_t i,size_t end)
+{
+    const uint8_t *b = sbuf.buf;
+#ifdef __SSE2__
+    while(i<end && i+2*NET_CANDIDATE_WINDOW<=sbuf.bufsize){
+        uint32_t m = net_candidate_mask(b+i);
+        if(m) return i+__builtin_ctz(m);
+        i += NET_CANDIDATE_WINDOW;
+    }
+#endif
+    for(;i<end;i++){
+        if(i+NET_CANDIDATE_WINDOW>sbuf.bufsize || net_candidate_at(b+i)) return i;
+    }
+    return end;
+}
+
 /*
  * Currently this will not write out a truncated packet.
  */
 class packet_carver {
 private:
-    packet_carver(const packet_carver &pc):fs(pc.fs),ps(pc.ps),ip_recorder(pc.ip_recorder),tcp_recorder(pc.tcp_recorder),ether_recorder(pc.ether_recorder){
+    packet_carver(const packet_carver &pc):fs(pc.fs),ps(pc.ps),ip_recorder(pc.ip_recorder),tcp_recorder(pc.tcp_recorder),ether_recorder(pc.ether_recorder),pcap_buf(){
     }
     packet_carver &operator=(const packet_carver &that){
 	return *this;			// no-op
@@ -610,7 +734,7 @@ public:
     feature_recorder *ether_recorder;
 
     packet_carver(const class scanner_params &sp):
-	fs(sp.fs),ps(),ip_recorder(0),tcp_recorder(0),ether_recorder(0){
+	fs(sp.fs),ps(),ip_recorder(0),tcp_recorder(0),ether_recorder(0),pcap_buf(){
 	ip_recorder = fs.get_name("ip");
 	tcp_recorder = fs.get_name("tcp");
 	ether_recorder = fs.get_name("ether");
@@ -620,50 +744,63 @@ private:
     /* 
      * According to 'man pcap-savefile', you need to implement this file format,
      * but there are no functions to do so.
+     *
+     * Packets are assembled in pcap_buf, which belongs to this carver and
+     * therefore to a single thread, and are handed to fcap in one block by
+     * pcap_flush(). M is only taken for that block write, not for every
+     * field of every packet.
      * 
      * pcap_write_bytes writes bytes; pcap accomidates.
      * pcap_write2 writes a 2-byte value in native byte order; pcap accomidates.
      * pcap_write4 writes a 4-byte value in native byte order; pcap accomidates.
      * pcap_writepkt writes a packet
      */
+    std::string pcap_buf;
     void pcap_write_bytes(const uint8_t * const val, size_t num_bytes) {
-        size_t count = fwrite(val,1,num_bytes,fcap);
-        if (count != num_bytes) {
-            err(1, "scanner scan_net is unable to write to file %s", default_filename);
-        }
+        pcap_buf.append(reinterpret_cast<const char *>(val),num_bytes);
     }
     void pcap_write2(const uint16_t val) {
-        size_t count = fwrite(&val,1,2,fcap);
-        if (count != 2) {
-            err(1, "scanner scan_net is unable to write to file %s", default_filename);
-        }
+        pcap_buf.append(reinterpret_cast<const char *>(&val),2);
     }
     void pcap_write4(const uint32_t val) {
-        size_t count = fwrite(&val,1,4,fcap);
-        if (count != 4) {
+        pcap_buf.append(reinterpret_cast<const char *>(&val),4);
+    }
+    static void pcap_fwrite(const void *val,size_t num_bytes) {
+        size_t count = fwrite(val,1,num_bytes,fcap);
+        if (count != num_bytes) {
             err(1, "scanner scan_net is unable to write to file %s", default_filename);
         }
     }
 
 public:
-    void pcap_writepkt(const struct pcap_hdr &h,
-		       const sbuf_t &sbuf,const size_t offset,
-                       const bool add_frame,
-                       const uint16_t frame_type) {
-	// Make sure that neither this packet nor an encapsulated version of this packet has been written
+    /* Write the buffered packets to fcap, creating it if necessary */
+    void pcap_flush() {
+        if(pcap_buf.size()==0) return;
 	cppmutex::lock lock(M);		// lock the mutex
         if(fcap==0){
             string ofn = ip_recorder->outdir+"/" + default_filename;
             fcap = fopen(ofn.c_str(),"wb"); // write the output
-            pcap_write4(0xa1b2c3d4);
-            pcap_write2(2);			// major version number
-            pcap_write2(4);			// minor version number
-            pcap_write4(0);			// time zone offset; always 0
-            pcap_write4(0);			// accuracy of time stamps in the file; always 0
-            pcap_write4(PCAP_MAX_PKT_LEN);	// snapshot length
-            pcap_write4(DLT_EN10MB);	// link layer encapsulation
+            if(fcap==0) err(1, "scanner scan_net is unable to open file %s", ofn.c_str());
+            const uint32_t magic = 0xa1b2c3d4;
+            const uint16_t major = 2;			// major version number
+            const uint16_t minor = 4;			// minor version number
+            const uint32_t fhdr[4] = {0,		// time zone offset; always 0
+                                      0,		// accuracy of time stamps in the file; always 0
+                                      PCAP_MAX_PKT_LEN,	// snapshot length
+                                      DLT_EN10MB};	// link layer encapsulation
+            pcap_fwrite(&magic,4);
+            pcap_fwrite(&major,2);
+            pcap_fwrite(&minor,2);
+            pcap_fwrite(fhdr,sizeof(fhdr));
         }
+        pcap_fwrite(pcap_buf.data(),pcap_buf.size());
+        pcap_buf.clear();
+    }
 
+    void pcap_writepkt(const struct pcap_hdr &h,
+		       const sbuf_t &sbuf,const size_t offset,
+                       const bool add_frame,
+                       const uint16_t frame_type) {
         size_t forged_header_len = 0;
 	/*
 	 * if requested, forge an Ethernet II header and prepend it to the packet so raw packets can
@@ -690,7 +827,13 @@ public:
         if(add_frame_and_safe) {
             pcap_write_bytes(forged_header, sizeof(forged_header));
         }
-        sbuf.write(fcap,offset,h.cap_len);	// the packet
+        /* the packet, clipped to the sbuf as sbuf_t::write() does */
+        if(offset < sbuf.bufsize){
+            size_t len = h.cap_len;
+            if(offset+len > sbuf.bufsize) len = sbuf.bufsize-offset;
+            pcap_write_bytes(sbuf.buf+offset,len);
+        }
+        if(pcap_buf.size() >= PCAP_FLUSH_SIZE) pcap_flush();
     }
 
     /**
@@ -975,9 +1118,11 @@ public:
 	 * If we find a pcap file or a packet at the present location,
 	 * don't bother with the remainder.
 	 *
-	 * Please remember that this is called for every byte, so it needs to be fast.
+	 * Please remember that this is called for every byte, so it needs to be fast;
+	 * offsets that fail the candidate prefilter are skipped without calling the carvers.
 	 */
-	for(u_int i=0 ; i<sbuf.pagesize && i<sbuf.bufsize;){
+	const size_t end = min(sbuf.pagesize,sbuf.bufsize);
+	for(size_t i=next_net_candidate(sbuf,0,end) ; i<end; i=next_net_candidate(sbuf,i,end)){
 	    const sbuf_t sb2 = sbuf+i;
 
             /* Look for a PCAPFile header */
@@ -1000,8 +1145,7 @@ public:
 	    }
 	    i += (carved>0 ? carved : 1);	// advance the pointer
 	}
-	cppmutex::lock lock(M);
-	if(fcap) fflush(fcap);
+	pcap_flush();
     };
 };
 
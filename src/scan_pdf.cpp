@@ -10,10 +10,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <algorithm>
+#include <vector>
 
 #define ZLIB_CONST
 #ifdef HAVE_DIAGNOSTIC_UNDEF
@@ -27,16 +30,76 @@
 using namespace std;
 static bool pdf_dump = false;
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Streams are inflated a chunk at a time and each chunk is handed to the
+ * text extractor, so a stream is never held decompressed in memory.
+ * Each thread keeps its chunk, text and tag buffers between calls. The
+ * buffers are in use while the text is being recursively scanned; a nested
+ * call (when the text itself has a stream) gets buffers of its own.
+ */
+static const size_t pdf_chunk_size = 65536;
+
+struct pdf_buffers {
+    pdf_buffers():chunk(pdf_chunk_size),text(),dump(),tags(),next_end(),in_use(false){}
+    std::vector<Bytef>  chunk;		// inflated data
+    std::string         text;		// extracted text, scanned in place
+    std::string         dump;		// the whole stream, for pdf_dump
+    std::vector<size_t> tags;		// offsets of "stream" in the sbuf
+    std::vector<size_t> next_end;	// see scan_streams()
+    bool in_use;
+};
+
+static pthread_key_t  pdf_buffers_key;
+static pthread_once_t pdf_buffers_once = PTHREAD_ONCE_INIT;
+
+static void pdf_buffers_free(void *arg)
+{
+    delete static_cast<pdf_buffers *>(arg);
+}
+
+static void pdf_buffers_init()
+{
+    pthread_key_create(&pdf_buffers_key,pdf_buffers_free);
+}
+
+static pdf_buffers *get_pdf_buffers()
+{
+    pthread_once(&pdf_buffers_once,pdf_buffers_init);
+    pdf_buffers *pb = static_cast<pdf_buffers *>(pthread_getspecific(pdf_buffers_key));
+    if(pb==0){
+        pb = new pdf_buffers();
+        pthread_setspecific(pdf_buffers_key,pb);
+    }
+    return pb;
+}
+
 /*
  * Return TRUE if most of the characters (90%) are printable ASCII.
+ * Counted a chunk at a time.
  */
 
-static bool mostly_printable_ascii(const unsigned char *buf,size_t bufsize)
+static bool printable_or_space[256];
+static struct printable_or_space_init {
+    printable_or_space_init() {
+	for(int ch=0;ch<256;ch++) printable_or_space[ch] = isprint(ch) || isspace(ch);
+    }
+} printable_or_space_init_;
+
+static size_t count_printable_ascii(const unsigned char *buf,size_t bufsize)
 {
     size_t count = 0;
     for(const unsigned char *cc = buf; cc<buf+bufsize;cc++){
-	if(isprint(*cc) || isspace(*cc)) count++;
+	count += printable_or_space[*cc];
     }
+    return count;
+}
+
+static bool mostly_printable_ascii(size_t count,size_t bufsize)
+{
     return count > (bufsize*9/10);
 }
 
@@ -57,98 +120,186 @@ static bool mostly_printable_ascii(const unsigned char *buf,size_t bufsize)
  *
  * Spaces are always added between arrays [foo].
  * So we just put a space between them all and hope.
+ *
+ * The text is extracted in one pass as the stream is inflated. A space is
+ * put after every word until a word with a space is seen; as every word up
+ * to then had no spaces, the spaces in the text are exactly the ones that
+ * were put there, and they are taken out again.
  */
- 
-static void pdf_extract_text(std::string &tbuf,const unsigned char *buf,size_t bufsize)
-{
-    //const int CHUNKSIZE = 10;
-    int maxwordsize = 0;
-    bool words_have_spaces = false;
-    for(int pass=0;pass<2;pass++){
-        /* pass = 0 --- analysis. Find maxwordsize
-         * pass = 1 --- creation.
-         */
-        bool in_paren = false;
-        int  wordsize = 0;
-        for(const unsigned char *cc = buf;cc<buf+bufsize;cc++){
-            if(in_paren==false && *cc=='[') {
-                /* Beginning of bracket group not in paren; ignore */
-                continue;
-            }
-            if(in_paren==false && *cc==']') {
-                /* End of bracket group not in paren; ignore */
-                continue;
-            }
-            if(in_paren==false && *cc=='(') {
-                /* beginning of word */
-                wordsize = 0;
+
+class pdf_text_extractor {
+public:
+    pdf_text_extractor(std::string &tbuf_):tbuf(tbuf_),in_paren(false),words_have_spaces(false){
+        tbuf.clear();
+    }
+    void add(const unsigned char *buf,size_t bufsize){
+        const unsigned char *end = buf+bufsize;
+        const unsigned char *cc  = buf;
+        while(cc<end){
+            if(in_paren==false){
+                /* Brackets not in parens are ignored; look for the beginning of a word */
+                const unsigned char *open = static_cast<const unsigned char *>(memchr(cc,'(',end-cc));
+                if(open==0) return;
                 in_paren = true;
+                cc = open+1;
                 continue;
             }
-            if(in_paren==true &&  *cc==')') {
-                /* end of word */
-                in_paren = false;
-                if(pass==0 && (wordsize > maxwordsize))  maxwordsize = wordsize;
-                if(pass==1 && (words_have_spaces==false)){
-                    /* Second pass; words don't have spaces, so add spaces between the parens */
-                    tbuf.push_back(' ');
-                }
-                continue;
-            }
-            if(in_paren){
-                /* in a word */
-                if(*cc==' ') words_have_spaces = true;
-                if(pass==1) tbuf.push_back(*cc);
-                wordsize+=1;
+            /* in a word; copy to the end of it */
+            const unsigned char *close = static_cast<const unsigned char *>(memchr(cc,')',end-cc));
+            const unsigned char *stop  = close ? close : end;
+            if(words_have_spaces==false && memchr(cc,' ',stop-cc)){
+                words_have_spaces = true;
+                tbuf.erase(std::remove(tbuf.begin(),tbuf.end(),' '),tbuf.end());
             }
+            tbuf.append(reinterpret_cast<const char *>(cc),stop-cc);
+            if(close==0) return;
+            /* end of word */
+            in_paren = false;
+            if(words_have_spaces==false) tbuf.push_back(' ');
+            cc = close+1;
         }
     }
+private:
+    pdf_text_extractor(const pdf_text_extractor &);
+    pdf_text_extractor &operator=(const pdf_text_extractor &);
+    std::string &tbuf;
+    bool in_paren;
+    bool words_have_spaces;
+};
+
+/* Find every "stream" in the sbuf, including the ones in "endstream" */
+static void find_stream_tags(const sbuf_t &sbuf,std::vector<size_t> &tags)
+{
+    static const char tag[] = "stream";
+    const size_t taglen = 6;
+    tags.clear();
+    if(sbuf.bufsize<taglen) return;
+    const uint8_t *buf = sbuf.buf;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i s = _mm_set1_epi8('s');
+    const __m128i t = _mm_set1_epi8('t');
+    for(;i+17<=sbuf.bufsize;i+=16){
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(buf+i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(buf+i+1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0,s),_mm_cmpeq_epi8(v1,t)));
+        while(mask){
+            int bit = __builtin_ctz(mask);
+            mask &= mask-1;
+            if(i+bit+taglen<=sbuf.bufsize && memcmp(buf+i+bit,tag,taglen)==0) tags.push_back(i+bit);
+        }
+    }
+#endif
+    for(;i+taglen<=sbuf.bufsize;i++){
+        if(buf[i]=='s' && memcmp(buf+i,tag,taglen)==0) tags.push_back(i);
+    }
 }
 
-inline int analyze_stream(const class scanner_params &sp,const recursion_control_block &rcb,
-                          size_t stream_tag,size_t stream_start,size_t endstream)
+static void analyze_stream(const class scanner_params &sp,const recursion_control_block &rcb,
+                           size_t stream_tag,size_t stream_start,size_t endstream,pdf_buffers &pb)
 {
     const sbuf_t &sbuf = sp.sbuf;
     size_t compr_size = endstream-stream_start;
     size_t uncompr_size = compr_size * 8;       // good assumption for expansion
-    managed_malloc<Bytef>decomp(uncompr_size);
-    if(decomp.buf){
-        z_stream zs;
-        memset(&zs,0,sizeof(zs));
-        zs.next_in = (Bytef *)sbuf.buf+stream_start;
-        zs.avail_in = compr_size;
-        zs.next_out = decomp.buf;
-        zs.avail_out = uncompr_size;
-        int r = inflateInit(&zs);
-        if(r==Z_OK){
-            r = inflate(&zs,Z_FINISH);
-            if(zs.total_out>0){
-                sbuf_t dbuf(sbuf.pos0 + "-PDFDECOMP",
-                            decomp.buf,zs.total_out,zs.total_out,0,
-                            false,false,false);
-                if(pdf_dump){
-                    std::cout << "====== " << dbuf.pos0 << "=====\n";
-                    dbuf.hex_dump(std::cout);
-                    std::cout << "\n";
-                }
-                if(mostly_printable_ascii(decomp.buf,zs.total_out)){
-                    std::string text;
-                    pdf_extract_text(text,decomp.buf,zs.total_out);
-                    if(text.size()>0){
-                        pos0_t pos0_pdf    = (sbuf.pos0 + stream_tag) + rcb.partName;
-                        const  sbuf_t sbuf_new(pos0_pdf, reinterpret_cast<const uint8_t *>(&text[0]),
-                                               text.size(),text.size(),false);
-                        (*rcb.callback)(scanner_params(sp,sbuf_new));
-                    }
-                    if(pdf_dump) std::cout << "Extracted Text:\n" << text << "\n";
-                }
-                if(pdf_dump){
-                    std::cout << "================\n";
-                }
+
+    z_stream zs;
+    memset(&zs,0,sizeof(zs));
+    zs.next_in = (Bytef *)sbuf.buf+stream_start;
+    zs.avail_in = compr_size;
+    if(inflateInit(&zs)!=Z_OK) return;
+
+    pdf_text_extractor extractor(pb.text);
+    size_t printable = 0;
+    if(pdf_dump) pb.dump.clear();
+    while(zs.total_out < uncompr_size){
+        size_t want = min(pb.chunk.size(),uncompr_size-zs.total_out);
+        zs.next_out  = &pb.chunk[0];
+        zs.avail_out = want;
+        int r = inflate(&zs,Z_NO_FLUSH);
+        size_t got = want - zs.avail_out;
+        if(got>0){
+            printable += count_printable_ascii(&pb.chunk[0],got);
+            extractor.add(&pb.chunk[0],got);
+            if(pdf_dump) pb.dump.append(reinterpret_cast<const char *>(&pb.chunk[0]),got);
+        }
+        if(r!=Z_OK) break;		// end of stream, bad data, or no more input
+    }
+    size_t total_out = zs.total_out;
+    inflateEnd(&zs);
+
+    if(total_out>0){
+        if(pdf_dump){
+            sbuf_t dbuf(sbuf.pos0 + "-PDFDECOMP",
+                        reinterpret_cast<const uint8_t *>(pb.dump.data()),pb.dump.size(),pb.dump.size(),0,
+                        false,false,false);
+            std::cout << "====== " << dbuf.pos0 << "=====\n";
+            dbuf.hex_dump(std::cout);
+            std::cout << "\n";
+        }
+        if(mostly_printable_ascii(printable,total_out)){
+            const std::string &text = pb.text;
+            if(text.size()>0){
+                pos0_t pos0_pdf    = (sbuf.pos0 + stream_tag) + rcb.partName;
+                const  sbuf_t sbuf_new(pos0_pdf, reinterpret_cast<const uint8_t *>(text.data()),
+                                       text.size(),text.size(),false);
+                (*rcb.callback)(scanner_params(sp,sbuf_new));
             }
+            if(pdf_dump) std::cout << "Extracted Text:\n" << text << "\n";
+        }
+        if(pdf_dump){
+            std::cout << "================\n";
         }
     }
-    return 0;
+}
+
+/* Find the streams in the sbuf and analyze each one */
+static void scan_streams(const class scanner_params &sp,const recursion_control_block &rcb,pdf_buffers &pb)
+{
+    const sbuf_t &sbuf = sp.sbuf;
+    std::vector<size_t> &tags = pb.tags;
+    find_stream_tags(sbuf,tags);
+
+    /* next_end[k] is the index of the first tag at or after k that is in an "endstream" */
+    std::vector<size_t> &next_end = pb.next_end;
+    next_end.assign(tags.size()+1,tags.size());
+    for(size_t k=tags.size();k>0;k--){
+        size_t tag = tags[k-1];
+        next_end[k-1] = (tag>=3 && memcmp(sbuf.buf+tag-3,"end",3)==0) ? k-1 : next_end[k];
+    }
+
+    size_t t = 0;			// index of the first tag at or after loc
+    for(size_t loc=0;loc+15<sbuf.pagesize;loc++){
+        while(t<tags.size() && tags[t]<loc) t++;
+        if(t==tags.size()) break;
+        size_t stream_tag = tags[t];
+        /* Now skip past the \r or \r\n or \n */
+        size_t stream_start = stream_tag+6;
+        if(sbuf[stream_start]=='\r' && sbuf[stream_start+1]=='\n') stream_start+=2;
+        else stream_start +=1;
+
+        /* See if we can find the endstream; here we can scan to the end of the buffer.
+         * Also, make sure that the endstream comes before the next stream. This is easily
+         * determined by doing a search for 'stream' and 'endstream' and making sure that
+         * the next 'stream' we find is, in fact, in the 'endsream'.
+         */
+        size_t n = t;
+        while(n<tags.size() && tags[n]<stream_start) n++;
+        size_t e = next_end[n];
+        while(e<tags.size() && tags[e]<stream_start+3) e = next_end[e+1]; // "end" must follow stream_start
+        if(e==tags.size()) break;	// no endstream tag
+        size_t endstream  = tags[e]-3;
+        size_t nextstream = tags[n];
+
+        if(endstream+3!=nextstream){
+            /* The 'stream' after the stream_tag is not the 'endstream',
+             * so advance loc so that it will find the nextstream
+             */
+            loc = nextstream - 1;
+            continue;
+        }
+        analyze_stream(sp,rcb,stream_tag,stream_start,endstream,pb);
+        loc=endstream+9;
+    }
 }
 
 
@@ -168,40 +319,21 @@ void scan_pdf(const class scanner_params &sp,const recursion_control_block &rcb)
     }
     if(sp.phase==scanner_params::PHASE_SHUTDOWN) return;
     if(sp.phase==scanner_params::PHASE_SCAN){
-
-	const sbuf_t &sbuf = sp.sbuf;
-
-	/* Look for signature for the beginning of a PDF stream */
-	for(size_t loc=0;loc+15<sbuf.pagesize;loc++){
-	    ssize_t stream_tag = sbuf.find("stream",loc);
-	    if(stream_tag==-1) break;   
-	    /* Now skip past the \r or \r\n or \n */
-	    size_t stream_start = stream_tag+6;
-	    if(sbuf[stream_start]=='\r' && sbuf[stream_start+1]=='\n') stream_start+=2;
-	    else stream_start +=1;
-
-	    /* See if we can find the endstream; here we can scan to the end of the buffer.
-	     * Also, make sure that the endstream comes before the next stream. This is easily
-	     * determined by doing a search for 'stream' and 'endstream' and making sure that
-	     * the next 'stream' we find is, in fact, in the 'endsream'.
-	     */
-	    ssize_t endstream = sbuf.find("endstream",stream_start);
-	    if(endstream==-1) break;    // no endstream tag
-
-	    ssize_t nextstream = sbuf.find("stream",stream_start);
-
-	    if(endstream+3!=nextstream){
-                /* The 'stream' after the stream_tag is not the 'endstream',
-                 * so advance loc so that it will find the nextstream
-                 */
-                loc = nextstream - 1;
-                continue;
-            }
-            if(analyze_stream(sp,rcb,stream_tag,stream_start,endstream)==-1){
-                return;
-            }
-            loc=endstream+9;
-	}
+        pdf_buffers *pb = get_pdf_buffers();
+        if(pb->in_use){
+            pdf_buffers nested;
+            nested.in_use = true;
+            scan_streams(sp,rcb,nested);
+            return;
+        }
+        pb->in_use = true;
+        try {
+            scan_streams(sp,rcb,*pb);
+        }
+        catch (...) {
+            pb->in_use = false;
+            throw;
+        }
+        pb->in_use = false;
     }
 }
-
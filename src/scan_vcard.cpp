@@ -79,7 +79,7 @@ void scan_vcard(const class scanner_params &sp,const recursion_control_block &rc
 			valid=false;
 		    }
 		}
-		/* We should probably validate the UTF-8. */
+		/* Bytes 0x80 and above are allowed, so that vCard 2.1 cards in ISO-8859-1 or CP1252 are carved */
 		if(valid){
 		    /* got a valid card; I can carve it! */
 		    vcard_recorder->carve(sbuf,begin,(end-begin)+end_len,hasher);
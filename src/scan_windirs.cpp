@@ -240,6 +240,31 @@ fat_validation_t valid_fat_directory_entry(const sbuf_t &sbuf)
 }
 
 
+/**
+ * Quick test of the first 32-byte record of a sector, made on the raw bytes.
+ * scan_fatdirs reports nothing for a sector unless its first record is a
+ * valid dentry or LFN entry, and these are necessary conditions for that:
+ * the attribute byte has no bits above FATFS_ATTR_ALL, and either the LFN
+ * sequence and reserved fields are plausible or the 8.3 name characters are.
+ * Almost every sector of file content fails on the attribute byte.
+ */
+static bool fat_sector_candidate(const uint8_t *rec)
+{
+    const uint8_t attrib = rec[11];
+    if((attrib & ~FATFS_ATTR_ALL) != 0) return false;
+    if(attrib == FATFS_ATTR_LFN){
+	return (rec[0] & ~0x40) <= 10 && rec[12]==0 && rec[26]==0 && rec[27]==0;
+    }
+    if(rec[0]=='.') return true;	// "." and ".." are checked by valid_fat_dentry_name
+    for(int i=0;i<8;i++){
+	if(!FATFS_IS_83_NAME(rec[i])) return false;
+    }
+    for(int i=8;i<11;i++){
+	if(!FATFS_IS_83_EXT(rec[i])) return false;
+    }
+    return true;
+}
+
 void scan_fatdirs(const sbuf_t &sbuf,feature_recorder *wrecorder)
 {
     /* 
@@ -248,10 +273,12 @@ void scan_fatdirs(const sbuf_t &sbuf,feature_recorder *wrecorder)
      */
     
     for(size_t base = 0;base<sbuf.pagesize;base+=512){
-	sbuf_t sector(sbuf,base,512);
-	if(sector.bufsize < 512){
+	if(base+512 > sbuf.bufsize){
 	    return;			// no space left
 	}
+	if(!fat_sector_candidate(sbuf.buf+base)) continue;
+
+	sbuf_t sector(sbuf,base,512);
 
 	int last_valid_entry_number = -1;
 	int ret1_count = 0;
@@ -329,11 +356,14 @@ void scan_fatdirs(const sbuf_t &sbuf,feature_recorder *wrecorder)
 void scan_ntfsdirs(const sbuf_t &sbuf,feature_recorder *wrecorder)
 {
     for(size_t base = 0;base<sbuf.pagesize;base+=512){
-	sbuf_t n(sbuf,base,1024);
-	std::string filename;
-	if(n.bufsize!=1024){
+	/* Check the magic number on the raw bytes before making an sbuf for the entry */
+	if(base+1024 > sbuf.bufsize){
 	    continue;	// no space
 	}
+	if(fat32int(sbuf.buf+base)!=NTFS_MFT_MAGIC) continue;
+
+	sbuf_t n(sbuf,base,1024);
+	std::string filename;
 	try{
 	    if(n.get32u(0)==NTFS_MFT_MAGIC){ // NFT magic number matches
 		if(debug & DEBUG_INFO) n.hex_dump(std::cerr);
@@ -2,13 +2,184 @@
  * scan_xor: optimistically search for features trivially obfuscated with xor
  * author:   Michael Shick <mfshick@nps.edu>
  * created:  2013-03-18
+ *
+ * Each mask in xor_masks gives a decoded view of the sbuf. The scanners are
+ * only run on a view that looks like it holds features: one with a block
+ * that is mostly text, or with the signature of a file format we recurse into.
+ * Both tests are made on the encoded sbuf, so a view that fails them is never
+ * decoded.
+ *
+ * The view of xor_mask is given the path part XOR, as before; the view of any
+ * other mask names its mask, as in XOR(0x5a), so that the path can be decoded.
  */
 #include "config.h"
 #include "bulk_extractor_i.h"
 
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 static uint8_t xor_mask = 255;
+static string xor_masks = "";		// comma-separated; empty means just xor_mask
+static uint32_t xor_min_text = 75;	// percent of a block that must decode to text; 0 recurses always
+
+static vector<uint8_t> masks;		// from xor_masks, without the identity mask
+
+static const size_t text_block_size = 4096;
+static const size_t text_block_min  = 256; // a shorter tail is not tested
+static const int text_min_distinct  = 16;
+static const uint32_t text_min_space = 128;	// at least one byte in this many is a space or newline
+
+/* Decoded signatures that are worth a recursive scan */
+struct xor_signature {
+    const char *bytes;
+    size_t len;
+};
+static const xor_signature signatures[] = {
+    {"PK\003\004",4},			// zip
+    {"%PDF",4},
+    {"\037\213\010\000",4},		// gzip, no flags
+    {"\037\213\010\010",4},		// gzip, with a file name
+    {"\377\330\377\340",4},		// JPEG/JFIF
+    {"\377\330\377\341",4},		// JPEG/Exif
+    {"http",4},
+    {"<?xm",4},
+    {"Rar!",4},
+};
+static const size_t signature_count = sizeof(signatures)/sizeof(signatures[0]);
+
+static bool parse_masks(const string &str,vector<uint8_t> &out)
+{
+    out.clear();
+    if(str.size()==0){
+        if(xor_mask!=0x00) out.push_back(xor_mask);
+        return true;
+    }
+    size_t start = 0;
+    while(start<=str.size()){
+        size_t comma = str.find(',',start);
+        if(comma==string::npos) comma = str.size();
+        string tok = str.substr(start,comma-start);
+        char *end = 0;
+        long val = strtol(tok.c_str(),&end,0);	// decimal, or hex with 0x
+        if(tok.size()==0 || *end!='\0' || val<0 || val>255) return false;
+        // 0x00 is 8-bit xor identity
+        if(val!=0 && find(out.begin(),out.end(),(uint8_t)val)==out.end()) out.push_back((uint8_t)val);
+        start = comma+1;
+    }
+    return true;
+}
+
+/* The path part of the view of mask */
+static string mask_part(const string &name,uint8_t mask)
+{
+    if(mask==xor_mask) return name;
+    char buf[8];
+    snprintf(buf,sizeof(buf),"(0x%02x)",mask);
+    return name + buf;
+}
+
+/* The mask of a path part made by mask_part() */
+static bool part_mask(const string &part,uint8_t &mask)
+{
+    size_t open = part.find('(');
+    if(open==string::npos){
+        mask = xor_mask;
+        return true;
+    }
+    char *end = 0;
+    long val = strtol(part.c_str()+open+1,&end,0);
+    if(*end!=')' || val<0 || val>255) return false;
+    mask = (uint8_t)val;
+    return true;
+}
+
+static inline bool is_text(int ch)
+{
+    return (ch>=0x20 && ch<0x7f) || ch=='\t' || ch=='\n' || ch=='\r';
+}
+
+/* For each mask, decide whether its view of sbuf is likely to hold features */
+static void prefilter(const sbuf_t &sbuf,vector<bool> &likely)
+{
+    likely.assign(masks.size(),xor_min_text==0);
+    size_t remaining = xor_min_text==0 ? 0 : masks.size();
+
+    /* Signatures: look for each one as it would be encoded by each mask */
+    uint8_t first[256];			// encoded first bytes of a signature
+    memset(first,0,sizeof(first));
+    for(size_t m=0;m<masks.size();m++){
+        for(size_t s=0;s<signature_count;s++){
+            first[(uint8_t)signatures[s].bytes[0] ^ masks[m]] = 1;
+        }
+    }
+    for(size_t i=0;i<sbuf.bufsize && remaining>0;i++){
+        if(first[sbuf.buf[i]]==0) continue;
+        for(size_t m=0;m<masks.size();m++){
+            if(likely[m]) continue;
+            for(size_t s=0;s<signature_count;s++){
+                const xor_signature &sig = signatures[s];
+                if(i+sig.len>sbuf.bufsize) continue;
+                size_t j=0;
+                while(j<sig.len && (sbuf.buf[i+j]^masks[m])==(uint8_t)sig.bytes[j]) j++;
+                if(j==sig.len){
+                    likely[m] = true;
+                    remaining--;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Text density: one histogram of each block serves every mask.
+     * UTF-16 text is half NULs, so NULs count as text up to the number of text bytes.
+     * Text also has spaces or newlines, which tells it from text under a nearby mask,
+     * and a variety of bytes, which tells it from a fill pattern.
+     */
+    for(size_t start=0;start<sbuf.bufsize && remaining>0;start+=text_block_size){
+        size_t len = min(text_block_size,sbuf.bufsize-start);
+        if(len<text_block_min) break;
+        uint32_t hist[256];
+        memset(hist,0,sizeof(hist));
+        for(size_t i=0;i<len;i++) hist[sbuf.buf[start+i]]++;
+        int distinct = 0;			// the same under every mask
+        for(int ch=0;ch<256;ch++) if(hist[ch]) distinct++;
+        if(distinct<text_min_distinct) continue;
+        for(size_t m=0;m<masks.size();m++){
+            if(likely[m]) continue;
+            uint8_t mask = masks[m];
+            uint32_t text = 0;
+            for(int ch=0;ch<256;ch++){
+                if(is_text(ch)) text += hist[ch ^ mask];
+            }
+            uint32_t space = hist[' '^mask] + hist['\n'^mask];
+            uint32_t nul = hist[mask];
+            text += min(nul,text);
+            if(text*100 >= xor_min_text*len && space*text_min_space >= len){
+                likely[m] = true;
+                remaining--;
+            }
+        }
+    }
+}
+
+static void xor_decode(uint8_t *dst,const uint8_t *src,size_t len,uint8_t mask)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i m = _mm_set1_epi8(mask);
+    for(;i+16<=len;i+=16){
+        _mm_storeu_si128((__m128i *)(dst+i),_mm_xor_si128(_mm_loadu_si128((const __m128i *)(src+i)),m));
+    }
+#endif
+    for(;i<len;i++){
+        dst[i] = src[i] ^ mask;
+    }
+}
 
 extern "C"
 void scan_xor(const class scanner_params &sp,const recursion_control_block &rcb)
@@ -21,17 +192,43 @@ void scan_xor(const class scanner_params &sp,const recursion_control_block &rcb)
 	sp.info->description = "optimistic XOR deobfuscator";
 	sp.info->flags = scanner_info::SCANNER_DISABLED | scanner_info::SCANNER_RECURSE;
         sp.info->get_config("xor_mask",&xor_mask,"XOR mask string, in decimal");
+        sp.info->get_config("xor_masks",&xor_masks,"XOR masks to try, comma-separated, in decimal or 0x hex (default xor_mask)");
+        sp.info->get_config("xor_min_text",&xor_min_text,"Percent of a 4KiB block that must decode to text for a recursive scan (0 always scans)");
 	return;
     }
+    if(sp.phase==scanner_params::PHASE_INIT) {
+        if(!parse_masks(xor_masks,masks)){
+            std::cerr << "Error.  Value '" << xor_masks << "' for parameter 'xor_masks' is invalid.\n"
+                      << "Cannot continue.\n";
+            exit(1);
+        }
+        return;
+    }
     if(sp.phase==scanner_params::PHASE_SCAN) {
 	const sbuf_t &sbuf = sp.sbuf;
 	const pos0_t &pos0 = sp.sbuf.pos0;
 
+        /* Printing a path: rcb.partName is the path part, which gives the mask */
+        if(scanner_params::getPrintMode(sp.print_options)!=scanner_params::MODE_NONE){
+            uint8_t mask = 0;
+            if(!part_mask(rcb.partName,mask)) return;
+            managed_malloc<uint8_t>dbuf(sbuf.bufsize);
+            if(!dbuf.buf) return;
+            xor_decode(dbuf.buf,sbuf.buf,sbuf.bufsize,mask);
+            const sbuf_t child_sbuf(pos0 + rcb.partName, dbuf.buf, sbuf.bufsize, sbuf.pagesize, false);
+            (*rcb.callback)(scanner_params(sp, child_sbuf));
+            return;
+        }
+
         // dodge infinite recursion by refusing to operate on an XOR'd buffer
-        if(rcb.partName == pos0.lastAddedPart()) {
+        if(pos0.lastAddedPart().compare(0,rcb.partName.size(),rcb.partName)==0) {
             return;
         }
 
+        vector<bool> likely;
+        prefilter(sbuf,likely);
+        if(find(likely.begin(),likely.end(),true)==likely.end()) return;
+
         managed_malloc<uint8_t>dbuf(sbuf.bufsize);
 
         if(!dbuf.buf){
@@ -39,13 +236,11 @@ void scan_xor(const class scanner_params &sp,const recursion_control_block &rcb)
             //zip_recorder->write(pos0+pos,name,ss.str());
             return;
         }
-        
-        // 0x00 is 8-bit xor identity
-        if(xor_mask != 0x00) {
-            for(size_t ii = 0; ii < sbuf.bufsize; ii++) {
-                dbuf.buf[ii] = sbuf.buf[ii] ^ xor_mask;
-            }
-            const pos0_t pos0_xor = pos0 + rcb.partName;
+
+        for(size_t m=0;m<masks.size();m++){
+            if(!likely[m]) continue;
+            xor_decode(dbuf.buf,sbuf.buf,sbuf.bufsize,masks[m]);
+            const pos0_t pos0_xor = pos0 + mask_part(rcb.partName,masks[m]);
             const sbuf_t child_sbuf(pos0_xor, dbuf.buf, sbuf.bufsize, sbuf.pagesize, false);
             scanner_params child_params(sp, child_sbuf);
             (*rcb.callback)(child_params);// call scanners on deobfuscated buffer
@@ -2,6 +2,7 @@
 #include "bulk_extractor_i.h"
 #include "dfxml/src/dfxml_writer.h"
 #include "utf8.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,7 @@ static uint32_t  zip_max_uncompr_size = 256*1024*1024; // don't decompress objec
 static uint32_t  zip_min_uncompr_size = 6;	// don't bother with objects smaller than this
 static uint32_t  zip_name_len_max = 1024;
 const uint32_t   MIN_ZIP_SIZE = 38;     // minimum size of a zip header and file name
+static const uint16_t trace_inflate = trace::intern("zip:inflate","decompress");
 
 /* These are to eliminate compiler warnings */
 #define ZLIB_CONST
@@ -144,7 +146,10 @@ inline void scan_zip_component(const class scanner_params &sp,const recursion_co
 		
         int r = inflateInit2(&zs,-15);
         if(r==0){
-            r = inflate(&zs,Z_SYNC_FLUSH);
+            {
+                trace::scope ts(trace_inflate,(pos0+pos).offset,sp.depth);
+                r = inflate(&zs,Z_SYNC_FLUSH);
+            }
             xmlstream << "<disposition bytes='" << zs.total_out << "'>decompressed</disposition></zipinfo>";
             zip_recorder->write(pos0+pos,name,xmlstream.str());
 
@@ -0,0 +1,128 @@
+/**
+ * scanner_stats.cpp:
+ * Wrap the enabled scanners to count their calls and time, and to trace them.
+ * See scanner_stats.h.
+ */
+
+#include "config.h"
+#include "bulk_extractor_i.h"
+#include "scanner_stats.h"
+#include "trace.h"
+
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <iostream>
+
+/****************************************************************
+ *** A scanner is called through a plain function pointer, so each
+ *** wrapped scanner gets its own instance of wrapped_scanner<N>,
+ *** which calls the real scanner and keeps its stats in slots[N].
+ ****************************************************************/
+
+struct scanner_slot {
+    scanner_t      *scanner;		// the real scanner
+    std::string     name;
+    uint16_t        trace_name;
+    pthread_mutex_t M;			// protects the following
+    uint64_t        calls;
+    double          seconds;
+};
+
+static const int max_wrapped_scanners = 128;
+static scanner_slot slots[max_wrapped_scanners];
+static int          wrapped_count = 0;	// set before the workers start
+
+/* Seconds on the monotonic clock if there is one, as trace.cpp times its events */
+static inline double now()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC,&ts)==0) return (double)ts.tv_sec + (double)ts.tv_nsec/1000000000.0;
+#endif
+    struct timeval tv;
+    gettimeofday(&tv,0);
+    return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/* Adds the time until it is destroyed to a slot, so that a scanner that throws is counted */
+class slot_timer {
+    slot_timer(const slot_timer &);
+    slot_timer &operator=(const slot_timer &);
+    scanner_slot &slot;
+    const double t0;
+public:
+    slot_timer(scanner_slot &slot_):slot(slot_),t0(now()){}
+    ~slot_timer(){
+        double t = now() - t0;
+        if(t<0) t = 0;			// the time of day stepped back
+        pthread_mutex_lock(&slot.M);
+        slot.calls++;
+        slot.seconds += t;
+        pthread_mutex_unlock(&slot.M);
+    }
+};
+
+template <int N>
+static void wrapped_scanner(const scanner_params &sp,const recursion_control_block &rcb)
+{
+    scanner_slot &slot = slots[N];
+    if(sp.phase==scanner_params::PHASE_SCAN){
+        slot_timer t(slot);
+        trace::scope s(slot.trace_name,sp.sbuf.pos0.offset,sp.depth);
+        (*slot.scanner)(sp,rcb);
+    } else {
+        (*slot.scanner)(sp,rcb);
+    }
+}
+
+template <int N>
+struct wrapped_scanner_table {
+    static void fill(scanner_t **t){
+        t[N-1] = wrapped_scanner<N-1>;
+        wrapped_scanner_table<N-1>::fill(t);
+    }
+};
+template <>
+struct wrapped_scanner_table<0> {
+    static void fill(scanner_t **){}
+};
+
+void scanner_stats::wrap_scanners()
+{
+    if(wrapped_count>0) return;		// already wrapped
+    scanner_t *table[max_wrapped_scanners];
+    wrapped_scanner_table<max_wrapped_scanners>::fill(table);
+    int n = 0;
+    for(be13::plugin::scanner_vector::const_iterator it = be13::plugin::current_scanners.begin();
+        it!=be13::plugin::current_scanners.end();it++){
+        if(!(*it)->enabled) continue;
+        if(n==max_wrapped_scanners){
+            std::cerr << "scanner_stats: only the first " << max_wrapped_scanners << " scanners are counted and traced\n";
+            break;
+        }
+        scanner_slot &slot = slots[n];
+        if(pthread_mutex_init(&slot.M,NULL)) errx(1,"scanner_stats: pthread_mutex_init failed");
+        slot.scanner    = (*it)->scanner;
+        slot.name       = (*it)->info.name;
+        slot.trace_name = trace::intern(slot.name,"scanner");
+        slot.calls      = 0;
+        slot.seconds    = 0;
+        (*it)->scanner  = table[n];
+        n++;
+    }
+    wrapped_count = n;
+}
+
+void scanner_stats::get_stats(void *user,feature_recorder_set::stat_callback_t stat_callback)
+{
+    for(int i=0;i<wrapped_count;i++){
+        scanner_slot &slot = slots[i];
+        pthread_mutex_lock(&slot.M);
+        uint64_t calls  = slot.calls;
+        double seconds  = slot.seconds;
+        pthread_mutex_unlock(&slot.M);
+        (*stat_callback)(user,slot.name,calls,seconds);
+    }
+}
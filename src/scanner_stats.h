@@ -0,0 +1,27 @@
+#ifndef SCANNER_STATS_H
+#define SCANNER_STATS_H
+
+/**
+ * \file
+ * Per-scanner calls and time that can be read while the scanners run.
+ *
+ * feature_recorder_set::get_stats() walks a map that the workers insert
+ * into, so it can only be read once the workers are idle. Instead, each
+ * enabled scanner is called through a wrapper that counts its calls and
+ * time under a lock of its own, and records it in the trace if tracing
+ * is enabled. A scanner's time includes the time of the scanners it
+ * calls on the buffers it decodes, as in report.xml's scanner_times.
+ */
+
+#include "bulk_extractor_i.h"
+
+class scanner_stats {
+public:
+    /* Wrap each enabled scanner; call once the scanners are enabled and before phase 1 */
+    static void wrap_scanners();
+
+    /* Call stat_callback with the calls and seconds of each wrapped scanner; threadsafe */
+    static void get_stats(void *user,feature_recorder_set::stat_callback_t stat_callback);
+};
+
+#endif
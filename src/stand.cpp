@@ -1,12 +1,18 @@
 /**
  *
  * ABOUT:
- *	A standalone program debug scanner. Compile in the scanner you want.
+ *	A standalone program to debug and benchmark scanners.
+ *	All of the built-in scanners are compiled in; plug-ins are loaded with -P.
  *
+ *	stand [options] file           - run the enabled scanners once over file
+ *	stand -B [options] file        - benchmark each enabled scanner on file
+ *	stand -B [options] -G kind:size - benchmark on a synthetic buffer
  *
  */
 
 #include "bulk_extractor.h"
+#include "aftimer.h"
+#include "dfxml/src/hash_t.h"
 
 #include <iostream>
 #include <fstream>
@@ -16,61 +22,423 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 /**
  * Stand alone tester.
- * 1. allocate an sbuf for the file.
- * 2. Initialize the scanner.
- * 3. Call the scanner.
- * 4. Shut down the scanner.
+ * 1. Read the file (or make the synthetic buffer) into memory.
+ * 2. Initialize the scanners.
+ * 3. Call the scanners: once, or -B repeatedly and timed, one at a time.
+ * 4. Shut down the scanners.
  */
 int debug=0;
-const char *image_fname = 0;
-be_config_t be_config; // system configuration
+
+/* The globals that bulk_extractor.cpp defines for the scanners */
+regex_list find_list;
+word_and_context_list alert_list;
+word_and_context_list stop_list;
 
 scanner_t *scanners_builtin[] = {
+    scan_accts,
+    scan_base16,
+    scan_base64,
+    scan_kml,
+    scan_email,
+    scan_gps,
+    scan_net,
+    scan_find,
+    scan_wordlist,
+    scan_aes,
+    scan_json,
+#ifdef HAVE_LIBLIGHTGREP
+    scan_lightgrep,
+#endif
+#ifdef HAVE_EXIV2
+    scan_exiv2,
+#endif
+#ifdef HAVE_HASHID
+    scan_hashid,
+#endif
+    scan_elf,
+    scan_exif,
+    scan_zip,
+#ifdef USE_RAR
+    scan_rar,
+#endif
+    scan_gzip,
+    scan_pdf,
+    scan_winpe,
+    scan_hiberfile,
+    scan_winprefetch,
+    scan_windirs,
+    scan_vcard,
     scan_bulk,
-    0
-};
+    scan_xor,
+    0};
+
+static std::string stand_hash(const uint8_t *buf,size_t bufsize)
+{
+    return md5_generator::hash_buf(buf,bufsize).hexdigest();
+}
 
 void usage()
 {
-    load_scanners(scanners_builtin,histograms);
     cerr << "usage: stand [options] filename\n";
-    cerr << "Scanner(s):\n";
-    for(scanner_vector::const_iterator it = current_scanners.begin();it!=current_scanners.end();it++){
-	cerr << "   " << (*it)->info.name;
-	if((*it)->info.flags & scanner_info::SCANNER_NO_USAGE){ cerr << " SCANNER_NO_USAGE "; }
-	if((*it)->info.flags & scanner_info::SCANNER_DISABLED){ cerr << " SCANNER_DISABLED "; }
-	cerr << "\n";
-    }
-    
+    cerr << "       stand -B [options] [filename]\n";
     cerr << "Options:\n";
     cerr << "   -h           - print this message\n";
-    cerr << "  -e scanner    - enable scanner\n";
-    cerr << "  -o outdir     - specify output directory\n";
+    cerr << "   -e scanner   - enable scanner\n";
+    cerr << "   -x scanner   - disable scanner\n";
+    cerr << "   -E scanner   - disable all scanners except scanner\n";
+    cerr << "   -P dir       - load plug-in scanners from dir\n";
+    cerr << "   -s name=value - set a scanner option\n";
+    cerr << "   -o outdir    - record features in outdir (otherwise they are discarded)\n";
+    cerr << "Benchmarking:\n";
+    cerr << "   -B           - time each enabled scanner on the buffer, which is held in memory\n";
+    cerr << "   -G kind[:size] - benchmark on a synthetic buffer instead of a file;\n";
+    cerr << "                  kind is zeros, random or text (default size 16M)\n";
+    cerr << "   -n NN        - timed passes per scanner (default 20)\n";
+    cerr << "   -w NN        - untimed warm-up passes per scanner (default 3)\n";
+    cerr << "   -r           - scan what the scanners decode with all enabled scanners\n";
+    cerr << "                  (by default decoded buffers are counted but not scanned)\n";
+    cerr << "   -p           - also read the CPU's performance counters (Linux)\n";
+    cerr << "\n";
+    be13::plugin::info_scanners(false,true,scanners_builtin,'e','x');
     exit(1);
 }
 
+/****************************************************************
+ *** Buffers
+ ****************************************************************/
+
+static uint64_t scaled_size(const std::string &str)
+{
+    uint64_t val = strtoull(str.c_str(),0,10);
+    switch(str.size()>0 ? str[str.size()-1] : 0){
+    case 'k': case 'K': val *= 1024; break;
+    case 'm': case 'M': val *= 1024*1024; break;
+    case 'g': case 'G': val *= 1024*1024*1024; break;
+    }
+    return val;
+}
+
+static void read_file(const char *fname,std::vector<uint8_t> &buf)
+{
+    int fd = open(fname,O_RDONLY|O_BINARY);
+    if(fd<0) err(1,"%s",fname);
+    struct stat st;
+    if(fstat(fd,&st)) err(1,"%s",fname);
+    buf.resize(st.st_size);
+    for(size_t off=0;off<buf.size();){
+        ssize_t r = read(fd,&buf[off],buf.size()-off);
+        if(r<=0) err(1,"%s",fname);
+        off += r;
+    }
+    close(fd);
+}
+
+/* A small, fast generator so that a synthetic buffer is the same on every run */
+class xorshift64 {
+    uint64_t s;
+public:
+    xorshift64(uint64_t seed):s(seed){}
+    uint64_t next(){
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+    size_t below(size_t n){ return next() % n; }
+};
+
+static const char *const synthetic_words[] = {
+    "the","of","and","to","in","is","that","for","it","as","was","with","be","by","on","not",
+    "account","invoice","meeting","report","budget","project","server","network","password",
+    "contract","review","schedule","customer","shipment","payment","delivery","office","manager",0};
+static const char *const synthetic_domains[] = {
+    "example.com","example.org","corp.example.net","mail.example.edu","shop.example.de",0};
+
+static size_t count_of(const char *const *list)
+{
+    size_t n = 0;
+    while(list[n]) n++;
+    return n;
+}
+
+/* English-like lines with an email address, URL or phone number on some of them */
+static void make_text(xorshift64 &r,size_t size,std::vector<uint8_t> &buf)
+{
+    const size_t nwords = count_of(synthetic_words);
+    const size_t ndomains = count_of(synthetic_domains);
+    std::string s;
+    while(buf.size()<size){
+        s.clear();
+        for(size_t i=0,n=8+r.below(12);i<n;i++){
+            if(i) s += ' ';
+            s += synthetic_words[r.below(nwords)];
+        }
+        char extra[128];
+        switch(r.below(10)){
+        case 0:
+            snprintf(extra,sizeof(extra)," user%u@%s",(unsigned)r.below(100000),synthetic_domains[r.below(ndomains)]);
+            s += extra;
+            break;
+        case 1:
+            snprintf(extra,sizeof(extra)," http://www.%s/%s.html?id=%u",synthetic_domains[r.below(ndomains)],
+                     synthetic_words[r.below(nwords)],(unsigned)r.below(100000));
+            s += extra;
+            break;
+        case 2:
+            snprintf(extra,sizeof(extra)," (%03u) %03u-%04u",(unsigned)(201+r.below(700)),
+                     (unsigned)(200+r.below(800)),(unsigned)r.below(10000));
+            s += extra;
+            break;
+        }
+        s += ".\n";
+        buf.insert(buf.end(),s.begin(),s.end());
+    }
+    buf.resize(size);
+}
+
+static void make_synthetic(const std::string &spec,std::vector<uint8_t> &buf,std::string &desc)
+{
+    std::string kind = spec;
+    uint64_t size = 16*1024*1024;
+    size_t colon = spec.find(':');
+    if(colon!=std::string::npos){
+        kind = spec.substr(0,colon);
+        size = scaled_size(spec.substr(colon+1));
+    }
+    xorshift64 r(0x9e3779b97f4a7c15ULL);
+    buf.clear();
+    buf.reserve(size);
+    if(kind=="zeros"){
+        buf.resize(size,0);
+    } else if(kind=="random"){
+        while(buf.size()<size){
+            uint64_t v = r.next();
+            for(int i=0;i<8 && buf.size()<size;i++) buf.push_back((uint8_t)(v>>(i*8)));
+        }
+    } else if(kind=="text"){
+        make_text(r,size,buf);
+    } else {
+        errx(1,"unknown synthetic buffer kind: %s (zeros, random or text)",kind.c_str());
+    }
+    desc = "synthetic " + kind;
+}
+
+/****************************************************************
+ *** Performance counters
+ ****************************************************************/
+
+/* The CPU's cycles, instructions, cache misses and branch misses, counted in user space */
+class perf_counters {
+public:
+    static const int COUNT = 4;
+    uint64_t totals[COUNT];
+
+    perf_counters():totals(),fds(),ok(false){
+        for(int i=0;i<COUNT;i++) fds[i] = -1;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+        static const uint64_t configs[COUNT] = {PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,
+                                                PERF_COUNT_HW_CACHE_MISSES,PERF_COUNT_HW_BRANCH_MISSES};
+        for(int i=0;i<COUNT;i++){
+            struct perf_event_attr pe;
+            memset(&pe,0,sizeof(pe));
+            pe.type           = PERF_TYPE_HARDWARE;
+            pe.size           = sizeof(pe);
+            pe.config         = configs[i];
+            pe.disabled       = (i==0);		// the group leader starts and stops them all
+            pe.exclude_kernel = 1;
+            pe.exclude_hv     = 1;
+            fds[i] = syscall(__NR_perf_event_open,&pe,0,-1,i==0 ? -1 : fds[0],0);
+            if(fds[i]<0){
+                warn("perf_event_open");
+                close_all();
+                return;
+            }
+        }
+        ok = true;
+#else
+        warnx("performance counters are not supported on this platform");
+#endif
+    }
+    ~perf_counters(){ close_all(); }
+    bool available() const { return ok; }
+
+    void start(){
+#ifdef HAVE_LINUX_PERF_EVENT_H
+        if(!ok) return;
+        ioctl(fds[0],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    void stop(){
+#ifdef HAVE_LINUX_PERF_EVENT_H
+        if(!ok) return;
+        ioctl(fds[0],PERF_EVENT_IOC_DISABLE,PERF_IOC_FLAG_GROUP);
+        for(int i=0;i<COUNT;i++){
+            uint64_t v = 0;
+            if(read(fds[i],&v,sizeof(v))==sizeof(v)) totals[i] += v;
+        }
+#endif
+    }
+    void clear(){ memset(totals,0,sizeof(totals)); }
+
+private:
+    int fds[COUNT];
+    bool ok;
+    perf_counters(const perf_counters &);
+    perf_counters &operator=(const perf_counters &);
+    void close_all(){
+        for(int i=0;i<COUNT;i++){
+            if(fds[i]>=0) close(fds[i]);
+            fds[i] = -1;
+        }
+        ok = false;
+    }
+};
+
+/****************************************************************
+ *** Benchmark
+ ****************************************************************/
+
+struct sample_stats {
+    double mean;
+    double min;
+    double median;
+    double ci95;			// half-width of the 95% confidence interval of the mean
+};
+
+static sample_stats summarize(std::vector<double> v)
+{
+    /* Student's t at 97.5% for 1..30 degrees of freedom; 1.96 beyond */
+    static const double t975[30] = {12.706,4.303,3.182,2.776,2.571,2.447,2.365,2.306,2.262,2.228,
+                                    2.201,2.179,2.160,2.145,2.131,2.120,2.110,2.101,2.093,2.086,
+                                    2.080,2.074,2.069,2.064,2.060,2.056,2.052,2.048,2.045,2.042};
+    sample_stats s;
+    std::sort(v.begin(),v.end());
+    double sum = 0;
+    for(size_t i=0;i<v.size();i++) sum += v[i];
+    s.mean   = sum / v.size();
+    s.min    = v[0];
+    s.median = (v.size()%2) ? v[v.size()/2] : (v[v.size()/2-1]+v[v.size()/2])/2;
+    s.ci95   = 0;
+    if(v.size()>1){
+        double ss = 0;
+        for(size_t i=0;i<v.size();i++) ss += (v[i]-s.mean)*(v[i]-s.mean);
+        double sd = sqrt(ss/(v.size()-1));
+        size_t df = v.size()-1;
+        s.ci95 = (df<=30 ? t975[df-1] : 1.96) * sd / sqrt((double)v.size());
+    }
+    return s;
+}
+
+/* Decoded buffers are counted, not scanned, unless -r */
+static uint64_t recursed_bytes = 0;
+static void count_recursion(const scanner_params &sp)
+{
+    recursed_bytes += sp.sbuf.bufsize;
+}
+
+static void benchmark(const sbuf_t &sbuf,feature_recorder_set &fs,const std::string &desc,
+                      int warmup,int passes,bool recurse,bool use_perf)
+{
+    perf_counters *pc = use_perf ? new perf_counters() : 0;
+    if(pc && !pc->available()){
+        delete pc;
+        pc = 0;
+    }
+    recursion_control_block rcb(recurse ? be13::plugin::process_sbuf : count_recursion,"STAND");
+
+    std::cout << "Buffer: " << desc << ", " << sbuf.bufsize << " bytes\n";
+    std::cout << "Passes: " << warmup << " warm-up, " << passes << " timed\n";
+    std::cout << "Decoded buffers: " << (recurse ? "scanned with all enabled scanners" : "counted, not scanned") << "\n\n";
+    printf("%-16s %10s %9s %10s %10s %12s","scanner","ns/byte","+/-95%","MB/s","min ns/B","decoded/pass");
+    if(pc) printf(" %8s %6s %10s %10s","cyc/byte","IPC","cmiss/KB","bmiss/KB");
+    printf("\n");
+
+    const double bytes = sbuf.bufsize ? sbuf.bufsize : 1;
+    for(be13::plugin::scanner_vector::const_iterator it = be13::plugin::current_scanners.begin();
+        it!=be13::plugin::current_scanners.end();it++){
+        if(!(*it)->enabled) continue;
+        scanner_params sp(scanner_params::PHASE_SCAN,sbuf,fs);
+        for(int i=0;i<warmup;i++) ((*it)->scanner)(sp,rcb);
+
+        std::vector<double> ns_per_byte;
+        if(pc) pc->clear();
+        recursed_bytes = 0;
+        for(int i=0;i<passes;i++){
+            aftimer t;
+            if(pc) pc->start();
+            t.start();
+            ((*it)->scanner)(sp,rcb);
+            t.stop();
+            if(pc) pc->stop();
+            ns_per_byte.push_back(t.lap_time()*1e9/bytes);
+        }
+        sample_stats s = summarize(ns_per_byte);
+        printf("%-16s %10.3f %9.3f %10.1f %10.3f %12llu",(*it)->info.name.c_str(),
+               s.mean,s.ci95,s.mean>0 ? 1000.0/s.mean : 0.0,s.min,(unsigned long long)(recursed_bytes/passes));
+        if(pc){
+            double total = bytes*passes;
+            printf(" %8.3f %6.2f %10.3f %10.3f",
+                   pc->totals[0]/total,
+                   pc->totals[0] ? (double)pc->totals[1]/pc->totals[0] : 0.0,
+                   pc->totals[2]*1024.0/total,
+                   pc->totals[3]*1024.0/total);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    delete pc;
+}
+
 int main(int argc,char **argv)
 {
-    /* look for usage first */
-    if(argc==1 || (strcmp(argv[1],"-h")==0)){
-	usage();
-	exit(1);
-    }
-    load_scanners(scanners_builtin,histograms);
-    be_config["bulk_block_size"] = itos(opt_scan_bulk_block_size);
-    
-    int ch;
+    scanner_info::scanner_config be_config;
+    std::vector<std::string> scanner_dirs;
     std::string opt_outdir;
-    while ((ch = getopt(argc, argv, "e:o:s:x:h?")) != -1) {
+    std::string opt_synthetic;
+    bool opt_benchmark = false;
+    bool opt_recurse = false;
+    bool opt_perf = false;
+    int opt_passes = 20;
+    int opt_warmup = 3;
+    bool opt_h = (argc==1);
+
+    int ch;
+    while ((ch = getopt(argc, argv, "BE:e:G:n:o:P:prs:w:x:h?")) != -1) {
 	switch (ch) {
+	case 'B': opt_benchmark = true;break;
+	case 'E':
+	    be13::plugin::scanners_disable_all();
+	    be13::plugin::scanners_enable(optarg);
+	    break;
+	case 'e': be13::plugin::scanners_enable(optarg);break;
+	case 'G': opt_synthetic = optarg;break;
+	case 'n': opt_passes = atoi(optarg);break;
 	case 'o': opt_outdir = optarg;break;
-	case 'e': set_scanner_enabled(optarg,1);break;
-	case 'x': set_scanner_enabled(optarg,0);break;
+	case 'P': scanner_dirs.push_back(optarg);break;
+	case 'p': opt_perf = true;break;
+	case 'r': opt_recurse = true;break;
+	case 'w': opt_warmup = atoi(optarg);break;
+	case 'x': be13::plugin::scanners_disable(optarg);break;
 	case 's':
 	    {
 		std::vector<std::string> params = split(optarg,'=');
@@ -78,56 +446,60 @@ int main(int argc,char **argv)
 		    std::cerr << "Invalid paramter: " << optarg << "\n";
 		    exit(1);
 		}
-		be_config[params[0]] = params[1];
+		be_config.namevals[params[0]] = params[1];
 		continue;
 	    }
 	case 'h': case '?':default:
-	    usage();
+	    opt_h = true;
 	    break;
 	}
     }
     argc -= optind;
     argv += optind;
 
-    if(argc!=1) usage();
-
-    opt_scan_bulk_block_size = stoi(be_config["bulk_block_size"]);
-
-    feature_file_names_t feature_file_names;
-    enable_feature_recorders(feature_file_names);
+    be_config.debug = debug;
+    be_config.hasher.name = "md5";
+    be_config.hasher.func = stand_hash;
+    be13::plugin::load_scanner_directories(scanner_dirs,be_config);
+    be13::plugin::load_scanners(scanners_builtin,be_config);
+    be13::plugin::scanners_process_enable_disable_commands();
 
-    xml *xreport = new xml("stand.xml",false);
+    if(opt_h) usage();
+    if(opt_synthetic.size()>0 && !opt_benchmark) errx(1,"-G requires -B");
+    if(argc!=(opt_synthetic.size()>0 ? 0 : 1)) usage();
+    if(opt_passes<1) errx(1,"-n must be at least 1");
 
     /* Make the sbuf */
-    sbuf_t *sbuf = sbuf_t::map_file(argv[0]);
-    if(!sbuf){
-	err(1,"Cannot map file %s:%s\n",argv[0],strerror(errno));
-    }
-
-    feature_recorder_set fs(feature_file_names,opt_outdir);	// where the features will be put
-    scanner_params sp(*sbuf,fs);		// the parameters that we will pass the scanner
-    recursion_control_block rcb(0,"STAND",true);
-    
-    for(scanner_vector::iterator it = current_scanners.begin();it!=current_scanners.end();it++){
-	((*it)->scanner)(sp,rcb);
+    std::vector<uint8_t> buf;
+    std::string desc;
+    if(opt_synthetic.size()>0){
+        make_synthetic(opt_synthetic,buf,desc);
+    } else {
+        read_file(argv[0],buf);
+        desc = argv[0];
     }
+    sbuf_t sbuf(pos0_t(),buf.size() ? &buf[0] : 0,buf.size(),buf.size(),false);
 
-    phase2(fs,*xreport);
+    /* The features go to outdir, or nowhere */
+    feature_file_names_t feature_file_names;
+    feature_recorder_set::get_alert_recorder_name(feature_file_names);
+    be13::plugin::get_scanner_feature_file_names(feature_file_names);
+    feature_recorder_set *fs = opt_outdir.size()>0 ?
+        new feature_recorder_set(feature_file_names,desc,opt_outdir,false) :
+        new feature_recorder_set(feature_recorder_set::SET_DISABLED);
+    be13::plugin::scanners_init(fs);
 
-    cout << "Phase 3. Creating Histograms\n";
-    for(histograms_t::const_iterator it = histograms.begin();it!=histograms.end();it++){
-	if(fs.has_name((*it).feature)){
-	    feature_recorder *fr = fs.get_name((*it).feature);
-	    try {
-		fr->make_histogram((*it).pattern,(*it).suffix);
-	    }
-	    catch (const std::exception &e) {
-		cerr << "ERROR: " << e.what() << " computing histogram " << (*it).feature << "\n";
-		xreport->xmlout("error",(*it).feature, "function='phase3'",true);
-	    }
-	}
+    if(opt_benchmark){
+        benchmark(sbuf,*fs,desc,opt_warmup,opt_passes,opt_recurse,opt_perf);
+    } else {
+        be13::plugin::process_sbuf(scanner_params(scanner_params::PHASE_SCAN,sbuf,*fs));
     }
 
+    be13::plugin::phase_shutdown(*fs);
+    if(opt_outdir.size()>0){
+        cout << "Phase 3. Creating Histograms\n";
+        be13::plugin::phase_histogram(*fs,0);
+    }
+    delete fs;
     return(0);
 }
-
@@ -2,6 +2,9 @@
 #include "threadpool.h"
 #include "image_process.h"
 #include "aftimer.h"
+#include "known_blocks.h"
+#include "page_cache.h"
+#include "trace.h"
 
 #include <dirent.h>
 #include <ctype.h>
@@ -12,6 +15,10 @@
 #include <queue>
 #include <unistd.h>
 
+static const uint16_t trace_sbuf            = trace::intern("sbuf","worker");
+static const uint16_t trace_wait_for_work   = trace::intern("wait_for_work","wait");
+static const uint16_t trace_wait_for_worker = trace::intern("wait_for_worker","wait");
+static const uint16_t trace_xreport         = trace::intern("work_start_work_end","report");
 
 /* Return the number of CPUs we have on various architectures.
  * From http://stackoverflow.com/questions/150355/programmatically-find-the-number-of-cores-on-a-machine
@@ -83,7 +90,7 @@ void threadpool::win32_init()
  */
 threadpool::threadpool(int numthreads,feature_recorder_set &fs_,dfxml_writer &xreport_):
     workers(),M(),TOMAIN(),TOWORKER(),freethreads(numthreads),work_queue(),
-    fs(fs_),xreport(xreport_),thread_status(),waiting(),mode()
+    fs(fs_),xreport(xreport_),thread_status(),waiting(),mode(),known(),known_pages_skipped(),pages()
 {
     if(pthread_mutex_init(&M,NULL)) errx(1,"pthread_mutex_init failed");
     if(pthread_cond_init(&TOMAIN,NULL)) errx(1,"pthread_cond_init #1 failed");
@@ -132,13 +139,16 @@ threadpool::~threadpool()
 void threadpool::schedule_work(sbuf_t *sbuf)
 {
     pthread_mutex_lock(&M);
-    while(freethreads==0){
-	// wait until a thread is free (doesn't matter which)
-	waiting.start();
-	if(pthread_cond_wait(&TOMAIN,&M)){
-	    err(1,"threadpool::schedule_work pthread_cond_wait failed");
+    if(freethreads==0){
+	trace::scope ts(trace_wait_for_worker);
+	while(freethreads==0){
+	    // wait until a thread is free (doesn't matter which)
+	    waiting.start();
+	    if(pthread_cond_wait(&TOMAIN,&M)){
+		err(1,"threadpool::schedule_work pthread_cond_wait failed");
+	    }
+	    waiting.stop();
 	}
-	waiting.stop();
     }
     work_queue.push(sbuf); 
     freethreads--;
@@ -160,9 +170,24 @@ int threadpool::get_free_count()
 bool worker::opt_work_start_work_end=true;
 void worker::do_work(sbuf_t *sbuf)
 {
+    trace::scope ts(trace_sbuf,sbuf->pos0.offset);
+
+    /* Pages made only of known blocks have nothing to find.
+     * The check is made here rather than by the producer so that the hashing is spread across the workers.
+     */
+    if(master.known && master.known->all_known(sbuf->buf,sbuf->pagesize)){
+        pthread_mutex_lock(&master.M);
+        master.known_pages_skipped++;
+        pthread_mutex_unlock(&master.M);
+        return;
+    }
+
+    /* A page that repeats an earlier page gets its features replayed at the end of phase 1 */
+    if(master.pages && master.pages->check(*sbuf)) return;
 
     /* If logging starting and ending, save the start */
     if(opt_work_start_work_end){
+	trace::scope tx(trace_xreport);
 	std::stringstream ss;
 	ss << "threadid='"  << id << "'"
 	   << " pos0='"     << sbuf->pos0.str() << "'"
@@ -184,6 +209,7 @@ void worker::do_work(sbuf_t *sbuf)
 
     /* If we are logging starting and ending, save the end */
     if(opt_work_start_work_end){
+	trace::scope tx(trace_xreport);
 	std::stringstream ss;
 	ss << "threadid='" << id << "'"
 	   << " pos0='" << sbuf->pos0.str() << "'"
@@ -205,6 +231,17 @@ void threadpool::set_thread_status(uint32_t id,const std::string &status)
     pthread_mutex_unlock(&M);
 }
 
+void threadpool::get_status(size_t &queued,int &free,std::vector<std::string> &status)
+{
+    if(pthread_mutex_lock(&M)){
+	errx(1,"threadpool::get_status pthread_mutex_lock failed");
+    }
+    queued = work_queue.size();
+    free   = freethreads;
+    status = thread_status;
+    pthread_mutex_unlock(&M);
+}
+
 std::string threadpool::get_thread_status(uint32_t id)
 {
     if(pthread_mutex_lock(&M)){
@@ -226,6 +263,9 @@ std::string threadpool::get_thread_status(uint32_t id)
 #pragma GCC diagnostic ignored "-Wsuggest-attribute=noreturn"
 void *worker::run() 
 {
+    std::stringstream name;
+    name << "worker " << id;
+    trace::set_thread_name(name.str());
     while(true){
 	/* Get the lock, then wait for the queue to be empty.
 	 * If it is not empty, wait for the lock again.
@@ -236,11 +276,14 @@ void *worker::run()
             throw new internal_error();
 	}
 	/* At this point the worker has the lock */
-	while(master.work_queue.empty()){
-	    /* I didn't get any work; go back to sleep */
-	    if(pthread_cond_wait(&master.TOWORKER,&master.M)){
-                std::cerr << "pthread_cond_wait error=%d" << errno << "\n";
-                throw new internal_error();
+	if(master.work_queue.empty()){
+	    trace::scope ts(trace_wait_for_work);
+	    while(master.work_queue.empty()){
+		/* I didn't get any work; go back to sleep */
+		if(pthread_cond_wait(&master.TOWORKER,&master.M)){
+		    std::cerr << "pthread_cond_wait error=%d" << errno << "\n";
+		    throw new internal_error();
+		}
 	    }
 	}
 	waiting.stop();
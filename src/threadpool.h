@@ -63,7 +63,7 @@ class threadpool {
 	}
     };
  threadpool(const threadpool &t) __attribute__((__noreturn__)) :workers(),M(),TOMAIN(),TOWORKER(),freethreads(),
-    work_queue(),fs(t.fs),xreport(t.xreport),thread_status(),waiting(),mode(){
+    work_queue(),fs(t.fs),xreport(t.xreport),thread_status(),waiting(),mode(),known(),known_pages_skipped(),pages(){
     throw new not_impl();
   }
   const threadpool &operator=(const threadpool &t){throw new not_impl(); }
@@ -84,6 +84,9 @@ class threadpool {
     vector<string>	thread_status;	// for each thread, its status
     aftimer		waiting;	// time spend waiting
     int			mode;		// 0=running; 1 = waiting for workers to finish
+    const class known_blocks *known;	// if set, pages made only of these blocks are not scanned
+    uint64_t		known_pages_skipped; // protected by M
+    class page_cache	*pages;		// if set, pages that repeat earlier pages are not scanned
 
     static u_int	numCPU();
 
@@ -94,6 +97,7 @@ class threadpool {
     int			get_free_count();
     std::string		get_thread_status(uint32_t id);
     void		set_thread_status(uint32_t id, const std::string &status );
+    void		get_status(size_t &queued,int &free,std::vector<std::string> &status); // one snapshot under M
 };
 
 // there is a worker object for each thread
@@ -0,0 +1,227 @@
+/**
+ * trace.cpp:
+ * Per-thread rings of begin/end events, and their output as Chrome trace JSON.
+ * See trace.h for the events recorded.
+ */
+
+#include "config.h"
+#include "bulk_extractor_i.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <iostream>
+#include <vector>
+
+bool     trace::enabled = false;
+uint32_t trace::ring_events = 256*1024;
+
+struct trace_event {
+    uint64_t us;			// see now_us()
+    uint64_t arg;
+    uint32_t depth;
+    uint16_t name;
+    uint8_t  ph;			// 'B' or 'E'
+};
+
+struct trace_ring {
+    std::vector<trace_event> ev;
+    uint64_t mask;
+    uint64_t next;			// events recorded; ev[next & mask] is the next to write
+    uint32_t tid;
+    std::string name;
+    trace_ring(size_t size,uint32_t tid_):ev(size),mask(size-1),next(0),tid(tid_),name(){}
+};
+
+/* The names and the rings are created on first use, as scanners intern
+ * their names during static initialization.
+ */
+static pthread_mutex_t trace_M = PTHREAD_MUTEX_INITIALIZER;	// protects the following
+struct trace_name {
+    std::string name;
+    std::string category;
+};
+static std::vector<trace_name> &trace_names()
+{
+    static std::vector<trace_name> names;
+    return names;
+}
+static std::vector<trace_ring *> &trace_rings()
+{
+    static std::vector<trace_ring *> rings;
+    return rings;
+}
+
+static pthread_key_t  trace_ring_key;
+static pthread_once_t trace_ring_once = PTHREAD_ONCE_INIT;
+static void trace_ring_init()
+{
+    pthread_key_create(&trace_ring_key,0);	// rings are kept until write_json()
+}
+
+static trace_ring *get_ring()
+{
+    pthread_once(&trace_ring_once,trace_ring_init);
+    trace_ring *r = static_cast<trace_ring *>(pthread_getspecific(trace_ring_key));
+    if(r==0){
+        size_t size = 1024;
+        while(size < trace::ring_events) size *= 2;
+        pthread_mutex_lock(&trace_M);
+        r = new trace_ring(size,(uint32_t)trace_rings().size()+1);
+        trace_rings().push_back(r);
+        pthread_mutex_unlock(&trace_M);
+        pthread_setspecific(trace_ring_key,r);
+    }
+    return r;
+}
+
+/* Microseconds on the monotonic clock if there is one; otherwise the time of day, which may step back */
+static inline uint64_t now_us()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC,&ts)==0) return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#endif
+    struct timeval tv;
+    gettimeofday(&tv,0);
+    return (uint64_t)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+/* b-a, or 0 if the clock stepped back between them */
+static inline uint64_t elapsed_us(uint64_t a,uint64_t b)
+{
+    return b>a ? b-a : 0;
+}
+
+uint16_t trace::intern(const std::string &name,const std::string &category)
+{
+    pthread_mutex_lock(&trace_M);
+    std::vector<trace_name> &names = trace_names();
+    size_t i;
+    for(i=0;i<names.size();i++){
+        if(names[i].name==name && names[i].category==category) break;
+    }
+    if(i==names.size()){
+        if(i>0xffff) errx(1,"trace::intern: too many names");
+        trace_name n;
+        n.name = name;
+        n.category = category;
+        names.push_back(n);
+    }
+    pthread_mutex_unlock(&trace_M);
+    return (uint16_t)i;
+}
+
+void trace::set_thread_name(const std::string &name)
+{
+    if(!enabled) return;
+    trace_ring *r = get_ring();
+    pthread_mutex_lock(&trace_M);
+    r->name = name;
+    pthread_mutex_unlock(&trace_M);
+}
+
+void trace::begin(uint16_t name,uint64_t arg,uint32_t depth)
+{
+    trace_ring *r = get_ring();
+    trace_event &e = r->ev[r->next++ & r->mask];
+    e.us    = now_us();
+    e.arg   = arg;
+    e.depth = depth;
+    e.name  = name;
+    e.ph    = 'B';
+}
+
+void trace::end(uint16_t name)
+{
+    trace_ring *r = get_ring();
+    trace_event &e = r->ev[r->next++ & r->mask];
+    e.us    = now_us();
+    e.arg   = 0;
+    e.depth = 0;
+    e.name  = name;
+    e.ph    = 'E';
+}
+
+/****************************************************************
+ *** JSON output
+ ****************************************************************/
+
+static std::string json_string(const std::string &s)
+{
+    std::string ret("\"");
+    for(std::string::const_iterator it=s.begin();it!=s.end();it++){
+        unsigned char ch = *it;
+        if(ch=='"' || ch=='\\'){
+            ret += '\\';
+            ret += ch;
+        } else if(ch<0x20){
+            char buf[8];
+            snprintf(buf,sizeof(buf),"\\u%04x",ch);
+            ret += buf;
+        } else {
+            ret += ch;
+        }
+    }
+    return ret + "\"";
+}
+
+/* Events are written as complete ('X') events. An end whose begin was
+ * overwritten, and a begin that has not ended, are left out.
+ */
+void trace::write_json(const std::string &fname)
+{
+    FILE *f = fopen(fname.c_str(),"w");
+    if(!f) err(1,"%s",fname.c_str());
+
+    pthread_mutex_lock(&trace_M);
+    const std::vector<trace_name> &names = trace_names();
+    const std::vector<trace_ring *> &rings = trace_rings();
+
+    uint64_t t0 = 0;
+    uint64_t dropped = 0;
+    for(size_t i=0;i<rings.size();i++){
+        const trace_ring &r = *rings[i];
+        uint64_t first = r.next > r.ev.size() ? r.next - r.ev.size() : 0;
+        dropped += first;
+        if(first<r.next && (t0==0 || r.ev[first & r.mask].us < t0)) t0 = r.ev[first & r.mask].us;
+    }
+
+    fprintf(f,"{\"displayTimeUnit\":\"ms\",\"otherData\":{\"events_dropped\":%llu},\"traceEvents\":[\n",
+            (unsigned long long)dropped);
+    const char *sep = "";
+    for(size_t i=0;i<rings.size();i++){
+        const trace_ring &r = *rings[i];
+        std::string tname = r.name.size() ? r.name : "thread";
+        fprintf(f,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":%s}}",
+                sep,r.tid,json_string(tname).c_str());
+        sep = ",\n";
+
+        std::vector<const trace_event *> open;
+        uint64_t first = r.next > r.ev.size() ? r.next - r.ev.size() : 0;
+        for(uint64_t j=first;j<r.next;j++){
+            const trace_event &e = r.ev[j & r.mask];
+            if(e.ph=='B'){
+                open.push_back(&e);
+                continue;
+            }
+            if(open.size()==0 || open.back()->name!=e.name) continue;
+            const trace_event &b = *open.back();
+            open.pop_back();
+            const trace_name &n = names.at(b.name);
+            fprintf(f,"%s{\"name\":%s,\"cat\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                    "\"ts\":%llu,\"dur\":%llu,\"args\":{\"offset\":%llu,\"depth\":%u}}",
+                    sep,json_string(n.name).c_str(),json_string(n.category).c_str(),r.tid,
+                    (unsigned long long)elapsed_us(t0,b.us),(unsigned long long)elapsed_us(b.us,e.us),
+                    (unsigned long long)b.arg,b.depth);
+        }
+    }
+    fprintf(f,"\n]}\n");
+    pthread_mutex_unlock(&trace_M);
+    if(fclose(f)) err(1,"%s",fname.c_str());
+}
@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * \file
+ * A timeline of what each thread did during phase 1, written as a Chrome
+ * trace (trace.json) that chrome://tracing or ui.perfetto.dev can open.
+ *
+ * Each thread records begin/end events into its own fixed-size ring of
+ * binary events, so recording takes no lock and allocates nothing; once a
+ * ring is full its oldest events are overwritten. The events are:
+ *
+ * \verbatim
+ *   sbuf              a page processed by a worker (arg: offset of pos0)
+ *   <scanner>         every call of an enabled scanner, including the calls
+ *                     on decoded buffers, which nest inside the scanner that
+ *                     decoded them (arg: offset of pos0; depth)
+ *   zip:inflate ...   decompression within a scanner
+ *   wait_for_work     a worker waiting on an empty queue
+ *   wait_for_worker   the producer waiting on a full pool
+ *   work_start_work_end  writing debug:work_start/work_end to report.xml
+ * \endverbatim
+ *
+ * Names are interned once, at static initialization or when
+ * scanner_stats::wrap_scanners() wraps the scanners.
+ * The rings are read by write_json() once the workers are idle.
+ */
+
+#include <string>
+#include <stdint.h>
+
+class trace {
+public:
+    static bool     enabled;		// set before the workers start
+    static uint32_t ring_events;	// events kept per thread; rounded up to a power of 2
+
+    /* Return the id of an event name; threadsafe */
+    static uint16_t intern(const std::string &name,const std::string &category);
+
+    static void set_thread_name(const std::string &name);
+    static void begin(uint16_t name,uint64_t arg=0,uint32_t depth=0);
+    static void end(uint16_t name);
+
+    /* Write the events of every thread as Chrome trace JSON */
+    static void write_json(const std::string &fname);
+
+    /* Records an event for the life of the scope, if tracing is enabled */
+    class scope {
+        scope(const scope &);
+        scope &operator=(const scope &);
+        const uint16_t name;
+        const bool on;
+    public:
+        scope(uint16_t name_,uint64_t arg=0,uint32_t depth=0):name(name_),on(trace::enabled){
+            if(on) trace::begin(name,arg,depth);
+        }
+        ~scope(){
+            if(on) trace::end(name);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * utf_util.cpp:
+ * UTF-8 validation and UTF-16/UTF-8 transcoding over raw memory.
+ * See utf_util.h.
+ */
+
+#include "config.h"
+#include "utf_util.h"
+
+#include <cstring>
+#include <wctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Decode the UTF-8 sequence at p, which has avail bytes after it.
+ * Return its length, or 0 if it is not valid.
+ */
+static inline size_t utf8_decode(const uint8_t *p,size_t avail,uint32_t &cp)
+{
+    uint8_t c = p[0];
+    if(c<0x80){
+        cp = c;
+        return 1;
+    }
+    if(c<0xc2) return 0;		// a continuation byte, or an overlong 2-byte form
+    if(c<0xe0){
+        if(avail<2 || (p[1]&0xc0)!=0x80) return 0;
+        cp = ((c&0x1f)<<6) | (p[1]&0x3f);
+        return 2;
+    }
+    if(c<0xf0){
+        if(avail<3 || (p[1]&0xc0)!=0x80 || (p[2]&0xc0)!=0x80) return 0;
+        cp = ((c&0x0f)<<12) | ((p[1]&0x3f)<<6) | (p[2]&0x3f);
+        if(cp<0x800 || (cp>=0xd800 && cp<=0xdfff)) return 0; // overlong, or a surrogate
+        return 3;
+    }
+    if(c<0xf5){
+        if(avail<4 || (p[1]&0xc0)!=0x80 || (p[2]&0xc0)!=0x80 || (p[3]&0xc0)!=0x80) return 0;
+        cp = ((c&0x07)<<18) | ((p[1]&0x3f)<<12) | ((p[2]&0x3f)<<6) | (p[3]&0x3f);
+        if(cp<0x10000 || cp>0x10ffff) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+static inline void utf8_append(std::string &out,uint32_t cp)
+{
+    if(cp<0x80){
+        out.push_back(cp);
+    } else if(cp<0x800){
+        out.push_back(0xc0 | (cp>>6));
+        out.push_back(0x80 | (cp & 0x3f));
+    } else if(cp<0x10000){
+        out.push_back(0xe0 | (cp>>12));
+        out.push_back(0x80 | ((cp>>6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    } else {
+        out.push_back(0xf0 | (cp>>18));
+        out.push_back(0x80 | ((cp>>12) & 0x3f));
+        out.push_back(0x80 | ((cp>>6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+}
+
+static inline void utf16_append(std::string &out,uint16_t unit,bool little_endian)
+{
+    if(little_endian){
+        out.push_back(unit & 0xff);
+        out.push_back(unit >> 8);
+    } else {
+        out.push_back(unit >> 8);
+        out.push_back(unit & 0xff);
+    }
+}
+
+#ifdef __SSE2__
+/* Return true if the 16 bytes at p are all ASCII */
+static inline bool ascii16(const uint8_t *p)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p))==0;
+}
+#endif
+
+size_t utf8_valid_length(const uint8_t *buf,size_t len)
+{
+    size_t i = 0;
+    while(i<len){
+#ifdef __SSE2__
+        if(i+16<=len && ascii16(buf+i)){
+            i += 16;
+            continue;
+        }
+        const size_t stop = i+16<=len ? i+16 : len; // decode at least to the end of this block
+#else
+        const size_t stop = len;
+#endif
+        while(i<stop){
+            uint32_t cp;
+            size_t n = utf8_decode(buf+i,len-i,cp);
+            if(n==0) return i;
+            i += n;
+        }
+    }
+    return len;
+}
+
+bool ascii_plain(const uint8_t *buf,size_t len)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i space     = _mm_set1_epi8(' ');
+    const __m128i del       = _mm_set1_epi8(0x7f);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for(;i+16<=len;i+=16){
+        __m128i v   = _mm_loadu_si128((const __m128i *)(buf+i));
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi8(v,space), // also the bytes with the high bit set
+                                   _mm_or_si128(_mm_cmpeq_epi8(v,del),_mm_cmpeq_epi8(v,backslash)));
+        if(_mm_movemask_epi8(bad)) return false;
+    }
+#endif
+    for(;i<len;i++){
+        if(buf[i]<' ' || buf[i]>=0x7f || buf[i]=='\\') return false;
+    }
+    return true;
+}
+
+bool utf16_to_utf8(const uint8_t *buf,size_t len,bool little_endian,std::string &out)
+{
+    out.clear();
+    out.reserve(len);
+    size_t i = 0;
+    while(i<len){
+#ifdef __SSE2__
+        if(i+16<=len){
+            /* Eight units that are all ASCII become eight bytes */
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf+i));
+            if(!little_endian) v = _mm_or_si128(_mm_slli_epi16(v,8),_mm_srli_epi16(v,8));
+            __m128i high = _mm_and_si128(v,_mm_set1_epi16((short)0xff80));
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(high,_mm_setzero_si128()))==0xffff){
+                char ascii[16];
+                _mm_storeu_si128((__m128i *)ascii,_mm_packus_epi16(v,v));
+                out.append(ascii,8);
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        uint8_t b0 = buf[i];
+        uint8_t b1 = i+1<len ? buf[i+1] : 0;
+        uint32_t cp = little_endian ? (b0 | (b1<<8)) : ((b0<<8) | b1);
+        i += 2;
+        if(cp>=0xdc00 && cp<=0xdfff) return false; // a trail surrogate with no lead
+        if(cp>=0xd800 && cp<=0xdbff){
+            if(i>=len) return false;
+            uint8_t t0 = buf[i];
+            uint8_t t1 = i+1<len ? buf[i+1] : 0;
+            uint32_t trail = little_endian ? (t0 | (t1<<8)) : ((t0<<8) | t1);
+            if(trail<0xdc00 || trail>0xdfff) return false;
+            cp = 0x10000 + ((cp-0xd800)<<10) + (trail-0xdc00);
+            i += 2;
+        }
+        utf8_append(out,cp);
+    }
+    return true;
+}
+
+bool utf8_to_utf16(const uint8_t *buf,size_t len,bool little_endian,std::string &out)
+{
+    out.clear();
+    out.reserve(len*2);
+    size_t i = 0;
+    while(i<len){
+#ifdef __SSE2__
+        if(i+16<=len && ascii16(buf+i)){
+            /* Sixteen ASCII bytes become sixteen units */
+            __m128i v  = _mm_loadu_si128((const __m128i *)(buf+i));
+            __m128i lo = _mm_unpacklo_epi8(v,_mm_setzero_si128());
+            __m128i hi = _mm_unpackhi_epi8(v,_mm_setzero_si128());
+            if(!little_endian){
+                lo = _mm_slli_epi16(lo,8);
+                hi = _mm_slli_epi16(hi,8);
+            }
+            char units[32];
+            _mm_storeu_si128((__m128i *)units,lo);
+            _mm_storeu_si128((__m128i *)(units+16),hi);
+            out.append(units,32);
+            i += 16;
+            continue;
+        }
+#endif
+        uint32_t cp;
+        size_t n = utf8_decode(buf+i,len-i,cp);
+        if(n==0) return false;
+        i += n;
+        if(cp<0x10000){
+            utf16_append(out,cp,little_endian);
+        } else {
+            cp -= 0x10000;
+            utf16_append(out,0xd800 + (cp>>10),little_endian);
+            utf16_append(out,0xdc00 + (cp & 0x3ff),little_endian);
+        }
+    }
+    return true;
+}
+
+bool utf8_tolower(const uint8_t *buf,size_t len,std::string &out)
+{
+    out.clear();
+    out.reserve(len);
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i before_A = _mm_set1_epi8('A'-1);
+    const __m128i after_Z  = _mm_set1_epi8('Z'+1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+#endif
+    while(i<len){
+#ifdef __SSE2__
+        if(i+16<=len && ascii16(buf+i)){
+            __m128i v     = _mm_loadu_si128((const __m128i *)(buf+i));
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v,before_A),_mm_cmplt_epi8(v,after_Z));
+            char lower[16];
+            _mm_storeu_si128((__m128i *)lower,_mm_or_si128(v,_mm_and_si128(upper,case_bit)));
+            out.append(lower,16);
+            i += 16;
+            continue;
+        }
+#endif
+        uint32_t cp;
+        size_t n = utf8_decode(buf+i,len-i,cp);
+        if(n==0) return false;
+        i += n;
+        if(cp<0x80){
+            if(cp>='A' && cp<='Z') cp |= 0x20;
+        } else if(cp<0x10000){
+            cp = towlower(cp);
+        }
+        utf8_append(out,cp);
+    }
+    return true;
+}
+
+bool utf8_digits(const uint8_t *buf,size_t len,std::string &out)
+{
+    out.clear();
+    size_t i = 0;
+    while(i<len){
+        uint32_t cp;
+        size_t n = utf8_decode(buf+i,len-i,cp);
+        if(n==0) return false;
+        i += n;
+        if(cp<0x10000 && (iswdigit(cp) || cp=='+')) utf8_append(out,cp);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef UTF_UTIL_H
+#define UTF_UTIL_H
+
+/**
+ * \file
+ * UTF-8 validation and UTF-16/UTF-8 transcoding over raw memory, so that
+ * callers can work on sbuf bytes without first copying them into a
+ * std::string or std::wstring. Runs of ASCII are handled 16 bytes at a
+ * time with SSE2 where it is available.
+ *
+ * UTF-8 is checked as by utf8::find_invalid(): no overlong forms, no
+ * surrogates, nothing above U+10FFFF, and no truncated sequences.
+ *
+ * Functions that produce a string write it to out, replacing what was
+ * there; pass the same string each time to reuse its memory.
+ */
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Return the length of the longest prefix of buf that is valid UTF-8 */
+size_t utf8_valid_length(const uint8_t *buf,size_t len);
+inline bool utf8_valid(const uint8_t *buf,size_t len){ return utf8_valid_length(buf,len)==len; }
+
+/* Return true if buf is printable ASCII with no backslash, which escaping leaves alone */
+bool ascii_plain(const uint8_t *buf,size_t len);
+
+/**
+ * Convert UTF-16 to UTF-8. An odd final byte is taken as a unit with a
+ * zero high (little endian) or low (big endian) byte.
+ * Return false if there is an unpaired surrogate.
+ */
+bool utf16_to_utf8(const uint8_t *buf,size_t len,bool little_endian,std::string &out);
+
+/* Convert UTF-8 to UTF-16. Return false if buf is not valid UTF-8. */
+bool utf8_to_utf16(const uint8_t *buf,size_t len,bool little_endian,std::string &out);
+
+/**
+ * Lower-case UTF-8: A-Z directly, and the rest of the BMP with towlower().
+ * As when the conversion was made with UTF-16 code units, characters
+ * outside the BMP are left alone.
+ * Return false if buf is not valid UTF-8.
+ */
+bool utf8_tolower(const uint8_t *buf,size_t len,std::string &out);
+
+/* Keep the digits (by iswdigit) and plus signs of UTF-8. Return false if buf is not valid UTF-8. */
+bool utf8_digits(const uint8_t *buf,size_t len,std::string &out);
+
+#endif
@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+Throughput benchmark:
+
+Generates a synthetic disk image that mixes the content the scanners look
+for, runs bulk_extractor on it at several -j values, and writes the
+overall and per-scanner throughput and the scaling with -j to a JSON file
+that can be compared between releases.
+
+The image depends only on --size and --seed, so runs on the same machine
+are repeatable. It is made of sector-aligned regions of these kinds:
+
+ text    - English-like text with email addresses, URLs and phone numbers
+ gzip    - gzip streams of such text
+ zip     - ZIP archives of such text
+ pdf     - PDF files with FlateDecode text streams
+ pcap    - pcap files of TCP/IP packets
+ jpeg    - JPEG files with EXIF headers
+ mail    - RFC822 mail with base64 MIME parts
+ random  - high-entropy bytes
+ zeros   - zero bytes
+
+Per-scanner throughput is the image size divided by the time spent in
+that scanner path (as reported in report.xml's scanner_times), summed
+over all threads.
+"""
+
+__version__ = "1.0.0"
+
+import os,sys,io,json,time,random,struct,zlib,gzip,zipfile,base64,hashlib,shutil,platform,tempfile
+import xml.dom.minidom
+from subprocess import call
+
+MiB = 1024*1024
+SECTOR = 512
+
+KINDS = [# kind, weight, min size, max size
+    ("text",   30,   4096, 256*1024),
+    ("gzip",   10,   4096, 256*1024),
+    ("zip",     8,   4096, 256*1024),
+    ("pdf",     6,   4096, 128*1024),
+    ("pcap",    8,   4096, 256*1024),
+    ("jpeg",    8,   8192, 128*1024),
+    ("mail",   10,   4096, 128*1024),
+    ("random", 12,  32*1024, 256*1024),
+    ("zeros",   8,  32*1024, 256*1024)]
+
+WORDS = ("the of and to in is that for it as was with be by on not he this are or his from at which but have "
+         "an they you were her she there been one all we their has would when if so no what can more will "
+         "account invoice meeting report budget project server network password contract review schedule "
+         "customer shipment payment delivery office manager quarter proposal draft agenda").split()
+FIRST = "alice bob carol dave erin frank grace heidi ivan judy mallory oscar peggy rupert sybil trent victor walter".split()
+DOMAINS = ["example.com","example.org","corp.example.net","mail.example.edu","acme.example.com",
+           "widgets.example.co.uk","shop.example.de","news.example.info"]
+
+class generator:
+    """Deterministic content of each kind, from one random.Random"""
+    def __init__(self,rng):
+        self.rng = rng
+
+    def email(self):
+        r = self.rng
+        return "{}.{}{}@{}".format(r.choice(FIRST),r.choice(FIRST),r.randint(1,999),r.choice(DOMAINS))
+
+    def url(self):
+        r = self.rng
+        return "http://www.{}/{}/{}.html?id={}".format(r.choice(DOMAINS),r.choice(WORDS),r.choice(WORDS),r.randint(1,99999))
+
+    def phone(self):
+        r = self.rng
+        return "({:03d}) {:03d}-{:04d}".format(r.randint(201,989),r.randint(200,999),r.randint(0,9999))
+
+    def text(self,size):
+        r = self.rng
+        out = []
+        n = 0
+        while n<size:
+            words = [r.choice(WORDS) for i in range(r.randint(8,20))]
+            k = r.randint(0,9)
+            if k==0: words.append(self.email())
+            elif k==1: words.append(self.url())
+            elif k==2: words.append(self.phone())
+            line = " ".join(words) + ".\n"
+            out.append(line)
+            n += len(line)
+        return "".join(out).encode('ascii')[:size]
+
+    def random(self,size):
+        return self.rng.getrandbits(size*8).to_bytes(size,'little')
+
+    def gzip(self,size):
+        f = io.BytesIO()
+        g = gzip.GzipFile(filename="doc.txt",mode="wb",fileobj=f,mtime=1300000000)
+        g.write(self.text(size*3))
+        g.close()
+        return f.getvalue()
+
+    def zip(self,size):
+        f = io.BytesIO()
+        z = zipfile.ZipFile(f,mode="w",compression=zipfile.ZIP_DEFLATED)
+        n = 0
+        i = 0
+        while n<size*3:
+            data = self.text(min(size*3-n,self.rng.randint(2048,64*1024)))
+            info = zipfile.ZipInfo("docs/file{}.txt".format(i),date_time=(2012,1,1,0,0,0))
+            info.compress_type = zipfile.ZIP_DEFLATED
+            z.writestr(info,data)
+            n += len(data)
+            i += 1
+        z.close()
+        return f.getvalue()
+
+    def pdf(self,size):
+        body = zlib.compress(b"BT /F1 12 Tf 72 712 Td (" + self.text(size*3).replace(b"\n",b") Tj T* (") + b") Tj ET")
+        objs = [b"<< /Type /Catalog /Pages 2 0 R >>",
+                b"<< /Type /Pages /Kids [3 0 R] /Count 1 >>",
+                b"<< /Type /Page /Parent 2 0 R /Contents 4 0 R >>",
+                b"<< /Length " + str(len(body)).encode('ascii') + b" /Filter /FlateDecode >>\nstream\n" + body + b"\nendstream"]
+        out = [b"%PDF-1.4\n"]
+        offsets = []
+        n = len(out[0])
+        for (i,o) in enumerate(objs):
+            obj = str(i+1).encode('ascii') + b" 0 obj\n" + o + b"\nendobj\n"
+            offsets.append(n)
+            out.append(obj)
+            n += len(obj)
+        out.append(b"xref\n0 " + str(len(objs)+1).encode('ascii') + b"\n0000000000 65535 f \n")
+        for off in offsets:
+            out.append("{:010d} 00000 n \n".format(off).encode('ascii'))
+        out.append(b"trailer\n<< /Size " + str(len(objs)+1).encode('ascii') + b" /Root 1 0 R >>\nstartxref\n"
+                   + str(n).encode('ascii') + b"\n%%EOF\n")
+        return b"".join(out)
+
+    def pcap(self,size):
+        r = self.rng
+        def checksum(b):
+            if len(b)%2: b += b"\0"
+            s = sum(struct.unpack("!%dH" % (len(b)//2),b))
+            while s>>16: s = (s & 0xffff) + (s>>16)
+            return (~s) & 0xffff
+        out = [struct.pack("<IHHiIII",0xa1b2c3d4,2,4,0,0,65535,1)]
+        n = len(out[0])
+        t = 1300000000
+        while n<size:
+            payload = (b"GET /" + r.choice(WORDS).encode('ascii') + b" HTTP/1.1\r\nHost: www."
+                       + r.choice(DOMAINS).encode('ascii') + b"\r\nFrom: " + self.email().encode('ascii') + b"\r\n\r\n"
+                       + self.text(r.randint(100,1200)))
+            src = bytes([10,r.randint(0,255),r.randint(0,255),r.randint(1,254)])
+            dst = bytes([192,168,r.randint(0,255),r.randint(1,254)])
+            tcp = struct.pack("!HHIIBBHHH",r.randint(1024,65535),80,r.getrandbits(32),r.getrandbits(32),5<<4,0x18,65535,0,0)
+            ip = struct.pack("!BBHHHBBH4s4s",0x45,0,20+len(tcp)+len(payload),r.randint(0,65535),0x4000,64,6,0,src,dst)
+            ip = ip[:10] + struct.pack("!H",checksum(ip)) + ip[12:]
+            ether = bytes([0,0x1b,0x21,r.randint(0,255),r.randint(0,255),r.randint(0,255),
+                           0,0x0c,0x29,r.randint(0,255),r.randint(0,255),r.randint(0,255)]) + b"\x08\x00"
+            frame = ether + ip + tcp + payload
+            t += r.randint(0,3)
+            rec = struct.pack("<IIII",t,r.randint(0,999999),len(frame),len(frame)) + frame
+            out.append(rec)
+            n += len(rec)
+        return b"".join(out)
+
+    def jpeg(self,size):
+        r = self.rng
+        def ascii_entry(tag,s,data_off):
+            return struct.pack("<HHII",tag,2,len(s),data_off)
+        strings = [(0x010f,b"SyntheticCam\0"),(0x0110,("Model " + str(r.randint(1,99)) + "\0").encode('ascii')),
+                   (0x0132,"2012:{:02d}:{:02d} {:02d}:{:02d}:{:02d}\0".format(r.randint(1,12),r.randint(1,28),
+                        r.randint(0,23),r.randint(0,59),r.randint(0,59)).encode('ascii'))]
+        ifd_size = 2 + 12*len(strings) + 4
+        data_off = 8 + ifd_size
+        entries = b""
+        data = b""
+        for (tag,s) in strings:
+            entries += ascii_entry(tag,s,data_off+len(data))
+            data += s
+        tiff = b"II*\0" + struct.pack("<I",8) + struct.pack("<H",len(strings)) + entries + struct.pack("<I",0) + data
+        app1 = b"Exif\0\0" + tiff
+        out = b"\xff\xd8" + b"\xff\xe1" + struct.pack(">H",len(app1)+2) + app1
+        qt = b"\0" + bytes([r.randint(1,50) for i in range(64)])
+        out += b"\xff\xdb" + struct.pack(">H",len(qt)+2) + qt
+        sof = struct.pack(">BHHB",8,480,640,1) + b"\x01\x11\x00"
+        out += b"\xff\xc0" + struct.pack(">H",len(sof)+2) + sof
+        sos = b"\x01\x01\x00\x00\x3f\x00"
+        out += b"\xff\xda" + struct.pack(">H",len(sos)+2) + sos
+        scan = self.random(max(size-len(out)-2,0)).replace(b"\xff",b"\xff\x00")
+        return out + scan + b"\xff\xd9"
+
+    def mail(self,size):
+        r = self.rng
+        boundary = "=_{:016x}".format(r.getrandbits(64))
+        head = ("From: {}\r\nTo: {}\r\nSubject: {} {}\r\nDate: Mon, {} Jan 2012 10:{:02d}:00 -0500\r\n"
+                "MIME-Version: 1.0\r\nContent-Type: multipart/mixed; boundary=\"{}\"\r\n\r\n"
+                "--{}\r\nContent-Type: text/plain\r\n\r\n").format(
+            self.email(),self.email(),r.choice(WORDS),r.choice(WORDS),r.randint(1,28),r.randint(0,59),boundary,boundary)
+        body = self.text(min(size//4,4096)).decode('ascii').replace("\n","\r\n")
+        att = base64.encodebytes(self.text(size*3//4)).decode('ascii').replace("\n","\r\n")
+        return (head + body + "\r\n--" + boundary + "\r\nContent-Type: text/plain; name=\"notes.txt\"\r\n"
+                "Content-Transfer-Encoding: base64\r\n\r\n" + att + "\r\n--" + boundary + "--\r\n").encode('ascii')
+
+    def zeros(self,size):
+        return b"\0" * size
+
+def make_image(fn,size,seed):
+    """Write the synthetic image to fn; return the bytes of each kind and the image's SHA1"""
+    rng = random.Random(seed)
+    gen = generator(rng)
+    kinds = []
+    for (kind,weight,lo,hi) in KINDS:
+        kinds += [(kind,lo,hi)] * weight
+    mix = dict((k[0],0) for k in KINDS)
+    sha1 = hashlib.sha1()
+    n = 0
+    with open(fn,"wb") as f:
+        while n<size:
+            (kind,lo,hi) = rng.choice(kinds)
+            data = getattr(gen,kind)(rng.randint(lo,hi))
+            data += b"\0" * (-len(data) % SECTOR)	# files start on sector boundaries
+            data = data[:size-n]
+            f.write(data)
+            sha1.update(data)
+            mix[kind] += len(data)
+            n += len(data)
+    return (mix,sha1.hexdigest())
+
+def get_text(node,name):
+    e = node.getElementsByTagName(name)
+    if not e or not e[0].firstChild: return None
+    return e[0].firstChild.wholeText
+
+def read_report(outdir):
+    """Return the version, total bytes, elapsed seconds and scanner times of a run"""
+    doc = xml.dom.minidom.parse(os.path.join(outdir,"report.xml"))
+    report = doc.getElementsByTagName("report")[0]
+    scanners = {}
+    for st in doc.getElementsByTagName("scanner_times"):
+        for path in st.getElementsByTagName("path"):
+            scanners[get_text(path,"name")] = {"calls":int(get_text(path,"calls")),
+                                               "seconds":float(get_text(path,"seconds"))}
+    return (get_text(doc.documentElement,"version"),int(get_text(report,"total_bytes")),
+            float(get_text(report,"elapsed_seconds")),scanners)
+
+def run_bulk_extractor(args,image,jobs,outdir):
+    if os.path.exists(outdir): shutil.rmtree(outdir)
+    cmd = [args.exe,"-o",outdir,"-j",str(jobs),"-q","-1"] + (args.extra.split() if args.extra else []) + [image]
+    print(" ".join(cmd))
+    t0 = time.time()
+    if call(cmd)!=0:
+        raise RuntimeError("{} failed".format(" ".join(cmd)))
+    return time.time()-t0
+
+def default_jobs():
+    cpus = os.cpu_count() or 1
+    jobs = [1]
+    while jobs[-1]*2<cpus: jobs.append(jobs[-1]*2)
+    if cpus>1: jobs.append(cpus)
+    return ",".join(str(j) for j in jobs)
+
+if __name__=="__main__":
+    import argparse
+    parser = argparse.ArgumentParser(description="Measure bulk_extractor throughput on a synthetic image")
+    parser.add_argument("--exe",default="src/bulk_extractor",help="bulk_extractor executable")
+    parser.add_argument("--size",type=int,default=256,help="image size in MiB")
+    parser.add_argument("--seed",type=int,default=1,help="seed of the image content")
+    parser.add_argument("--jobs",default=default_jobs(),help="comma-separated -j values to run")
+    parser.add_argument("--repeat",type=int,default=1,help="runs at each -j; the fastest is reported")
+    parser.add_argument("--extra",help="other bulk_extractor options, e.g. '-e all'")
+    parser.add_argument("--workdir",help="directory for the image and outputs (default: a temporary directory)")
+    parser.add_argument("--keep",action="store_true",help="keep the image and outputs")
+    parser.add_argument("--output",default="bench.json",help="JSON results file")
+    args = parser.parse_args()
+
+    workdir = args.workdir or tempfile.mkdtemp(prefix="be_bench")
+    if not os.path.exists(workdir): os.makedirs(workdir)
+    image = os.path.join(workdir,"synthetic-{}M-{}.raw".format(args.size,args.seed))
+    print("Generating {} ...".format(image))
+    (mix,sha1) = make_image(image,args.size*MiB,args.seed)
+
+    runs = []
+    version = None
+    for jobs in [int(j) for j in args.jobs.split(",")]:
+        best = None
+        for rep in range(args.repeat):
+            outdir = os.path.join(workdir,"out-j{}".format(jobs))
+            wall = run_bulk_extractor(args,image,jobs,outdir)
+            (version,total_bytes,elapsed,scanners) = read_report(outdir)
+            if best is None or elapsed<best["elapsed_seconds"]:
+                best = {"jobs":jobs,"elapsed_seconds":elapsed,"wall_seconds":wall,
+                        "mb_per_sec":total_bytes/1e6/elapsed,"scanners":scanners}
+                for s in scanners.values():
+                    s["mb_per_sec"] = total_bytes/1e6/s["seconds"] if s["seconds"]>0 else None
+            if not args.keep: shutil.rmtree(outdir)
+        runs.append(best)
+
+    base = runs[0]
+    for r in runs:
+        r["speedup"]    = base["elapsed_seconds"]/r["elapsed_seconds"]
+        r["efficiency"] = r["speedup"]*base["jobs"]/r["jobs"]
+
+    results = {"bench_version":__version__,
+               "bulk_extractor_version":version,
+               "date":time.strftime("%Y-%m-%dT%H:%M:%S"),
+               "host":{"name":platform.node(),"system":platform.platform(),"cpus":os.cpu_count()},
+               "options":args.extra or "",
+               "image":{"size":args.size*MiB,"seed":args.seed,"sha1":sha1,"mix":mix},
+               "runs":runs}
+    with open(args.output,"w") as f:
+        json.dump(results,f,indent=2,sort_keys=True)
+        f.write("\n")
+
+    print("")
+    print("{:>6} {:>10} {:>10} {:>8} {:>10}".format("-j","seconds","MB/s","speedup","efficiency"))
+    for r in runs:
+        print("{:>6} {:>10.2f} {:>10.2f} {:>8.2f} {:>10.2f}".format(r["jobs"],r["elapsed_seconds"],r["mb_per_sec"],
+                                                                   r["speedup"],r["efficiency"]))
+    print("")
+    print("Scanner throughput at -j {} (image MB per second in the scanner):".format(runs[-1]["jobs"]))
+    for (name,s) in sorted(runs[-1]["scanners"].items(),key=lambda a:-a[1]["seconds"]):
+        print("  {:>25} {:>10.4f} sec {:>12}".format(name,s["seconds"],
+                                                   "{:.2f} MB/s".format(s["mb_per_sec"]) if s["mb_per_sec"] else "-"))
+    print("Results written to {}".format(args.output))
+    if not args.keep and not args.workdir:
+        shutil.rmtree(workdir)
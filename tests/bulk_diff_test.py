@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+bulk_diff fixture test.
+
+bulk_diff/pre and bulk_diff/post are two small reports whose histograms
+cover the cases of python/bulk_diff.py: values only on one side, a value
+listed twice (the last line wins), UTF-8 and tabs in values, a histogram
+with no changes, and histograms that are only in one report.
+bulk_diff's text output, with and without -s, must match
+bulk_diff/expected*.txt and python/bulk_diff.py.
+
+The external sort is then forced to spill to temporary files, with
+histograms too large for -m 1, and must give the same output as an
+in-memory sort.
+"""
+
+import os,sys,random,shutil,tempfile
+from fixture import *
+
+def write_report(dname,image,histograms):
+    os.mkdir(dname)
+    with open(os.path.join(dname,"report.xml"),"w") as f:
+        f.write("<?xml version='1.0' encoding='UTF-8'?>\n<dfxml><source>"
+                "<image_filename>{}</image_filename></source></dfxml>\n".format(image))
+    for (name,rows) in histograms.items():
+        with open(os.path.join(dname,name),"w",encoding="utf-8") as f:
+            for (count,value) in rows:
+                f.write("n={}\t{}\n".format(count,value))
+
+def random_histogram(rng,values):
+    return [(rng.choice([1,2,3,10,999,123456]),v) for v in rng.sample(values,len(values)*3//4)]
+
+if __name__=="__main__":
+    bulk_diff = program("bulk_diff")
+
+    for (opts,expected) in (([],"expected.txt"),(["-s"],"expected_smaller.txt")):
+        got = run([bulk_diff]+opts+["bulk_diff/pre","bulk_diff/post"],cwd=tests_dir)
+        same("bulk_diff {} differs from {}".format(" ".join(opts),expected),
+             open(fixture("bulk_diff",expected),"rb").read(),got)
+        pyopts = ["--smaller"] if opts else []
+        py = run([sys.executable,python_tool("bulk_diff.py")]+pyopts+["bulk_diff/pre","bulk_diff/post"],
+                 cwd=tests_dir)
+        same("bulk_diff.py {} differs from {}".format(" ".join(pyopts),expected),
+             open(fixture("bulk_diff",expected),"rb").read(),py)
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        rng = random.Random(1)
+        values = (["user{}@example.com".format(i) for i in range(20000)] +
+                  ["zoë{}@example.org".format(i) for i in range(100)])
+        for side in ("pre","post"):
+            write_report(os.path.join(tmpdir,side),"/images/{}.raw".format(side),
+                         {"email_histogram.txt":random_histogram(rng,values),
+                          "domain_histogram.txt":random_histogram(rng,values[:2000])})
+        args = [os.path.join(tmpdir,"pre"),os.path.join(tmpdir,"post")]
+        for opts in ([],["-s"]):
+            in_memory = run([bulk_diff]+opts+args)
+            spilled   = run([bulk_diff,"-m","1"]+opts+args)
+            same("bulk_diff -m 1 {} differs from an in-memory sort".format(" ".join(opts)),in_memory,spilled)
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASS")
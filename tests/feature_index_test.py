@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+Feature index fixture test.
+
+feature_index/email.txt is a feature file with a BOM and comments,
+lines that are not features (empty, no tab, a path that is not a
+number), features at equal offsets, XOR, XOR(0x5a), chained XOR, GZIP
+and nested paths, and a last line with no newline.
+feature_index/email.txt.idx was written for it by
+feature_index::write_file().
+
+The test checks that:
+ - the index is the layout documented in src/feature_index.h, built
+   here from the feature file line by line;
+ - bulk_extractor_reader.FeatureFile gives the same lines, records and
+   features_in_range() results with the index and without it;
+ - an index for a different file size is ignored.
+
+If bulk_extractor has been built, it is run on a small image and the
+email.txt.idx of its report is checked against the layout as well.
+"""
+
+import os,sys,re,struct,shutil,tempfile
+from fixture import *
+sys.path.insert(0,python_dir)
+from bulk_extractor_reader import FeatureFile
+
+def path_offset(path):
+    """The image offset of a path, as feature_index.h documents it, or None"""
+    parts = path.split(b"-")
+    if not re.match(b"^[0-9]+$",parts[0]): return None
+    offset = int(parts[0])
+    i = 1
+    while i+1<len(parts) and re.match(b"^XOR(\\(0x[0-9a-fA-F]+\\))?$",parts[i]) and re.match(b"^[0-9]+$",parts[i+1]):
+        offset += int(parts[i+1])
+        i += 2
+    return offset
+
+def by_offset(lines):
+    """The sorted (image offset, line number) of each feature in lines"""
+    pairs = []
+    for (i,line) in enumerate(lines):
+        if line.startswith(b"#") or line.startswith(b"\xef\xbb\xbf#") or b"\t" not in line: continue
+        off = path_offset(line[:line.find(b"\t")])
+        if off is not None: pairs.append((off,i))
+    return sorted(pairs)
+
+def expected_index(data):
+    """The index of a feature file, built line by line"""
+    lines  = data.split(b"\n")
+    if lines[-1]==b"": lines.pop()      # the file ends with a newline
+    starts = [0]
+    for line in lines:
+        starts.append(min(starts[-1]+len(line)+1,len(data)))
+    pairs = by_offset(lines)
+    return (struct.pack("<8sQQQ",b"BEFIDX01",len(data),len(starts)-1,len(pairs)) +
+            struct.pack("<{}Q".format(len(starts)),*starts) +
+            struct.pack("<{}Q".format(len(pairs)),*[line for (off,line) in pairs]))
+
+def check_reader(fname,data,want_index):
+    lines = data.split(b"\n")
+    ranges = [(0,1<<64),(0,512),(512,513),(512,4096),(600,4097),(4096,4097),(4097,9000),(9000,9001),(10**12,10**12+1)]
+    with FeatureFile.from_file(fname) as f:
+        if (f.index is not None)!=want_index:
+            fail("{}: index {}".format(fname,"ignored" if want_index else "used"))
+        if len(f)!=len(lines): fail("{}: {} lines, not {}".format(fname,len(f),len(lines)))
+        for i in range(len(lines)):
+            if f[i]!=lines[i]: fail("{}: line {} is {!r}".format(fname,i,f[i]))
+            if f.record(i)!=tuple(lines[i].split(b"\t")): fail("{}: record {}".format(fname,i))
+        if f[3:8]!=lines[3:8] or f[-2:]!=lines[-2:]: fail("{}: slices".format(fname))
+        for (start,end) in ranges:
+            want = [(i,lines[i]) for (off,i) in by_offset(lines) if start<=off<end]
+            got = list(f.features_in_range(start,end))
+            if got!=want: fail("{}: features_in_range({},{}) gave {}".format(fname,start,end,got))
+
+if __name__=="__main__":
+    fname = fixture("feature_index","email.txt")
+    data  = open(fname,"rb").read()
+    same("email.txt.idx differs from the documented layout",
+         expected_index(data),open(fname+".idx","rb").read())
+    check_reader(fname,data,True)
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        noidx = os.path.join(tmpdir,"email.txt")
+        shutil.copy(fname,noidx)
+        check_reader(noidx,data,False)          # no index
+
+        stale = os.path.join(tmpdir,"stale.txt")
+        grown = data+b"\n513\tadded@example.com\tadded@example.com"
+        open(stale,"wb").write(grown)
+        shutil.copy(fname+".idx",stale+".idx")
+        check_reader(stale,grown,False)         # the index is for a different size
+
+        bulk_extractor = built("bulk_extractor")
+        if bulk_extractor:
+            image = os.path.join(tmpdir,"image.raw")
+            with open(image,"wb") as f:
+                for i in range(64):
+                    f.write(b"\0"*(1000+i*37))
+                    f.write("From: user{}@example.com\r\n".format(i%20).encode('ascii'))
+            outdir = os.path.join(tmpdir,"out")
+            run([bulk_extractor,"-E","email","-o",outdir,image])
+            written = os.path.join(outdir,"email.txt")
+            same("bulk_extractor's email.txt.idx differs from the documented layout",
+                 expected_index(open(written,"rb").read()),open(written+".idx","rb").read())
+        else:
+            print("bulk_extractor has not been built; its index was not checked")
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASS")
@@ -0,0 +1,64 @@
+# coding=UTF-8
+"""
+Helpers for the fixture tests run by make check (*_test.py).
+
+Each test compares a program in src/ with its fixture in tests/ or with
+the Python tool it replaces. A test whose program has not been built is
+skipped with automake's exit status 77.
+
+The programs are looked for in $BE_SRC, which make check sets to the
+build's src directory, and otherwise in ../src beside this directory.
+"""
+
+import os,sys,difflib
+from subprocess import Popen,PIPE
+
+SKIP = 77
+tests_dir  = os.path.dirname(os.path.abspath(__file__))
+python_dir = os.getenv("BE_PYTHON") or os.path.join(tests_dir,"..","python")
+
+def fixture(*parts):
+    """Return the path of a file in the fixtures"""
+    return os.path.join(tests_dir,*parts)
+
+def built(name):
+    """Return the path of a built program, or None"""
+    exe = os.path.join(os.getenv("BE_SRC") or os.path.join(tests_dir,"..","src"),name)
+    return exe if os.path.exists(exe) else None
+
+def program(name):
+    """Return the path of a built program, or skip the test"""
+    exe = built(name)
+    if not exe:
+        print("SKIP: {} has not been built".format(name))
+        sys.exit(SKIP)
+    return exe
+
+def python_tool(name):
+    return os.path.join(python_dir,name)
+
+def run(cmd,stdin=None,cwd=None):
+    """Run cmd and return its stdout as bytes; fail the test if it fails"""
+    p = Popen(cmd,stdin=PIPE,stdout=PIPE,stderr=PIPE,cwd=cwd)
+    (out,errout) = p.communicate(stdin)
+    if p.returncode!=0:
+        sys.stderr.write(errout.decode('utf-8','replace'))
+        fail("{} exited with status {}".format(" ".join(cmd),p.returncode))
+    return out
+
+def fail(msg):
+    print("FAIL: "+msg)
+    sys.exit(1)
+
+def same(what,expected,got):
+    """Fail with a diff (or the first differing byte, for binary data) unless expected and got (bytes) are the same"""
+    if expected==got: return
+    if b"\0" in expected or b"\0" in got:
+        n = 0
+        while n<min(len(expected),len(got)) and expected[n]==got[n]: n += 1
+        fail("{} (at byte {}; {} bytes expected, {} bytes got)".format(what,n,len(expected),len(got)))
+    diff = difflib.unified_diff(expected.decode('utf-8','replace').splitlines(True),
+                                got.decode('utf-8','replace').splitlines(True),
+                                "expected","got")
+    sys.stdout.write("".join(diff))
+    fail(what)
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+identify_filenames fixture test.
+
+identify_filenames/fiwalk.xml describes allocated and unallocated files,
+a file with a UTF-8 name, one with only a SHA1, one with a fill run,
+an $OrphanFiles entry and an empty file. The feature files in
+identify_filenames/report have features at the edges of their byte
+runs, in gaps, and in XOR, XOR(0x5a), GZIP and nested paths.
+
+identify_filenames, in full and terse (-t) output, must write the
+annotated files in identify_filenames/expected and expected_terse, as
+must python/identify_filenames.py. The processing time line is left out
+of the comparison.
+"""
+
+import os,sys,shutil,tempfile
+from fixture import *
+
+TIMING = b"# Total processing time:"
+
+def annotated(fname):
+    with open(fname,"rb") as f:
+        return b"".join(line for line in f if not line.startswith(TIMING))
+
+if __name__=="__main__":
+    identify_filenames = program("identify_filenames")
+    tmpdir = tempfile.mkdtemp()
+    try:
+        for (opts,expected) in (([],"expected"),(["-t"],"expected_terse")):
+            native = os.path.join(tmpdir,"native"+expected)
+            py     = os.path.join(tmpdir,"python"+expected)
+            run([identify_filenames]+opts+["-a","-x","identify_filenames/fiwalk.xml",
+                                           "identify_filenames/report",native],cwd=tests_dir)
+            run([sys.executable,python_tool("identify_filenames.py")]+opts+
+                ["--all","--xmlfile","identify_filenames/fiwalk.xml","identify_filenames/report",py],cwd=tests_dir)
+            for name in sorted(os.listdir(fixture("identify_filenames",expected))):
+                want = annotated(fixture("identify_filenames",expected,name))
+                same("identify_filenames {} {} differs from {}".format(" ".join(opts),name,expected),
+                     want,annotated(os.path.join(native,name)))
+                same("identify_filenames.py {} {} differs from {}".format(" ".join(opts),name,expected),
+                     want,annotated(os.path.join(py,name)))
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASS")
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+Page cache (-K) fixture test.
+
+The image is built from 64KiB pages, one of which repeats byte for byte
+in a run of four, so with -G 64k -g 4k the second and third copies are
+repeats of the first (the fourth's margin differs) and a fifth copy at
+the end of the image is not (its margin is shorter). Each page has
+emails at its start, in its middle, and just before its end so that
+only the context reaches into the margin. It ends with a JSON object
+holding an email, both of which run into the margin, so the object is
+reported where it ends, in the next page: the page before the first
+copy reports an object inside the first copy, and each copy reports one
+inside the page after it.
+
+With -E email, every feature file and histogram written with -K must
+have the same lines as one written by a scan without it (the order of
+lines written by different threads is not compared), and report.xml
+must count the two repeats. The json scanner's features cannot be
+replayed, so with it enabled -K must not be used, and the output must
+again be that of a scan without -K.
+"""
+
+import os,sys,re,shutil,tempfile
+from fixture import *
+
+PAGE   = 65536
+MARGIN = 4096
+
+HEAD = b'example.com","a":1,"b":2,"c":3}\r\n'
+
+def page(tag,seed):
+    """A page of filler with emails at its start, in its middle and near
+    its end, ending in a JSON object. Every page starts with HEAD, which
+    ends the object and the email in it begun by the page before."""
+    buf = bytearray((seed*7+i*13)%251 for i in range(PAGE))
+    def put(offset,text):
+        buf[offset:offset+len(text)] = text.encode('ascii')
+    buf[0:len(HEAD)] = HEAD
+    put(len(HEAD), "From: {}-first@example.com\r\n".format(tag))
+    put(30000,     "To: {}-middle@example.org, other@example.net\r\n".format(tag))
+    edge = '{{"from":"{}-edge@'.format(tag)
+    put(PAGE-len(edge)-40,"Cc: {}-context@example.com\r\n".format(tag))
+    put(PAGE-len(edge),edge)
+    return bytes(buf)
+
+def lines(fname):
+    with open(fname,"rb") as f:
+        return sorted(line for line in f if not line.startswith(b"#") and not line.startswith(b"\xef\xbb\xbf#"))
+
+if __name__=="__main__":
+    bulk_extractor = program("bulk_extractor")
+    tmpdir = tempfile.mkdtemp()
+    try:
+        repeated = page("repeat",1)
+        pages = [page("first",2),repeated,repeated,repeated,repeated,page("other",3),repeated]
+        image = os.path.join(tmpdir,"image.raw")
+        with open(image,"wb") as f:
+            f.write(b"".join(pages)+HEAD)
+
+        def scan(name,opts):
+            outdir = os.path.join(tmpdir,name)
+            run([bulk_extractor,"-G",str(PAGE),"-g",str(MARGIN)]+opts+["-o",outdir,image])
+            return outdir
+
+        def page_cache_hits(outdir):
+            m = re.search(b"<page_cache_hits>([0-9]+)</page_cache_hits>",
+                          open(os.path.join(outdir,"report.xml"),"rb").read())
+            return int(m.group(1)) if m else None
+
+        def compare(scanned,cached,opts):
+            names = sorted(n for n in os.listdir(scanned) if n.endswith(".txt"))
+            if sorted(n for n in os.listdir(cached) if n.endswith(".txt"))!=names:
+                fail("-K {} wrote different feature files: {}".format(" ".join(opts),sorted(os.listdir(cached))))
+            for name in names:
+                same("{} with -K {} differs from a scan without it".format(name," ".join(opts)),
+                     b"".join(lines(os.path.join(scanned,name))),b"".join(lines(os.path.join(cached,name))))
+
+        opts = ["-E","email"]
+        scanned = scan("email",opts)
+        if not os.path.getsize(os.path.join(scanned,"email.txt")):
+            fail("no emails were found")
+        cached = scan("email-K",["-K"]+opts)
+        compare(scanned,cached,opts)
+        if page_cache_hits(cached)!=2:
+            fail("report.xml counts {} page cache hits, not 2".format(page_cache_hits(cached)))
+
+        opts = ["-E","json","-e","email"]
+        scanned = scan("json",opts)
+        if len(lines(os.path.join(scanned,"json.txt")))!=len(pages):
+            fail("{} JSON objects were found, not {}".format(len(lines(os.path.join(scanned,"json.txt"))),len(pages)))
+        cached = scan("json-K",["-K"]+opts)
+        compare(scanned,cached,opts)
+        if page_cache_hits(cached) is not None:
+            fail("-K was used with the json scanner")
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASS")
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# coding=UTF-8
+"""
+Path cache fixture test.
+
+The image holds a GZIP stream, a ZIP file with two members and a GZIP
+stream of another such ZIP file. bulk_extractor -p - resolves a list of
+paths into them in one run, so that later paths start from the buffers
+cached for earlier ones: paths into both ZIP members (the second is
+found by offsetting past the end of the first, which the decoder then
+gives it), into the GZIP stream and past its end, and into the ZIP
+inside the GZIP stream. The output of that run must be the output of
+resolving each path in a run of its own, with an empty cache.
+"""
+
+import io,os,sys,gzip,zipfile,shutil,tempfile
+from fixture import *
+
+HEADER = b"Path Interactive Mode:\n"
+
+def text(n,seed):
+    return "".join("line {} of {}\n".format(i,seed) for i in range(n)).encode('ascii')
+
+def zip_file(small,large):
+    """A ZIP file whose first member is smaller than its second"""
+    f = io.BytesIO()
+    with zipfile.ZipFile(f,"w",zipfile.ZIP_DEFLATED) as z:
+        z.writestr("first.txt",small)
+        z.writestr("second.txt",large)
+    return f.getvalue()
+
+def resolve(bulk_extractor,image,paths):
+    out = run([bulk_extractor,"-p","-",image],stdin=b"".join(p.encode('ascii')+b"\n" for p in paths)+b".\n")
+    if not out.startswith(HEADER): fail("-p - printed {!r}".format(out[:80]))
+    return out[len(HEADER):]
+
+if __name__=="__main__":
+    bulk_extractor = program("bulk_extractor")
+    tmpdir = tempfile.mkdtemp()
+    try:
+        parts = [b"\0"*4096,gzip.compress(text(2000,"gzip")),
+                 b"\0"*4096,zip_file(text(10,"zip first"),text(500,"zip second")),
+                 b"\0"*4096,gzip.compress(zip_file(text(20,"nested first"),text(300,"nested second")))]
+        offsets = [sum(len(p) for p in parts[:i]) for i in range(len(parts))]
+        image = os.path.join(tmpdir,"image.raw")
+        with open(image,"wb") as f:
+            f.write(b"".join(parts))
+
+        gz,zp,nested = offsets[1],offsets[3],offsets[5]
+        paths = ["{}-ZIP-2000".format(zp),               # past the first member, into the second
+                 "{}-ZIP-0".format(zp),                  # caches the first member
+                 "{}-ZIP-2000".format(zp),               # fails from the cache, decodes again
+                 "{}-ZIP-100".format(zp),
+                 "{}-GZIP-5000".format(gz),
+                 "{}-GZIP-100".format(gz),
+                 "{}-GZIP-1000000".format(gz),           # past the end of the stream
+                 "{}-GZIP-0-ZIP-50".format(nested),
+                 "{}-GZIP-0-ZIP-2000".format(nested),
+                 "{}-GZIP-0-ZIP-0".format(nested),
+                 "{}-GZIP-0-ZIP-2000".format(nested),
+                 "{}-ZIP-2000".format(zp)]
+        alone = b""
+        for path in paths:
+            out = resolve(bulk_extractor,image,[path])
+            if not out: fail("{} printed nothing".format(path))
+            alone += out
+        same("resolving the paths in one run differs from resolving each alone",
+             alone,resolve(bulk_extractor,image,paths))
+    finally:
+        shutil.rmtree(tmpdir)
+    print("PASS")